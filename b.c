@@ -1,189 +1,323 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "b.h"
+#include "scan.h"
+#include "opt.h"
 #include "targets/x86/b2as.c"
+#include "targets/x86_64/sysv.c"
+#include "targets/x86/fncache.c"
+#include "targets/c/b2c.c"
 
 ASTNodeList *top_level_funcs = NULL;
 // Add a global variable for the current filename
 const char *current_filename = NULL;
 // --- Utility Functions ---
 ASTNode *make_node(ASTNodeType type);
-ASTNodeList *append_node(ASTNodeList *list, ASTNode *node);
-void free_ast(ASTNode *node);
+void append_node(ASTNodeList *list, ASTNode *node);
 void print_ast(ASTNode *node, int indent);
 
-// --- Parser State ---
-typedef struct {
-    const char *src;
-    size_t pos;
-    int line;
-    int col;
-    int cur;
-} Parser;
-
-void parser_init(Parser *p, const char *src);
-int parser_peek(Parser *p);
-int parser_next(Parser *p);
-void parser_skip_ws(Parser *p);
-int parser_match(Parser *p, const char *kw);
+// --- Parser Functions ---
+Token *parser_peek(Parser *p);
+Token *parser_next(Parser *p);
+int parser_accept(Parser *p, Operator op);
+int parser_match(Parser *p, Keyword kw);
 void parser_error(Parser *p, const char *msg);
 
-// --- Parser Functions (to be implemented) ---
-ASTNode *parse_program(Parser *p);
+// --- Source input ---
+// Regular files are mapped read-only; the zero fill past EOF in the last
+// page doubles as the NUL sentinel the lexer relies on. Pipes, terminals and
+// files that end exactly on a page boundary are read into a growing buffer.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t map_len;    // nonzero when data is an mmap
+} SourceText;
+
+static int source_read_stream(SourceText *t, int fd) {
+    size_t cap = 64 * 1024;
+    t->data = (char*)malloc(cap);
+    t->len = 0;
+    t->map_len = 0;
+    if (!t->data) return -1;
+    for (;;) {
+        if (cap - t->len < 2) {
+            char *grown = (char*)realloc(t->data, cap * 2);
+            if (!grown) { free(t->data); return -1; }
+            t->data = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, t->data + t->len, cap - t->len - 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            free(t->data);
+            return -1;
+        }
+        if (n == 0) break;
+        t->len += (size_t)n;
+    }
+    t->data[t->len] = 0;
+    return 0;
+}
+
+// Open `path` ("-" for stdin) as a NUL-terminated buffer
+static int source_open(SourceText *t, const char *path) {
+    if (strcmp(path, "-") == 0) return source_read_stream(t, STDIN_FILENO);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    long page = sysconf(_SC_PAGESIZE);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        st.st_size % page != 0) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            close(fd);
+            t->data = (char*)m;
+            t->len = (size_t)st.st_size;
+            t->map_len = (size_t)st.st_size;
+            return 0;
+        }
+    }
+    int rc = source_read_stream(t, fd);
+    close(fd);
+    return rc;
+}
+
+static void source_close(SourceText *t) {
+    if (t->map_len) munmap(t->data, t->map_len);
+    else free(t->data);
+    t->data = NULL;
+}
 
 // --- Main ---
 int main(int argc, char **argv) {
     int dump_asm = 0;
+    int emit_c = 0;
+    int peephole_stats = 0;
+    int dce_stats = 0;
+    int cache_stats = 0;
     const char *filename = NULL;
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s [-S] <file.b>\n", argv[0]);
-        return 1;
+    // Target the machine the compiler runs on unless told otherwise
+    x86_mode64 = sizeof(void*) == 8;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-S") == 0) {
+            dump_asm = 1;
+        } else if (strcmp(argv[i], "-emit=c") == 0 || strcmp(argv[i], "-emit=x86") == 0) {
+            emit_c = argv[i][6] == 'c';
+        } else if (strcmp(argv[i], "-m32") == 0 || strcmp(argv[i], "-m64") == 0) {
+            x86_mode64 = argv[i][2] == '6';
+        } else if (strcmp(argv[i], "-fverbose-asm") == 0) {
+            asm_compact = 0;
+        } else if (strcmp(argv[i], "-fno-verbose-asm") == 0) {
+            asm_compact = 1;
+        } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0) {
+            opt_level = argv[i][2] - '0';
+        } else if (strncmp(argv[i], "-finline-limit=", 15) == 0) {
+            inline_limit = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "-funroll-factor=", 16) == 0) {
+            unroll_factor = atoi(argv[i] + 16);
+        } else if (strcmp(argv[i], "-fomit-frame-pointer") == 0) {
+            omit_frame_pointer = 1;
+        } else if (strcmp(argv[i], "-fdrop-unused-globals") == 0) {
+            drop_unused_globals = 1;
+        } else if (strcmp(argv[i], "-fdce-stats") == 0) {
+            dce_stats = 1;
+        } else if (strncmp(argv[i], "-fcache-dir=", 12) == 0) {
+            fn_cache_dir = argv[i] + 12;
+        } else if (strcmp(argv[i], "-fcache-stats") == 0) {
+            cache_stats = 1;
+        } else if (strcmp(argv[i], "-fpeephole-stats") == 0) {
+            peephole_stats = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] != 0) {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            filename = NULL;
+            break;
+        } else if (!filename) {
+            filename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
     }
-    if (argc == 3 && strcmp(argv[1], "-S") == 0) {
-        dump_asm = 1;
-        filename = argv[2];
-    } else if (argc == 2) {
-        filename = argv[1];
-    } else {
-        fprintf(stderr, "Usage: %s [-S] <file.b>\n", argv[0]);
+    if (!filename) {
+        fprintf(stderr, "Usage: %s [-S] [-emit=c|x86] [-m32|-m64] [-O0|-O1] [-finline-limit=N] [-funroll-factor=N] [-fomit-frame-pointer] [-fdrop-unused-globals] [-fno-verbose-asm] [-fcache-dir=DIR] [-fcache-stats] [-fdce-stats] [-fpeephole-stats] <file.b | ->\n", argv[0]);
         return 1;
     }
-    FILE *f = fopen(filename, "r");
-    if (!f) {
+    SourceText text;
+    if (source_open(&text, filename) != 0) {
         fprintf(stderr, "Could not open %s\n", filename);
         return 1;
     }
-    fseek(f, 0, SEEK_END);
-    long len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char *src = (char*)malloc(len + 1);
-    if (!src) { fclose(f); fprintf(stderr, "Out of memory\n"); return 1; }
-    fread(src, 1, len, f);
-    src[len] = 0;
-    fclose(f);
+    const char *src = text.data;
+    Arena arena;
+    arena_init(&arena);
+    ast_arena = &arena;
     Parser parser;
     parser_init(&parser, src);
     current_filename = filename;
     ASTNode *ast = parse_program(&parser);
+    parser_free(&parser);
     if (ast) {
-        generate_x86(ast, stdout);
-        if (!dump_asm) {
-            print_ast(ast, 0);
+        if (opt_level > 0) {
+            inline_program(ast);
+            fold_program(ast);
+            optimize_loops(ast);
+            long before = dce_stats ? x86_program_size(ast) : 0;
+            prune_program(ast);
+            if (dce_stats)
+                fprintf(stderr, "dce: %d functions, %d statements, %d globals, %ld bytes removed\n",
+                        prune_stats.functions, prune_stats.statements, prune_stats.globals,
+                        before - x86_program_size(ast));
+        }
+        if (emit_c) {
+            generate_c(ast, stdout);
+        } else {
+            generate_x86(ast, stdout);
+            if (!dump_asm) {
+                print_ast(ast, 0);
+            }
         }
-        free_ast(ast);
+        if (peephole_stats)
+            x86_peephole_report(stderr);
+        if (cache_stats)
+            fprintf(stderr, "cache: %d hits, %d misses, %d not cacheable; meta: %d hits, %d misses\n",
+                    fn_cache_stats.hits, fn_cache_stats.misses, fn_cache_stats.skipped,
+                    fn_cache_stats.meta_hits, fn_cache_stats.meta_misses);
     }
-    free(src);
+    ast_arena = NULL;
+    arena_release(&arena);
+    source_close(&text);
     return 0;
 }
 
 // --- Implementations ---
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8
+
+Arena *ast_arena = NULL;
+
+void arena_init(Arena *a) {
+    a->head = NULL;
+}
+void *arena_alloc(Arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaBlock *b = a->head;
+    if (!b || b->size - b->used < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = (ArenaBlock*)malloc(sizeof(ArenaBlock) + block_size);
+        if (!b) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        b->size = block_size;
+        b->used = 0;
+        b->next = a->head;
+        a->head = b;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    memset(p, 0, size);
+    return p;
+}
+void arena_release(Arena *a) {
+    for (ArenaBlock *b = a->head; b;) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+}
+
+// --- Intern table ---
+// Open-addressed hash from name to id. Names live in their own arena that is
+// never released, since ids must stay valid across nested meta compilations.
+static Arena intern_arena;
+static const char **sym_names = NULL;   // id -> name (id 0 is SYM_NONE)
+static unsigned *sym_hashes = NULL;     // id -> hash
+static unsigned *sym_lengths = NULL;    // id -> strlen of the name
+static int num_syms = 1;
+static int sym_capacity = 0;
+static SymId *intern_slots = NULL;      // hash slot -> id, 0 if empty
+static unsigned intern_mask = 0;
+
+static unsigned hash_name(const char *name, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void intern_grow(void) {
+    unsigned size = intern_mask ? (intern_mask + 1) * 2 : 1024;
+    free(intern_slots);
+    intern_slots = (SymId*)calloc(size, sizeof(SymId));
+    intern_mask = size - 1;
+    for (SymId id = 1; id < num_syms; id++) {
+        unsigned slot = sym_hashes[id] & intern_mask;
+        while (intern_slots[slot]) slot = (slot + 1) & intern_mask;
+        intern_slots[slot] = id;
+    }
+}
+
+SymId intern_name(const char *name, size_t len) {
+    // Keep the load factor at or below one half
+    if ((unsigned)num_syms * 2 >= intern_mask) intern_grow();
+    unsigned h = hash_name(name, len);
+    unsigned slot = h & intern_mask;
+    while (intern_slots[slot]) {
+        SymId id = intern_slots[slot];
+        if (sym_hashes[id] == h && strncmp(sym_names[id], name, len) == 0 && sym_names[id][len] == 0)
+            return id;
+        slot = (slot + 1) & intern_mask;
+    }
+    if (num_syms == sym_capacity || !sym_names) {
+        sym_capacity = sym_capacity ? sym_capacity * 2 : 1024;
+        sym_names = (const char**)realloc(sym_names, sym_capacity * sizeof(char*));
+        sym_hashes = (unsigned*)realloc(sym_hashes, sym_capacity * sizeof(unsigned));
+        sym_lengths = (unsigned*)realloc(sym_lengths, sym_capacity * sizeof(unsigned));
+        sym_names[SYM_NONE] = NULL;
+        sym_lengths[SYM_NONE] = 0;
+    }
+    char *copy = (char*)arena_alloc(&intern_arena, len + 1);
+    memcpy(copy, name, len);
+    SymId id = num_syms++;
+    sym_names[id] = copy;
+    sym_hashes[id] = h;
+    sym_lengths[id] = (unsigned)len;
+    intern_slots[slot] = id;
+    return id;
+}
+const char *symbol_name(SymId id) {
+    return sym_names[id];
+}
+size_t symbol_length(SymId id) {
+    return sym_lengths[id];
+}
+int symbol_count(void) {
+    return num_syms;
+}
+
 ASTNode *make_node(ASTNodeType type) {
-    ASTNode *n = (ASTNode*)calloc(1, sizeof(ASTNode));
+    ASTNode *n = (ASTNode*)arena_alloc(ast_arena, sizeof(ASTNode));
     n->type = type;
     return n;
 }
-ASTNodeList *append_node(ASTNodeList *list, ASTNode *node) {
-    ASTNodeList *item = (ASTNodeList*)calloc(1, sizeof(ASTNodeList));
-    item->node = node;
-    if (!list) return item;
-    ASTNodeList *cur = list;
-    while (cur->next) cur = cur->next;
-    cur->next = item;
-    return list;
-}
-void free_ast(ASTNode *node) {
-    if (!node) return;
-    switch (node->type) {
-        case AST_PROGRAM:
-            for (ASTNodeList *l = node->data.program.functions; l;) {
-                ASTNodeList *n = l->next;
-                free_ast(l->node); free(l); l = n;
-            }
-            break;
-        case AST_FUNCTION:
-            free(node->data.function.name);
-            for (ASTNodeList *l = node->data.function.params; l;) {
-                ASTNodeList *n = l->next;
-                free_ast(l->node); free(l); l = n;
-            }
-            free_ast(node->data.function.body);
-            break;
-        case AST_BLOCK:
-            for (ASTNodeList *l = node->data.block.statements; l;) {
-                ASTNodeList *n = l->next;
-                free_ast(l->node); free(l); l = n;
-            }
-            break;
-        case AST_STATEMENT:
-            free_ast(node->data.statement.stmt);
-            break;
-        case AST_IF:
-            free_ast(node->data.if_stmt.cond);
-            free_ast(node->data.if_stmt.then_branch);
-            free_ast(node->data.if_stmt.else_branch);
-            break;
-        case AST_WHILE:
-            free_ast(node->data.while_stmt.cond);
-            free_ast(node->data.while_stmt.body);
-            break;
-        case AST_RETURN:
-            free_ast(node->data.ret.expr);
-            break;
-        case AST_ASSIGN:
-            free_ast(node->data.assign.var);
-            free_ast(node->data.assign.expr);
-            break;
-        case AST_BINOP:
-            free(node->data.binop.op);
-            free_ast(node->data.binop.left);
-            free_ast(node->data.binop.right);
-            break;
-        case AST_UNOP:
-            free(node->data.unop.op);
-            free_ast(node->data.unop.expr);
-            break;
-        case AST_CALL:
-            free(node->data.call.name);
-            for (ASTNodeList *l = node->data.call.args; l;) {
-                ASTNodeList *n = l->next;
-                free_ast(l->node); free(l); l = n;
-            }
-            free_ast(node->data.call.left);
-            break;
-        case AST_VAR:
-            free(node->data.var.name);
-            break;
-        case AST_STRING:
-            free(node->data.string_lit.value);
-            break;
-        case AST_EXTERN:
-            free(node->data.ext.name);
-            break;
-        case AST_INDEX:
-            free_ast(node->data.index.array);
-            free_ast(node->data.index.index);
-            break;
-        case AST_GLOBAL:
-            free(node->data.global.name);
-            free_ast(node->data.global.init);
-            break;
-        case AST_LABEL:
-            free(node->data.label.label);
-            break;
-        case AST_GOTO:
-            free(node->data.go.label);
-            break;
-        case AST_META:
-            free(node->data.meta.content);
-            break;
-        case AST_VAR_DECL:
-            free(node->data.var_decl.name);
-            break;
-        default: break;
+// Append in amortized O(1); a grown vector leaves its old storage in the arena
+void append_node(ASTNodeList *list, ASTNode *node) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 4;
+        ASTNode **items = (ASTNode**)arena_alloc(ast_arena, capacity * sizeof(ASTNode*));
+        if (list->count) memcpy(items, list->items, list->count * sizeof(ASTNode*));
+        list->items = items;
+        list->capacity = capacity;
     }
-    free(node);
+    list->items[list->count++] = node;
 }
 void print_indent(int n) { while (n--) putchar(' '); }
 void print_ast(ASTNode *node, int indent) {
@@ -192,17 +326,17 @@ void print_ast(ASTNode *node, int indent) {
     switch (node->type) {
         case AST_PROGRAM:
             printf("Program\n");
-            for (ASTNodeList *l = node->data.program.functions; l; l = l->next)
-                print_ast(l->node, indent+2);
+            for (int i = 0; i < node->data.program.functions.count; ++i)
+                print_ast(node->data.program.functions.items[i], indent+2);
             break;
         case AST_FUNCTION:
-            printf("Function: %s\n", node->data.function.name);
+            printf("Function: %s\n", symbol_name(node->data.function.name));
             print_ast(node->data.function.body, indent+2);
             break;
         case AST_BLOCK:
             printf("Block\n");
-            for (ASTNodeList *l = node->data.block.statements; l; l = l->next)
-                print_ast(l->node, indent+2);
+            for (int i = 0; i < node->data.block.statements.count; ++i)
+                print_ast(node->data.block.statements.items[i], indent+2);
             break;
         case AST_STATEMENT:
             printf("Statement\n");
@@ -238,12 +372,12 @@ void print_ast(ASTNode *node, int indent) {
             print_ast(node->data.assign.expr, indent+4);
             break;
         case AST_BINOP:
-            printf("BinOp: %s\n", node->data.binop.op);
+            printf("BinOp: %s\n", op_text[node->data.binop.op]);
             print_ast(node->data.binop.left, indent+2);
             print_ast(node->data.binop.right, indent+2);
             break;
         case AST_UNOP:
-            printf("UnOp: %s\n", node->data.unop.op);
+            printf("UnOp: %s\n", op_text[node->data.unop.op]);
             print_ast(node->data.unop.expr, indent+2);
             break;
         case AST_CALL:
@@ -251,16 +385,16 @@ void print_ast(ASTNode *node, int indent) {
                 printf("Call (pexpr):\n");
                 print_ast(node->data.call.left, indent+2);
                 print_indent(indent+2); printf("Args:\n");
-                for (ASTNodeList *l = node->data.call.args; l; l = l->next)
-                    print_ast(l->node, indent+4);
+                for (int i = 0; i < node->data.call.args.count; ++i)
+                    print_ast(node->data.call.args.items[i], indent+4);
             } else {
-                printf("Call: %s\n", node->data.call.name ? node->data.call.name : "(pexpr)");
-                for (ASTNodeList *l = node->data.call.args; l; l = l->next)
-                    print_ast(l->node, indent+2);
+                printf("Call: %s\n", node->data.call.name ? symbol_name(node->data.call.name) : "(pexpr)");
+                for (int i = 0; i < node->data.call.args.count; ++i)
+                    print_ast(node->data.call.args.items[i], indent+2);
             }
             break;
         case AST_VAR:
-            printf("Var: %s\n", node->data.var.name);
+            printf("Var: %s\n", symbol_name(node->data.var.name));
             break;
         case AST_NUM:
             printf("Num: %d\n", node->data.num.value);
@@ -281,7 +415,7 @@ void print_ast(ASTNode *node, int indent) {
             printf("Empty\n");
             break;
         case AST_EXTERN:
-            printf("Extern: %s%s\n", node->data.ext.name, node->data.ext.is_func ? "()" : "");
+            printf("Extern: %s%s\n", symbol_name(node->data.ext.name), node->data.ext.is_func ? "()" : "");
             break;
         case AST_INDEX:
             printf("Index\n");
@@ -291,7 +425,7 @@ void print_ast(ASTNode *node, int indent) {
             print_ast(node->data.index.index, indent+4);
             break;
         case AST_GLOBAL:
-            printf("Global: %s", node->data.global.name);
+            printf("Global: %s", symbol_name(node->data.global.name));
             if (node->data.global.init) {
                 printf(" = ");
                 print_ast(node->data.global.init, 0);
@@ -301,77 +435,274 @@ void print_ast(ASTNode *node, int indent) {
             printf("\n");
             break;
         case AST_LABEL:
-            printf("Label: %s\n", node->data.label.label);
+            printf("Label: %s\n", symbol_name(node->data.label.label));
             break;
         case AST_GOTO:
-            printf("Goto: %s\n", node->data.go.label);
+            printf("Goto: %s\n", symbol_name(node->data.go.label));
             break;
         case AST_META:
             printf("Meta: %s\n", node->data.meta.content);
             break;
         case AST_VAR_DECL:
-            printf("VarDecl: %s\n", node->data.var_decl.name);
+            printf("VarDecl: %s\n", symbol_name(node->data.var_decl.name));
             break;
         default:
             printf("(Unknown node, type=%d)\n", node->type);
     }
 }
 
-// --- Parser State Functions ---
-void parser_init(Parser *p, const char *src) {
-    p->src = src;
-    p->pos = 0;
-    p->line = 1;
-    p->col = 1;
-    p->cur = src[0];
+// --- Lexer ---
+// Scans the whole source once into p->toks. Keywords and operators are
+// classified here, so the parser never looks at their spelling again.
+
+const char *const op_text[OP_COUNT] = {
+    [OP_NONE] = "", [OP_ASSIGN] = "=", [OP_OR] = "||", [OP_AND] = "&&",
+    [OP_EQ] = "==", [OP_NE] = "!=", [OP_GE] = ">=", [OP_LE] = "<=",
+    [OP_SHR] = ">>", [OP_SHL] = "<<", [OP_GT] = ">", [OP_LT] = "<",
+    [OP_ADD] = "+", [OP_SUB] = "-", [OP_BITAND] = "&", [OP_XOR] = "^",
+    [OP_BITOR] = "|", [OP_MUL] = "*", [OP_DIV] = "/", [OP_MOD] = "%",
+    [OP_NOT] = "!", [OP_INC] = "++", [OP_DEC] = "--",
+    [OP_LPAREN] = "(", [OP_RPAREN] = ")", [OP_LBRACE] = "{", [OP_RBRACE] = "}",
+    [OP_LBRACKET] = "[", [OP_RBRACKET] = "]", [OP_SEMI] = ";", [OP_COMMA] = ",",
+    [OP_COLON] = ":"
+};
+
+const signed char op_prec[OP_COUNT] = {
+    [OP_NONE] = -1, [OP_ASSIGN] = 0, [OP_OR] = 1, [OP_AND] = 2,
+    [OP_EQ] = 3, [OP_NE] = 3,
+    [OP_GE] = 4, [OP_LE] = 4, [OP_SHR] = 4, [OP_SHL] = 4, [OP_GT] = 4, [OP_LT] = 4,
+    [OP_ADD] = 5, [OP_SUB] = 5,
+    [OP_BITAND] = 7, [OP_XOR] = 8, [OP_BITOR] = 9,
+    [OP_MUL] = 10, [OP_DIV] = 10, [OP_MOD] = 10,
+    [OP_NOT] = -1, [OP_INC] = -1, [OP_DEC] = -1,
+    [OP_LPAREN] = -1, [OP_RPAREN] = -1, [OP_LBRACE] = -1, [OP_RBRACE] = -1,
+    [OP_LBRACKET] = -1, [OP_RBRACKET] = -1, [OP_SEMI] = -1, [OP_COMMA] = -1,
+    [OP_COLON] = -1
+};
+
+// Keyword recognizer: dispatch on length and first byte, then one compare
+static int classify_keyword(const char *s, size_t len) {
+    #define KW(text, kw) (memcmp(s, text, len) == 0 ? (int)(kw) : -1)
+    switch (len) {
+        case 2: return s[0] == 'i' ? KW("if", KW_IF) : -1;
+        case 4:
+            switch (s[0]) {
+                case 'e': return KW("else", KW_ELSE);
+                case 'a': return KW("auto", KW_AUTO);
+                case 'g': return KW("goto", KW_GOTO);
+                case 'm': return KW("meta", KW_META);
+            }
+            return -1;
+        case 5:
+            switch (s[0]) {
+                case 'w': return KW("while", KW_WHILE);
+                case 'b': return KW("break", KW_BREAK);
+            }
+            return -1;
+        case 6:
+            switch (s[0]) {
+                case 'r': return KW("return", KW_RETURN);
+                case 'e': return KW("extern", KW_EXTERN);
+            }
+            return -1;
+        case 8: return s[0] == 'c' ? KW("continue", KW_CONTINUE) : -1;
+    }
+    return -1;
+    #undef KW
 }
-int parser_peek(Parser *p) {
-    return p->cur;
+
+// Operator recognizer: a switch on the first byte, peeking at the second.
+// Returns OP_NONE for bytes that start no operator; *len gets the length.
+static Operator classify_operator(const char *s, int *len) {
+    #define PAIR(second, two, one) (s[1] == (second) ? (*len = 2, (two)) : (one))
+    *len = 1;
+    switch (s[0]) {
+        case '=': return PAIR('=', OP_EQ, OP_ASSIGN);
+        case '!': return PAIR('=', OP_NE, OP_NOT);
+        case '>': return s[1] == '=' ? (*len = 2, OP_GE) : PAIR('>', OP_SHR, OP_GT);
+        case '<': return s[1] == '=' ? (*len = 2, OP_LE) : PAIR('<', OP_SHL, OP_LT);
+        case '|': return PAIR('|', OP_OR, OP_BITOR);
+        case '&': return PAIR('&', OP_AND, OP_BITAND);
+        case '+': return PAIR('+', OP_INC, OP_ADD);
+        case '-': return PAIR('-', OP_DEC, OP_SUB);
+        case '^': return OP_XOR;
+        case '*': return OP_MUL;
+        case '/': return OP_DIV;
+        case '%': return OP_MOD;
+        case '(': return OP_LPAREN;
+        case ')': return OP_RPAREN;
+        case '{': return OP_LBRACE;
+        case '}': return OP_RBRACE;
+        case '[': return OP_LBRACKET;
+        case ']': return OP_RBRACKET;
+        case ';': return OP_SEMI;
+        case ',': return OP_COMMA;
+        case ':': return OP_COLON;
+    }
+    return OP_NONE;
+    #undef PAIR
 }
-int parser_next(Parser *p) {
-    if (p->cur == '\n') { p->line++; p->col = 1; }
-    else p->col++;
-    if (p->src[p->pos]) p->pos++;
-    p->cur = p->src[p->pos];
-    return p->cur;
+
+// Report an error at a byte offset; line and column are only computed here
+static void source_error(const char *src, size_t offset, const char *msg) {
+    int line = 1, col = 1;
+    for (size_t i = 0; i < offset && src[i]; i++) {
+        if (src[i] == '\n') { line++; col = 1; }
+        else col++;
+    }
+    if (current_filename)
+        fprintf(stderr, "Parse error at %s:%d:%d: %s\n", current_filename, line, col, msg);
+    else
+        fprintf(stderr, "Parse error at <input>:%d:%d: %s\n", line, col, msg);
+    exit(1);
 }
-void parser_skip_ws(Parser *p) {
+
+static size_t skip_ws(const char *src, size_t pos) {
     while (1) {
         // Skip whitespace
-        while (isspace(p->cur)) parser_next(p);
+        pos = scan.skip_space(src, pos);
         // Skip C-style comments /* ... */
-        if (p->cur == '/' && p->src[p->pos+1] == '*') {
-            parser_next(p); parser_next(p);
-            while (p->cur && !(p->cur == '*' && p->src[p->pos+1] == '/')) {
-                parser_next(p);
-            }
-            if (p->cur) { parser_next(p); parser_next(p); }
+        if (src[pos] == '/' && src[pos+1] == '*') {
+            pos = scan.find_comment_end(src, pos + 2);
+            if (src[pos]) pos += 2;
             continue;
         }
         // Skip C++-style comments // ...
-        if (p->cur == '/' && p->src[p->pos+1] == '/') {
-            parser_next(p); parser_next(p);
-            while (p->cur && p->cur != '\n') parser_next(p);
+        if (src[pos] == '/' && src[pos+1] == '/') {
+            pos = scan.find_newline(src, pos + 2);
             continue;
         }
-        break;
+        return pos;
     }
 }
-int parser_match(Parser *p, const char *kw) {
-    parser_skip_ws(p);
-    size_t len = strlen(kw);
-    if (strncmp(p->src + p->pos, kw, len) == 0) {
-        for (size_t i = 0; i < len; i++) parser_next(p);
-        return 1;
+
+// Decode one (possibly escaped) character of a literal delimited by quote
+static int lex_escape(const char *src, size_t *pos, char quote) {
+    int c = (unsigned char)src[*pos];
+    if (c == '\\') {
+        (*pos)++;
+        c = (unsigned char)src[*pos];
+        if (c == 'n') c = '\n';
+        else if (c == 't') c = '\t';
+        else if (c == '\\') c = '\\';
+        else if (c == quote) c = quote;
+        else source_error(src, *pos, quote == '"' ? "Unknown escape in string literal" : "Unknown escape in char literal");
     }
-    return 0;
+    (*pos)++;
+    return c;
+}
+
+static void push_token(Parser *p, int *cap, int kind, int value, size_t offset) {
+    if (p->num_toks == *cap) {
+        *cap = *cap ? *cap * 2 : 1024;
+        p->toks = (Token*)realloc(p->toks, *cap * sizeof(Token));
+        if (!p->toks) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    Token *t = &p->toks[p->num_toks++];
+    t->kind = (unsigned char)kind;
+    t->value = value;
+    t->offset = (unsigned)offset;
+}
+
+static void lex_source(Parser *p) {
+    const char *src = p->src;
+    size_t pos = 0;
+    int cap = 0;
+    char *buf = NULL;
+    size_t buf_cap = 0;
+    while (1) {
+        pos = skip_ws(src, pos);
+        size_t start = pos;
+        int c = (unsigned char)src[pos];
+        if (!c) break;
+        if (isalpha(c) || c == '_') {
+            pos = scan.skip_ident(src, pos + 1);
+            int kw = classify_keyword(src + start, pos - start);
+            if (kw >= 0)
+                push_token(p, &cap, TOK_KEYWORD, kw, start);
+            else
+                push_token(p, &cap, TOK_IDENT, intern_name(src + start, pos - start), start);
+        } else if (isdigit(c)) {
+            int val = 0;
+            while (isdigit((unsigned char)src[pos])) val = val * 10 + (src[pos++] - '0');
+            push_token(p, &cap, TOK_NUMBER, val, start);
+        } else if (c == '\'') {
+            pos++;
+            int val = lex_escape(src, &pos, '\'');
+            if (src[pos] != '\'') source_error(src, pos, "Expected ''' to close char literal");
+            pos++;
+            push_token(p, &cap, TOK_CHAR, val, start);
+        } else if (c == '"') {
+            size_t len = 0;
+            pos++;
+            while (src[pos] && src[pos] != '"') {
+                if (len + 1 >= buf_cap) {
+                    buf_cap = buf_cap ? buf_cap * 2 : 256;
+                    buf = (char*)realloc(buf, buf_cap);
+                }
+                buf[len++] = (char)lex_escape(src, &pos, '"');
+            }
+            if (src[pos] != '"') source_error(src, start, "Unterminated string literal");
+            pos++;
+            push_token(p, &cap, TOK_STRING, intern_name(len ? buf : "", len), start);
+        } else {
+            int len;
+            Operator op = classify_operator(src + pos, &len);
+            if (op == OP_NONE) source_error(src, pos, "Unexpected character");
+            pos += len;
+            push_token(p, &cap, TOK_OP, op, start);
+        }
+    }
+    push_token(p, &cap, TOK_EOF, 0, pos);
+    free(buf);
+}
+
+// --- Parser State Functions ---
+void parser_init(Parser *p, const char *src) {
+    scan_init();
+    p->src = src;
+    p->toks = NULL;
+    p->num_toks = 0;
+    p->pos = 0;
+    lex_source(p);
+}
+void parser_free(Parser *p) {
+    free(p->toks);
+    p->toks = NULL;
+    p->num_toks = 0;
+}
+Token *parser_peek(Parser *p) {
+    return &p->toks[p->pos];
+}
+// Lookahead past the current token; the EOF token repeats at the end
+Token *parser_peek_at(Parser *p, int n) {
+    int i = p->pos + n;
+    return &p->toks[i < p->num_toks ? i : p->num_toks - 1];
+}
+Token *parser_next(Parser *p) {
+    Token *t = &p->toks[p->pos];
+    if (t->kind != TOK_EOF) p->pos++;
+    return t;
+}
+// Is the current token the given operator/punctuation?
+int parser_is(Parser *p, Operator op) {
+    Token *t = parser_peek(p);
+    return t->kind == TOK_OP && t->value == (int)op;
+}
+int parser_accept(Parser *p, Operator op) {
+    if (!parser_is(p, op)) return 0;
+    p->pos++;
+    return 1;
+}
+// Consume the current token if it is the given keyword
+int parser_match(Parser *p, Keyword kw) {
+    Token *t = parser_peek(p);
+    if (t->kind != TOK_KEYWORD || t->value != (int)kw) return 0;
+    p->pos++;
+    return 1;
 }
 void parser_error(Parser *p, const char *msg) {
-    if (current_filename)
-        fprintf(stderr, "Parse error at %s:%d:%d: %s\n", current_filename, p->line, p->col, msg);
-    else
-        fprintf(stderr, "Parse error at <input>:%d:%d: %s\n", p->line, p->col, msg);
-    exit(1);
+    source_error(p->src, parser_peek(p)->offset, msg);
 }
 
 // --- Parser Functions ---
@@ -383,108 +714,71 @@ ASTNode *parse_expression(Parser *p);
 ASTNode *parse_primary(Parser *p);
 ASTNode *parse_identifier(Parser *p);
 ASTNode *parse_number(Parser *p);
-ASTNode *parse_call(Parser *p, char *name);
+ASTNode *parse_call(Parser *p, SymId name);
 ASTNode *parse_postfix(Parser *p); // forward declaration
 ASTNode *parse_unary(Parser *p); // forward declaration
-char *parse_name(Parser *p);
+SymId parse_name(Parser *p);
 
-// Helper: allocate and copy string
+// Helper: allocate and copy string (owned by the current arena)
 char *strdup2(const char *src, size_t len) {
-    char *s = (char*)malloc(len+1);
+    char *s = (char*)arena_alloc(ast_arena, len+1);
     memcpy(s, src, len);
     s[len] = 0;
     return s;
 }
 
-// Helper: expect a specific character
-void expect(Parser *p, char c) {
-    parser_skip_ws(p);
-    if (parser_peek(p) != c) {
+// Helper: expect a specific operator or punctuation
+void expect(Parser *p, Operator op) {
+    if (!parser_accept(p, op)) {
         char msg[128];
-        snprintf(msg, sizeof(msg), "Expected '%c', got '%c' at pos=%zu line=%d col=%d", c, parser_peek(p), p->pos, p->line, p->col);
+        Token *t = parser_peek(p);
+        if (t->kind == TOK_EOF)
+            snprintf(msg, sizeof(msg), "Expected '%s', got end of input", op_text[op]);
+        else
+            snprintf(msg, sizeof(msg), "Expected '%s', got '%c'", op_text[op], p->src[t->offset]);
         parser_error(p, msg);
     }
-    parser_next(p);
 }
 
 ASTNode *parse_char_literal(Parser *p) {
-    expect(p, '\'');
-    int c = parser_peek(p);
-    if (c == '\\') {
-        parser_next(p);
-        c = parser_peek(p);
-        if (c == 'n') c = '\n';
-        else if (c == 't') c = '\t';
-        else if (c == '\\') c = '\\';
-        else if (c == '\'') c = '\'';
-        else parser_error(p, "Unknown escape in char literal");
-    }
-    parser_next(p);
-    expect(p, '\'');
+    Token *t = parser_next(p);
     ASTNode *n = make_node(AST_CHAR);
-    n->data.char_lit.value = (char)c;
+    n->data.char_lit.value = (char)t->value;
     return n;
 }
 ASTNode *parse_string_literal(Parser *p) {
-    expect(p, '"');
-    char buf[1024];
-    int i = 0;
-    while (parser_peek(p) && parser_peek(p) != '"') {
-        int c = parser_peek(p);
-        if (c == '\\') {
-            parser_next(p);
-            c = parser_peek(p);
-            if (c == 'n') c = '\n';
-            else if (c == 't') c = '\t';
-            else if (c == '\\') c = '\\';
-            else if (c == '"') c = '"';
-            else parser_error(p, "Unknown escape in string literal");
-        }
-        if (i < 1023) buf[i++] = (char)c;
-        parser_next(p);
-    }
-    buf[i] = 0;
-    expect(p, '"');
+    Token *t = parser_next(p);
     ASTNode *n = make_node(AST_STRING);
-    n->data.string_lit.value = strdup2(buf, strlen(buf));
+    n->data.string_lit.value = symbol_name(t->value);
     return n;
 }
 ASTNode *parse_primary(Parser *p) {
-    parser_skip_ws(p);
-    int c = parser_peek(p);
-    if (c == '\'') return parse_char_literal(p);
-    if (c == '"') return parse_string_literal(p);
+    Token *t = parser_peek(p);
+    if (t->kind == TOK_CHAR) return parse_char_literal(p);
+    if (t->kind == TOK_STRING) return parse_string_literal(p);
     return parse_postfix(p);
 }
 
-// Parse a name (identifier)
-char *parse_name(Parser *p) {
-    parser_skip_ws(p);
-    if (!isalpha(parser_peek(p)) && parser_peek(p) != '_')
+// Parse a name (identifier) and return its interned id
+SymId parse_name(Parser *p) {
+    if (parser_peek(p)->kind != TOK_IDENT)
         parser_error(p, "Expected identifier");
-    size_t start = p->pos;
-    while (isalnum(parser_peek(p)) || parser_peek(p) == '_') parser_next(p);
-    return strdup2(p->src + start, p->pos - start);
+    return parser_next(p)->value;
 }
 
 // Parse a number
 ASTNode *parse_number(Parser *p) {
-    parser_skip_ws(p);
-    int val = 0;
-    if (!isdigit(parser_peek(p))) parser_error(p, "Expected number");
-    while (isdigit(parser_peek(p))) {
-        val = val * 10 + (parser_peek(p) - '0');
-        parser_next(p);
-    }
+    if (parser_peek(p)->kind != TOK_NUMBER) parser_error(p, "Expected number");
     ASTNode *n = make_node(AST_NUM);
-    n->data.num.value = val;
+    n->data.num.value = parser_next(p)->value;
     return n;
 }
 
 // Helper: check if a name is a function name (for function pointer support)
-int is_function_name(const char *name, ASTNodeList *funcs) {
-    for (ASTNodeList *l = funcs; l; l = l->next) {
-        if (l->node->type == AST_FUNCTION && strcmp(l->node->data.function.name, name) == 0)
+int is_function_name(SymId name, ASTNodeList *funcs) {
+    if (!funcs) return 0;
+    for (int i = 0; i < funcs->count; ++i) {
+        if (funcs->items[i]->type == AST_FUNCTION && funcs->items[i]->data.function.name == name)
             return 1;
     }
     return 0;
@@ -492,9 +786,8 @@ int is_function_name(const char *name, ASTNodeList *funcs) {
 
 // Update parse_identifier to allow function names as rvalues
 ASTNode *parse_identifier(Parser *p) {
-    char *name = parse_name(p);
-    parser_skip_ws(p);
-    if (parser_peek(p) == '(') {
+    SymId name = parse_name(p);
+    if (parser_is(p, OP_LPAREN)) {
         return parse_call(p, name);
     } else {
         // Check if this is a function name (function pointer)
@@ -510,186 +803,117 @@ ASTNode *parse_identifier(Parser *p) {
     }
 }
 
-// Parse a function call
-ASTNode *parse_call(Parser *p, char *name) {
-    expect(p, '(');
-    ASTNodeList *args = NULL;
-    parser_skip_ws(p);
-    if (parser_peek(p) != ')') {
+// Parse a parenthesized argument list into args
+static void parse_args(Parser *p, ASTNodeList *args) {
+    expect(p, OP_LPAREN);
+    if (!parser_is(p, OP_RPAREN)) {
         while (1) {
             ASTNode *arg = parse_expression(p);
-            args = append_node(args, arg);
-            parser_skip_ws(p);
-            if (parser_peek(p) == ',') {
-                parser_next(p);
-            } else {
-                break;
-            }
+            append_node(args, arg);
+            if (!parser_accept(p, OP_COMMA)) break;
         }
     }
-    expect(p, ')');
+    expect(p, OP_RPAREN);
+}
+
+// Parse a function call
+ASTNode *parse_call(Parser *p, SymId name) {
     ASTNode *n = make_node(AST_CALL);
     n->data.call.name = name;
-    n->data.call.args = args;
+    parse_args(p, &n->data.call.args);
     return n;
 }
 
 // Refactor parse_primary to always call parse_postfix
 // Refactor parse_postfix to handle all primary expressions
 ASTNode *parse_postfix(Parser *p) {
-    parser_skip_ws(p);
     ASTNode *node = NULL;
-    int c = parser_peek(p);
-    if (isalpha(c) || c == '_') {
-        char *name = parse_name(p);
-        parser_skip_ws(p);
-        if (parser_peek(p) == '(') {
+    Token *t = parser_peek(p);
+    if (t->kind == TOK_IDENT) {
+        SymId name = parse_name(p);
+        if (parser_is(p, OP_LPAREN)) {
             node = parse_call(p, name);
         } else {
             node = make_node(AST_VAR);
             node->data.var.name = name;
         }
-    } else if (c == '(') {
-        parser_next(p);
+    } else if (parser_accept(p, OP_LPAREN)) {
         node = parse_expression(p);
-        expect(p, ')');
-    } else if (isdigit(c)) {
+        expect(p, OP_RPAREN);
+    } else if (t->kind == TOK_NUMBER) {
         node = parse_number(p);
-    } else if (c == '\'' || c == '"') {
-        // Char or string literal
-        if (c == '\'') node = parse_char_literal(p);
-        else node = parse_string_literal(p);
-    } else if (c == '-' || c == '+' || c == '*' || c == '&') {
+    } else if (t->kind == TOK_CHAR) {
+        node = parse_char_literal(p);
+    } else if (t->kind == TOK_STRING) {
+        node = parse_string_literal(p);
+    } else if (t->kind == TOK_OP && (t->value == OP_SUB || t->value == OP_NOT || t->value == OP_MUL ||
+               t->value == OP_BITAND || t->value == OP_INC || t->value == OP_DEC)) {
         node = parse_unary(p);
     } else {
         parser_error(p, "Unexpected character in expression");
         return NULL;
     }
-    parser_skip_ws(p);
     // Allow chains of calls, array accesses, and postfix ++/-- on any expression
     while (1) {
-        if (parser_peek(p) == '(') {
-            expect(p, '(');
-            ASTNodeList *args = NULL;
-            parser_skip_ws(p);
-            if (parser_peek(p) != ')') {
-                while (1) {
-                    ASTNode *arg = parse_expression(p);
-                    args = append_node(args, arg);
-                    parser_skip_ws(p);
-                    if (parser_peek(p) == ',') {
-                        parser_next(p);
-                    } else {
-                        break;
-                    }
-                }
-            }
-            expect(p, ')');
+        if (parser_is(p, OP_LPAREN)) {
             ASTNode *call = make_node(AST_CALL);
-            call->data.call.name = NULL;
-            call->data.call.args = args;
+            call->data.call.name = SYM_NONE;
+            parse_args(p, &call->data.call.args);
             call->data.call.left = node;
             node = call;
-        } else if (parser_peek(p) == '[') {
-            parser_next(p);
+        } else if (parser_accept(p, OP_LBRACKET)) {
             ASTNode *idx = parse_expression(p);
-            expect(p, ']');
+            expect(p, OP_RBRACKET);
             ASTNode *arr = make_node(AST_INDEX);
             arr->data.index.array = node;
             arr->data.index.index = idx;
             node = arr;
-        } else if ((parser_peek(p) == '+' && p->src[p->pos+1] == '+') || (parser_peek(p) == '-' && p->src[p->pos+1] == '-')) {
-            char op[3] = { (char)parser_peek(p), (char)parser_peek(p), 0 };
-            parser_next(p); parser_next(p);
+        } else if (parser_is(p, OP_INC) || parser_is(p, OP_DEC)) {
             ASTNode *n = make_node(AST_UNOP);
-            n->data.unop.op = strdup2(op, 2);
+            n->data.unop.op = (Operator)parser_next(p)->value;
             n->data.unop.expr = node;
             n->data.unop.is_postfix = 1; // postfix
             node = n;
         } else {
             break;
         }
-        parser_skip_ws(p);
     }
     return node;
 }
 
 // Parse unary operators
 ASTNode *parse_unary(Parser *p) {
-    parser_skip_ws(p);
-    int c = parser_peek(p);
-    // Handle prefix ++ and --
-    if ((c == '+' && p->src[p->pos+1] == '+') || (c == '-' && p->src[p->pos+1] == '-')) {
-        char op[3] = { (char)c, (char)c, 0 };
-        parser_next(p); parser_next(p);
-        ASTNode *n = make_node(AST_UNOP);
-        n->data.unop.op = strdup2(op, 2);
-        n->data.unop.expr = parse_unary(p);
-        n->data.unop.is_postfix = 0; // prefix
-        return n;
-    }
-    return parse_primary(p);
-}
-
-// --- Operator precedence and recognition ---
-typedef struct { const char *op; int prec; } OpPrec;
-static const OpPrec op_table[] = {
-    {"=", 0},
-    {"||", 1},
-    {"&&", 2},
-    {"==", 3}, {"!=", 3},
-    {">=", 4}, {"<=", 4}, {">>", 4}, {"<<", 4},
-    {">", 4}, {"<", 4},
-    {"+", 5}, {"-", 5},
-    {"&", 7},
-    {"^", 8},
-    {"|", 9},
-    {"*", 10}, {"/", 10}, {"%", 10},
-    {NULL, 0}
-};
-
-// Try to match an operator at the current position, return its precedence and length
-int match_op(Parser *p, const char **op_out, int *len_out, int *prec_out) {
-    for (int i = 0; op_table[i].op; ++i) {
-        size_t len = strlen(op_table[i].op);
-        if (strncmp(p->src + p->pos, op_table[i].op, len) == 0) {
-            if (op_out) *op_out = op_table[i].op;
-            if (len_out) *len_out = (int)len;
-            if (prec_out) *prec_out = op_table[i].prec;
-            return 1;
+    Token *t = parser_peek(p);
+    if (t->kind == TOK_OP) {
+        switch (t->value) {
+            case OP_INC: case OP_DEC: case OP_SUB: case OP_NOT: case OP_MUL: case OP_BITAND: {
+                ASTNode *n = make_node(AST_UNOP);
+                n->data.unop.op = (Operator)parser_next(p)->value;
+                n->data.unop.expr = parse_unary(p);
+                n->data.unop.is_postfix = 0; // prefix
+                return n;
+            }
         }
     }
-    return 0;
+    return parse_primary(p);
 }
 
-// --- Updated parse_binop_rhs and get_precedence ---
-int get_precedence(Parser *p, const char **op_out, int *len_out) {
-    int prec = 0;
-    const char *op = NULL;
-    int len = 0;
-    if (match_op(p, &op, &len, &prec)) {
-        if (op_out) *op_out = op;
-        if (len_out) *len_out = len;
-        return prec;
-    }
-    return -1;
+// --- Operator precedence ---
+// Precedence of the current token as a binary operator, or -1
+int get_precedence(Parser *p) {
+    Token *t = parser_peek(p);
+    return t->kind == TOK_OP ? op_prec[t->value] : -1;
 }
 
 ASTNode *parse_binop_rhs(Parser *p, int prec, ASTNode *lhs) {
     while (1) {
-        parser_skip_ws(p);
-        const char *op = NULL;
-        int op_len = 0;
-        int op_prec = get_precedence(p, &op, &op_len);
+        int op_prec = get_precedence(p);
         if (op_prec < prec) return lhs;
         // Advance past the operator
-        for (int i = 0; i < op_len; ++i) parser_next(p);
+        Operator op = (Operator)parser_next(p)->value;
         ASTNode *rhs = parse_unary(p);
-        parser_skip_ws(p);
-        const char *next_op = NULL;
-        int next_len = 0;
-        int next_prec = get_precedence(p, &next_op, &next_len);
-        if (strcmp(op, "=") == 0) {
+        int next_prec = get_precedence(p);
+        if (op_prec == 0) {
             // Assignment is right-associative
             if (op_prec <= next_prec) {
                 rhs = parse_binop_rhs(p, op_prec, rhs);
@@ -701,13 +925,13 @@ ASTNode *parse_binop_rhs(Parser *p, int prec, ASTNode *lhs) {
             }
         }
         ASTNode *node = NULL;
-        if (strcmp(op, "=") == 0) {
+        if (op_prec == 0) {
             node = make_node(AST_ASSIGN);
             node->data.assign.var = lhs;
             node->data.assign.expr = rhs;
         } else {
             node = make_node(AST_BINOP);
-            node->data.binop.op = strdup2(op, op_len);
+            node->data.binop.op = op;
             node->data.binop.left = lhs;
             node->data.binop.right = rhs;
         }
@@ -723,40 +947,29 @@ ASTNode *parse_expression(Parser *p) {
 
 // Parse a statement
 ASTNode *parse_statement(Parser *p) {
-    parser_skip_ws(p);
     // Label definition: label:
-    if (isalpha(parser_peek(p)) || parser_peek(p) == '_') {
-        size_t save_pos = p->pos;
-        int save_cur = p->cur;
-        char *name = parse_name(p);
-        parser_skip_ws(p);
-        if (parser_peek(p) == ':') {
-            parser_next(p);
-            ASTNode *n = make_node(AST_LABEL);
-            n->data.label.label = name;
-            return n;
-        } else {
-            // Not a label, revert and continue
-            p->pos = save_pos;
-            p->cur = save_cur;
-        }
+    if (parser_peek(p)->kind == TOK_IDENT && parser_peek_at(p, 1)->kind == TOK_OP &&
+        parser_peek_at(p, 1)->value == OP_COLON) {
+        ASTNode *n = make_node(AST_LABEL);
+        n->data.label.label = parse_name(p);
+        parser_next(p);
+        return n;
     }
     // Goto statement: goto label;
-    if (parser_match(p, "goto")) {
-        char *name = parse_name(p);
-        expect(p, ';');
+    if (parser_match(p, KW_GOTO)) {
+        SymId name = parse_name(p);
+        expect(p, OP_SEMI);
         ASTNode *n = make_node(AST_GOTO);
         n->data.go.label = name;
         return n;
     }
-    if (parser_match(p, "if")) {
-        expect(p, '(');
+    if (parser_match(p, KW_IF)) {
+        expect(p, OP_LPAREN);
         ASTNode *cond = parse_expression(p);
-        expect(p, ')');
+        expect(p, OP_RPAREN);
         ASTNode *then_branch = parse_statement(p);
         ASTNode *else_branch = NULL;
-        parser_skip_ws(p);
-        if (parser_match(p, "else")) {
+        if (parser_match(p, KW_ELSE)) {
             else_branch = parse_statement(p);
         }
         ASTNode *n = make_node(AST_IF);
@@ -764,66 +977,48 @@ ASTNode *parse_statement(Parser *p) {
         n->data.if_stmt.then_branch = then_branch;
         n->data.if_stmt.else_branch = else_branch;
         return n;
-    } else if (parser_match(p, "while")) {
-        expect(p, '(');
+    } else if (parser_match(p, KW_WHILE)) {
+        expect(p, OP_LPAREN);
         ASTNode *cond = parse_expression(p);
-        expect(p, ')');
+        expect(p, OP_RPAREN);
         ASTNode *body = parse_statement(p);
         ASTNode *n = make_node(AST_WHILE);
         n->data.while_stmt.cond = cond;
         n->data.while_stmt.body = body;
         return n;
-    } else if (parser_match(p, "return")) {
+    } else if (parser_match(p, KW_RETURN)) {
         ASTNode *expr = parse_expression(p);
-        expect(p, ';');
+        expect(p, OP_SEMI);
         ASTNode *n = make_node(AST_RETURN);
         n->data.ret.expr = expr;
         return n;
-    } else if (parser_match(p, "break")) {
-        expect(p, ';');
+    } else if (parser_match(p, KW_BREAK)) {
+        expect(p, OP_SEMI);
         return make_node(AST_BREAK);
-    } else if (parser_match(p, "continue")) {
-        expect(p, ';');
+    } else if (parser_match(p, KW_CONTINUE)) {
+        expect(p, OP_SEMI);
         return make_node(AST_CONTINUE);
-    } else if (parser_match(p, "auto")) {
-        char *name = parse_name(p);
-        expect(p, ';');
+    } else if (parser_match(p, KW_AUTO)) {
+        SymId name = parse_name(p);
+        expect(p, OP_SEMI);
         ASTNode *n = make_node(AST_VAR_DECL);
         n->data.var_decl.name = name;
         return n;
-    } else if (parser_match(p, "extern")) {
-        parser_skip_ws(p);
-        char *name = parse_name(p);
-        parser_skip_ws(p);
-        expect(p, ';');
+    } else if (parser_match(p, KW_EXTERN)) {
+        SymId name = parse_name(p);
+        expect(p, OP_SEMI);
         ASTNode *n = make_node(AST_EXTERN);
         n->data.ext.name = name;
         n->data.ext.is_func = 0;
         return n;
-    } else if (parser_peek(p) == ';') {
-        parser_next(p);
+    } else if (parser_accept(p, OP_SEMI)) {
         return make_node(AST_EMPTY);
-    } else if (parser_peek(p) == '{') {
+    } else if (parser_is(p, OP_LBRACE)) {
         return parse_block(p);
-    } else if (isalpha(parser_peek(p)) || parser_peek(p) == '_') {
-        size_t save_pos = p->pos;
-        int save_cur = p->cur;
-        char *name = parse_name(p);
-        parser_skip_ws(p);
-        if (parser_peek(p) == '(') {
-            ASTNode *call = parse_call(p, name);
-            expect(p, ';');
-            ASTNode *n = make_node(AST_STATEMENT);
-            n->data.statement.stmt = call;
-            return n;
-        } else {
-            p->pos = save_pos;
-            p->cur = save_cur;
-        }
     }
-    // Assignment or expression
+    // Assignment, call or other expression
     ASTNode *expr = parse_expression(p);
-    expect(p, ';');
+    expect(p, OP_SEMI);
     ASTNode *n = make_node(AST_STATEMENT);
     n->data.statement.stmt = expr;
     return n;
@@ -831,15 +1026,13 @@ ASTNode *parse_statement(Parser *p) {
 
 // Parse a block: { ... }
 ASTNode *parse_block(Parser *p) {
-    expect(p, '{');
-    ASTNodeList *stmts = NULL;
-    parser_skip_ws(p);
-    while (parser_peek(p) && parser_peek(p) != '}') {
+    expect(p, OP_LBRACE);
+    ASTNodeList stmts = {0};
+    while (parser_peek(p)->kind != TOK_EOF && !parser_is(p, OP_RBRACE)) {
         ASTNode *stmt = parse_statement(p);
-        stmts = append_node(stmts, stmt);
-        parser_skip_ws(p);
+        append_node(&stmts, stmt);
     }
-    expect(p, '}');
+    expect(p, OP_RBRACE);
     ASTNode *n = make_node(AST_BLOCK);
     n->data.block.statements = stmts;
     return n;
@@ -847,28 +1040,19 @@ ASTNode *parse_block(Parser *p) {
 
 // Parse a function definition: name ( ) block
 ASTNode *parse_function(Parser *p) {
-    char *name = parse_name(p);
-    parser_skip_ws(p);
-    expect(p, '(');
-    parser_skip_ws(p);
-    ASTNodeList *params = NULL;
-    if (parser_peek(p) != ')') {
+    SymId name = parse_name(p);
+    expect(p, OP_LPAREN);
+    ASTNodeList params = {0};
+    if (!parser_is(p, OP_RPAREN)) {
         while (1) {
-            char *param_name = parse_name(p);
+            SymId param_name = parse_name(p);
             ASTNode *param = make_node(AST_VAR);
             param->data.var.name = param_name;
-            params = append_node(params, param);
-            parser_skip_ws(p);
-            if (parser_peek(p) == ',') {
-                parser_next(p);
-                parser_skip_ws(p);
-            } else {
-                break;
-            }
+            append_node(&params, param);
+            if (!parser_accept(p, OP_COMMA)) break;
         }
     }
-    expect(p, ')');
-    parser_skip_ws(p);
+    expect(p, OP_RPAREN);
     ASTNode *body = parse_block(p);
     ASTNode *n = make_node(AST_FUNCTION);
     n->data.function.name = name;
@@ -879,79 +1063,60 @@ ASTNode *parse_function(Parser *p) {
 
 // Parse the whole program: list of functions
 ASTNode *parse_program(Parser *p) {
-    ASTNodeList *funcs = NULL;
-    parser_skip_ws(p);
+    ASTNode *program = make_node(AST_PROGRAM);
+    ASTNodeList *funcs = &program->data.program.functions;
     top_level_funcs = funcs;
-    while (parser_peek(p)) {
-        parser_skip_ws(p);
-        if (parser_match(p, "extern")) {
-            parser_skip_ws(p);
-            char *name = parse_name(p);
-            parser_skip_ws(p);
+    while (parser_peek(p)->kind != TOK_EOF) {
+        if (parser_match(p, KW_EXTERN)) {
+            SymId name = parse_name(p);
             // Only allow extern name;
-            expect(p, ';');
+            expect(p, OP_SEMI);
             ASTNode *n = make_node(AST_EXTERN);
             n->data.ext.name = name;
             n->data.ext.is_func = 0;
-            funcs = append_node(funcs, n);
-        } else if (parser_match(p, "meta")) {
-            expect(p, '{');
-            // Parse balanced brackets content
+            append_node(funcs, n);
+        } else if (parser_match(p, KW_META)) {
+            // Skip balanced braces; the content is the source text between them
+            unsigned start_offset = parser_peek(p)->offset + 1;
+            expect(p, OP_LBRACE);
             int brace_count = 1;
-            size_t start_pos = p->pos;
-            while (brace_count > 0 && parser_peek(p)) {
-                int c = parser_next(p);
-                if (c == '{') brace_count++;
-                else if (c == '}') brace_count--;
+            while (parser_peek(p)->kind != TOK_EOF) {
+                if (parser_is(p, OP_LBRACE)) brace_count++;
+                else if (parser_is(p, OP_RBRACE) && --brace_count == 0) break;
+                parser_next(p);
             }
             if (brace_count > 0) {
                 parser_error(p, "Unmatched braces in meta construct");
                 return NULL;
             }
             // Extract content (excluding the closing brace)
-            size_t end_pos = p->pos - 1;
-            size_t content_len = end_pos - start_pos;
-            char *content = strdup2(p->src + start_pos, content_len);
-            
-            parser_next(p); // Advance past the closing brace to sync cur/pos
-            
+            unsigned end_offset = parser_next(p)->offset;
+            char *content = strdup2(p->src + start_offset, end_offset - start_offset);
             ASTNode *n = make_node(AST_META);
             n->data.meta.content = content;
-            funcs = append_node(funcs, n);
-            // The parser position is now at the character after the closing brace
-            // No need to skip whitespace here as it will be done at the end of the loop
-        } else if (isalpha(parser_peek(p)) || parser_peek(p) == '_') {
+            append_node(funcs, n);
+        } else if (parser_peek(p)->kind == TOK_IDENT) {
             // Could be function definition or global variable
-            size_t save_pos = p->pos;
-            int save_cur = p->cur;
-            char *name = parse_name(p);
-            parser_skip_ws(p);
-            if (parser_peek(p) == '(') {
+            if (parser_peek_at(p, 1)->kind == TOK_OP && parser_peek_at(p, 1)->value == OP_LPAREN) {
                 // Function definition
-                p->pos = save_pos;
-                p->cur = save_cur;
                 ASTNode *fn = parse_function(p);
-                funcs = append_node(funcs, fn);
-                top_level_funcs = funcs;
+                append_node(funcs, fn);
             } else {
                 // Global variable definition: name [= expr]?;
+                SymId name = parse_name(p);
                 ASTNode *init = NULL;
-                if (parser_peek(p) == '=') {
-                    parser_next(p);
+                if (parser_accept(p, OP_ASSIGN)) {
                     init = parse_expression(p);
                 }
-                expect(p, ';');
+                expect(p, OP_SEMI);
                 ASTNode *n = make_node(AST_GLOBAL);
                 n->data.global.name = name;
                 n->data.global.init = init;
-                funcs = append_node(funcs, n);
+                append_node(funcs, n);
             }
         } else {
             parser_error(p, "Expected 'extern', 'meta', function definition, or global variable at top level");
         }
-        parser_skip_ws(p);
     }
-    ASTNode *n = make_node(AST_PROGRAM);
-    n->data.program.functions = funcs;
-    return n;
-} 
\ No newline at end of file
+    return program;
+}
@@ -2,6 +2,68 @@
 #define B_H
 
 #include <stdio.h>
+#include <stddef.h>
+
+// --- Arena allocator ---
+// Every ASTNode, ASTNodeList and name string of one compilation is carved out
+// of the current arena and released in one step with arena_release().
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *head;
+} Arena;
+
+void arena_init(Arena *a);
+void *arena_alloc(Arena *a, size_t size);
+void arena_release(Arena *a);
+
+// Arena used by make_node/append_node/strdup2 (set per compilation)
+extern Arena *ast_arena;
+
+// --- Identifier interning ---
+// Every distinct identifier maps to a stable integer id for the lifetime of
+// the process, so the AST and code generators compare ids, not strings.
+typedef int SymId;
+#define SYM_NONE 0
+
+SymId intern_name(const char *name, size_t len);
+const char *symbol_name(SymId id);
+size_t symbol_length(SymId id);
+int symbol_count(void);
+
+// --- Operators and punctuation ---
+// Classified by the lexer; binary operators index op_prec directly.
+typedef enum {
+    OP_NONE,
+    // Binary operators
+    OP_ASSIGN,          // =
+    OP_OR, OP_AND,      // || &&
+    OP_EQ, OP_NE,       // == !=
+    OP_GE, OP_LE, OP_SHR, OP_SHL, OP_GT, OP_LT,
+    OP_ADD, OP_SUB,
+    OP_BITAND, OP_XOR, OP_BITOR,
+    OP_MUL, OP_DIV, OP_MOD,
+    // Unary-only operators
+    OP_NOT, OP_INC, OP_DEC,
+    // Punctuation
+    OP_LPAREN, OP_RPAREN, OP_LBRACE, OP_RBRACE, OP_LBRACKET, OP_RBRACKET,
+    OP_SEMI, OP_COMMA, OP_COLON,
+    OP_COUNT
+} Operator;
+
+extern const char *const op_text[OP_COUNT];   // source spelling
+extern const signed char op_prec[OP_COUNT];   // binary precedence, -1 if not binary
+
+// --- Keywords ---
+typedef enum {
+    KW_IF, KW_ELSE, KW_WHILE, KW_RETURN, KW_BREAK, KW_CONTINUE,
+    KW_AUTO, KW_EXTERN, KW_GOTO, KW_META
+} Keyword;
 
 // --- AST Node Types ---
 typedef enum {
@@ -34,37 +96,69 @@ typedef enum {
 
 struct ASTNode;
 
+// Contiguous child vector, stored inline in its parent node
 typedef struct ASTNodeList {
-    struct ASTNode *node;
-    struct ASTNodeList *next;
+    struct ASTNode **items;
+    int count;
+    int capacity;
 } ASTNodeList;
 
 typedef struct ASTNode {
     ASTNodeType type;
     union {
-        struct { ASTNodeList *functions; } program;
-        struct { char *name; ASTNodeList *params; struct ASTNode *body; } function;
-        struct { ASTNodeList *statements; } block;
+        struct { ASTNodeList functions; } program;
+        struct { SymId name; ASTNodeList params; struct ASTNode *body; } function;
+        struct { ASTNodeList statements; } block;
         struct { struct ASTNode *stmt; } statement;
         struct { struct ASTNode *cond, *then_branch, *else_branch; } if_stmt;
-        struct { struct ASTNode *cond, *body; } while_stmt;
+        struct { struct ASTNode *cond, *body; int entered; } while_stmt;  // entered: cond holds on entry
         struct { struct ASTNode *expr; } ret;
         struct { struct ASTNode *var, *expr; } assign;
-        struct { char *op; struct ASTNode *left, *right; } binop;
-        struct { char *op; struct ASTNode *expr; int is_postfix; } unop;
-        struct { char *name; ASTNodeList *args; struct ASTNode *left; } call;
-        struct { char *name; } var;
+        struct { Operator op; struct ASTNode *left, *right; } binop;
+        struct { Operator op; struct ASTNode *expr; int is_postfix; } unop;
+        struct { SymId name; ASTNodeList args; struct ASTNode *left; } call;
+        struct { SymId name; } var;
         struct { int value; } num;
         struct { char value; } char_lit;
-        struct { char *value; } string_lit;
-        struct { char *name; int is_func; } ext;
+        struct { const char *value; } string_lit;
+        struct { SymId name; int is_func; } ext;
         struct { struct ASTNode *array, *index; } index;
-        struct { char *name; struct ASTNode *init; } global;
-        struct { char *label; } label;
-        struct { char *label; } go;
-        struct { char *name; } var_decl;
+        struct { SymId name; struct ASTNode *init; } global;
+        struct { SymId label; } label;
+        struct { SymId label; } go;
+        struct { SymId name; } var_decl;
         struct { char *content; } meta;
     } data;
 } ASTNode;
 
+// --- Tokens ---
+typedef enum {
+    TOK_EOF,
+    TOK_IDENT,   // value: SymId
+    TOK_NUMBER,  // value: numeric value
+    TOK_CHAR,    // value: character code
+    TOK_STRING,  // value: SymId of the unescaped text
+    TOK_KEYWORD, // value: Keyword
+    TOK_OP       // value: Operator (operators and punctuation)
+} TokenKind;
+
+typedef struct {
+    unsigned char kind;
+    int value;
+    unsigned offset;   // byte offset of the token in the source
+} Token;
+
+// --- Parser State ---
+// The source is scanned once into a token buffer; the parser walks it.
+typedef struct {
+    const char *src;
+    Token *toks;
+    int num_toks;
+    int pos;           // index of the current token
+} Parser;
+
+void parser_init(Parser *p, const char *src);
+void parser_free(Parser *p);
+struct ASTNode *parse_program(Parser *p);
+
 #endif // B_PARSER_H 
\ No newline at end of file
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Assembly emitter throughput: compiles a codegen-heavy program and reports
+# bytes of assembly written per second. Set B_BASE to a second compiler
+# binary to get a before/after comparison on the same input.
+B=${B:-./b}
+B_BASE=${B_BASE:-}
+FUNCS=${FUNCS:-2000}
+STMTS=${STMTS:-200}
+SRC=$(mktemp /tmp/asm_emit.XXXXXX.b)
+ASM=${SRC%.b}.s
+trap 'rm -f "$SRC" "$ASM"' EXIT
+
+awk -v funcs="$FUNCS" -v stmts="$STMTS" 'BEGIN {
+    printf("extern printf;\ng = 1;\n")
+    for (f = 0; f < funcs; f++) {
+        printf("f%d(a, b) {\n    auto x;\n    auto y;\n    auto i;\n    x = a;\n    y = b;\n    i = 0;\n", f)
+        for (i = 0; i < stmts; i++) {
+            k = i % 5
+            if (k == 0) printf("    x = x + y * %d - (a << 2);\n", i)
+            else if (k == 1) printf("    if (x > y && i != %d) y = y ^ x; else x = x | %d;\n", i, i)
+            else if (k == 2) printf("    while (i < %d) i++;\n", i)
+            else if (k == 3) printf("    g = f%d(x, \"s%d\") / (y + 1);\n", (f + 1) % funcs, i % 16)
+            else printf("    x = -x + !y + (a & b);\n")
+        }
+        printf("    return x;\n}\n")
+    }
+    printf("main() {\n    return f0(1, 2);\n}\n")
+}' > "$SRC"
+
+run() {
+    local name=$1; shift
+    local start end
+    start=$(date +%s.%N)
+    "$@" "$SRC" > "$ASM" || { echo "FAIL: $name exited with $?"; exit 1; }
+    end=$(date +%s.%N)
+    awk -v n="$name" -v s="$start" -v e="$end" -v b="$(wc -c < "$ASM")" 'BEGIN {
+        t = e - s
+        printf("%-22s %7.1f MB asm in %.3fs (%.1f MB/s)\n", n, b / 1e6, t, b / 1e6 / t)
+    }'
+}
+
+echo "asm_emit: $FUNCS functions x $STMTS statements, $(($(wc -c < "$SRC") / 1000)) KB source"
+[ -n "$B_BASE" ] && run "before" "$B_BASE" -S
+run "after" "$B" -S
+run "after, compact" "$B" -S -fno-verbose-asm
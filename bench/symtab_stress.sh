@@ -0,0 +1,44 @@
+#!/bin/bash
+# Symbol table throughput test: 100k globals and 1k locals per function.
+# Fails if any global or local is dropped from the generated assembly.
+B=${B:-./b}
+GLOBALS=${GLOBALS:-100000}
+LOCALS=${LOCALS:-1000}
+FUNCS=${FUNCS:-50}
+SRC=$(mktemp /tmp/symtab_stress.XXXXXX.b)
+ASM=${SRC%.b}.s
+trap 'rm -f "$SRC" "$ASM"' EXIT
+
+awk -v globals="$GLOBALS" -v locals="$LOCALS" -v funcs="$FUNCS" 'BEGIN {
+    for (i = 0; i < globals; i++) printf("g%d = %d;\n", i, i);
+    for (f = 0; f < funcs; f++) {
+        printf("f%d() {\n", f);
+        for (i = 0; i < locals; i++) printf("    auto l%d;\n", i);
+        for (i = 0; i < locals; i++) printf("    l%d = g%d + l%d;\n", i, (f * locals + i) % globals, (i + 1) % locals);
+        printf("    return l0;\n}\n");
+    }
+    printf("main() {\n    return f0();\n}\n");
+}' > "$SRC"
+
+start=$(date +%s.%N)
+$B -S "$SRC" > "$ASM" || { echo "FAIL: compiler exited with $?"; exit 1; }
+end=$(date +%s.%N)
+
+FAIL=0
+got_globals=$(grep -c '^g[0-9]*: .long' "$ASM")
+if [ "$got_globals" != "$GLOBALS" ]; then
+    echo "FAIL: $got_globals of $GLOBALS globals emitted"
+    FAIL=1
+fi
+got_frames=$(grep -c "sub esp, $((LOCALS * 4)) " "$ASM")
+if [ "$got_frames" != "$FUNCS" ]; then
+    echo "FAIL: $got_frames of $FUNCS functions got a $LOCALS-local frame"
+    FAIL=1
+fi
+bytes=$(wc -c < "$SRC")
+awk -v s="$start" -v e="$end" -v b="$bytes" -v g="$GLOBALS" -v l="$((LOCALS * FUNCS))" 'BEGIN {
+    t = e - s
+    printf("symtab_stress: %d globals, %d locals, %.1f MB source in %.3fs (%.1f MB/s)\n", g, l, b / 1e6, t, b / 1e6 / t)
+}'
+[ $FAIL = 0 ] && echo "PASS"
+exit $FAIL
@@ -0,0 +1,1544 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "b.h"
+#include "opt.h"
+#include "targets/x86/x86.h"
+
+ASTNode *make_node(ASTNodeType type);
+void append_node(ASTNodeList *list, ASTNode *node);
+
+int opt_level = 1;
+
+// --- Constant folding ---
+// Arithmetic follows the generated code at the target's word size, 32 or 64
+// bits: it wraps, >> is a logical shift and shift counts are taken mod the
+// word size. Division by zero and the most negative word / -1 trap at run
+// time, so they are left alone. A literal holds only 32 bits, so in 64-bit
+// mode a fold whose result does not fit, or that shifts by 31 or more, is
+// left to the generated code.
+
+static int literal_value(const ASTNode *e, int *value) {
+    if (!e) return 0;
+    if (e->type == AST_NUM) { *value = e->data.num.value; return 1; }
+    if (e->type == AST_CHAR) { *value = (unsigned char)e->data.char_lit.value; return 1; }
+    return 0;
+}
+
+// Truncate to a target word
+static int64_t to_word(uint64_t v) {
+    return x86_mode64 ? (int64_t)v : (int64_t)(int32_t)(uint32_t)v;
+}
+
+static int eval_word(Operator op, int64_t a, int64_t b, int64_t *r) {
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    unsigned count = (unsigned)ub & (x86_mode64 ? 63 : 31);
+    switch (op) {
+        case OP_ADD: *r = to_word(ua + ub); return 1;
+        case OP_SUB: *r = to_word(ua - ub); return 1;
+        case OP_MUL: *r = to_word(ua * ub); return 1;
+        case OP_DIV: case OP_MOD:
+            if (b == 0 || (a == (x86_mode64 ? INT64_MIN : INT32_MIN) && b == -1)) return 0;
+            *r = op == OP_DIV ? a / b : a % b;
+            return 1;
+        case OP_SHL: *r = to_word(ua << count); return 1;
+        case OP_SHR:
+            *r = x86_mode64 ? (int64_t)(ua >> count) : (int64_t)((uint32_t)ua >> count);
+            return 1;
+        case OP_BITAND: *r = a & b; return 1;
+        case OP_BITOR: *r = a | b; return 1;
+        case OP_XOR: *r = a ^ b; return 1;
+        case OP_EQ: *r = a == b; return 1;
+        case OP_NE: *r = a != b; return 1;
+        case OP_LT: *r = a < b; return 1;
+        case OP_GT: *r = a > b; return 1;
+        case OP_LE: *r = a <= b; return 1;
+        case OP_GE: *r = a >= b; return 1;
+        case OP_AND: *r = a && b; return 1;
+        case OP_OR: *r = a || b; return 1;
+        default: return 0;
+    }
+}
+
+static int eval_unop_word(Operator op, int64_t a, int64_t *r) {
+    switch (op) {
+        case OP_SUB: *r = to_word(0 - (uint64_t)a); return 1;
+        case OP_NOT: *r = !a; return 1;
+        default: return 0;
+    }
+}
+
+// The folds that give a literal
+static int eval_binop(Operator op, int a, int b, int *r) {
+    int64_t w;
+    if (x86_mode64 && (op == OP_SHL || op == OP_SHR) && (unsigned)b >= 31) return 0;
+    if (!eval_word(op, a, b, &w) || w != (int)w) return 0;
+    *r = (int)w;
+    return 1;
+}
+
+static int eval_unop(Operator op, int a, int *r) {
+    int64_t w;
+    if (!eval_unop_word(op, a, &w) || w != (int)w) return 0;
+    *r = (int)w;
+    return 1;
+}
+
+int fold_constant(const ASTNode *e, int *value) {
+    int a, b;
+    if (!e) return 0;
+    switch (e->type) {
+        case AST_NUM: case AST_CHAR:
+            return literal_value(e, value);
+        case AST_BINOP:
+            return fold_constant(e->data.binop.left, &a) && fold_constant(e->data.binop.right, &b) &&
+                   eval_binop(e->data.binop.op, a, b, value);
+        case AST_UNOP:
+            return fold_constant(e->data.unop.expr, &a) && eval_unop(e->data.unop.op, a, value);
+        default:
+            return 0;
+    }
+}
+
+int fold_word(const ASTNode *e, int64_t *value) {
+    int64_t a, b;
+    int lit;
+    if (!e) return 0;
+    switch (e->type) {
+        case AST_NUM: case AST_CHAR:
+            if (!literal_value(e, &lit)) return 0;
+            *value = lit;
+            return 1;
+        case AST_BINOP:
+            return fold_word(e->data.binop.left, &a) && fold_word(e->data.binop.right, &b) &&
+                   eval_word(e->data.binop.op, a, b, value);
+        case AST_UNOP:
+            return fold_word(e->data.unop.expr, &a) && eval_unop_word(e->data.unop.op, a, value);
+        default:
+            return 0;
+    }
+}
+
+// Whether evaluating e can do anything besides produce its value
+static int has_effects(const ASTNode *e) {
+    if (!e) return 0;
+    switch (e->type) {
+        case AST_CALL: case AST_ASSIGN: return 1;
+        case AST_UNOP:
+            return e->data.unop.op == OP_INC || e->data.unop.op == OP_DEC || has_effects(e->data.unop.expr);
+        case AST_BINOP: return has_effects(e->data.binop.left) || has_effects(e->data.binop.right);
+        case AST_INDEX: return has_effects(e->data.index.array) || has_effects(e->data.index.index);
+        default: return 0;
+    }
+}
+
+static int is_comparison(Operator op) {
+    return op == OP_EQ || op == OP_NE || op == OP_LT || op == OP_GT || op == OP_LE || op == OP_GE;
+}
+
+static Operator negate_comparison(Operator op) {
+    switch (op) {
+        case OP_EQ: return OP_NE;
+        case OP_NE: return OP_EQ;
+        case OP_LT: return OP_GE;
+        case OP_GE: return OP_LT;
+        case OP_GT: return OP_LE;
+        default: return OP_GT;   // OP_LE
+    }
+}
+
+// Turn e into a literal
+static ASTNode *set_num(ASTNode *e, int value) {
+    e->type = AST_NUM;
+    e->data.num.value = value;
+    return e;
+}
+
+static ASTNode *make_num(int value) {
+    return set_num(make_node(AST_NUM), value);
+}
+
+// Turn e into a unary expression
+static ASTNode *set_unop(ASTNode *e, Operator op, ASTNode *operand) {
+    e->type = AST_UNOP;
+    e->data.unop.op = op;
+    e->data.unop.expr = operand;
+    e->data.unop.is_postfix = 0;
+    return e;
+}
+
+// Turn e into `operand != 0`, the value && and || give a nonzero operand
+static ASTNode *set_truth(ASTNode *e, ASTNode *operand) {
+    e->data.binop.op = OP_NE;
+    e->data.binop.left = operand;
+    e->data.binop.right = make_num(0);
+    return e;
+}
+
+// Identities for a binary expression with exactly one literal operand
+static ASTNode *simplify_binop(ASTNode *e) {
+    Operator op = e->data.binop.op;
+    ASTNode *l = e->data.binop.left, *r = e->data.binop.right;
+    int c;
+    // Two literals whose fold was left to the generated code
+    if (literal_value(l, &c) && literal_value(r, &c)) return e;
+    if (literal_value(l, &c)) {
+        switch (op) {
+            case OP_ADD: case OP_MUL: case OP_BITAND: case OP_BITOR: case OP_XOR: case OP_EQ: case OP_NE:
+                // Commutative: keep the literal on the right
+                e->data.binop.left = r;
+                e->data.binop.right = l;
+                return simplify_binop(e);
+            case OP_SUB:
+                return c == 0 ? set_unop(e, OP_SUB, r) : e;
+            case OP_AND:
+                return c == 0 ? set_num(e, 0) : set_truth(e, r);
+            case OP_OR:
+                return c != 0 ? set_num(e, 1) : set_truth(e, r);
+            default:
+                return e;
+        }
+    }
+    if (!literal_value(r, &c)) return e;
+    int pure = !has_effects(l);
+    switch (op) {
+        case OP_SUB:
+            if (c == INT_MIN) return e;
+            c = -c;
+            // fall through
+        case OP_ADD:
+            if (c == 0) return l;
+            // (x + c1) + c2 -> x + (c1 + c2)
+            if (l->type == AST_BINOP && (l->data.binop.op == OP_ADD || l->data.binop.op == OP_SUB)) {
+                int inner;
+                int sum;
+                if (literal_value(l->data.binop.right, &inner) &&
+                    (l->data.binop.op == OP_ADD || eval_unop(OP_SUB, inner, &inner)) &&
+                    eval_binop(OP_ADD, inner, c, &sum)) {
+                    if (sum == 0) return l->data.binop.left;
+                    l->data.binop.op = OP_ADD;
+                    l->data.binop.right = make_num(sum);
+                    return l;
+                }
+            }
+            return e;
+        case OP_MUL:
+            if (c == 1) return l;
+            if (c == 0 && pure) return set_num(e, 0);
+            if (c == -1) return set_unop(e, OP_SUB, l);
+            return e;
+        case OP_DIV:
+            if (c == 1) return l;
+            if (c == -1) return set_unop(e, OP_SUB, l);
+            return e;
+        case OP_MOD:
+            return (c == 1 || c == -1) && pure ? set_num(e, 0) : e;
+        case OP_BITAND:
+            if (c == -1) return l;
+            return c == 0 && pure ? set_num(e, 0) : e;
+        case OP_BITOR:
+            if (c == 0) return l;
+            return c == -1 && pure ? set_num(e, -1) : e;
+        case OP_XOR:
+            return c == 0 ? l : e;
+        case OP_SHL: case OP_SHR:
+            return (c & (x86_mode64 ? 63 : 31)) == 0 ? l : e;
+        case OP_AND:
+            if (c != 0) return set_truth(e, l);
+            return pure ? set_num(e, 0) : e;
+        case OP_OR:
+            if (c == 0) return set_truth(e, l);
+            return pure ? set_num(e, 1) : e;
+        default:
+            return e;
+    }
+}
+
+static ASTNode *fold_expr(ASTNode *e) {
+    int a, b, r;
+    if (!e) return e;
+    switch (e->type) {
+        case AST_BINOP:
+            e->data.binop.left = fold_expr(e->data.binop.left);
+            e->data.binop.right = fold_expr(e->data.binop.right);
+            if (literal_value(e->data.binop.left, &a) && literal_value(e->data.binop.right, &b) &&
+                eval_binop(e->data.binop.op, a, b, &r))
+                return set_num(e, r);
+            return simplify_binop(e);
+        case AST_UNOP: {
+            ASTNode *x = e->data.unop.expr = fold_expr(e->data.unop.expr);
+            if (literal_value(x, &a) && eval_unop(e->data.unop.op, a, &r)) return set_num(e, r);
+            if (!x) return e;
+            // -(-x) -> x
+            if (e->data.unop.op == OP_SUB && x->type == AST_UNOP && x->data.unop.op == OP_SUB)
+                return x->data.unop.expr;
+            // !(a < b) -> a >= b
+            if (e->data.unop.op == OP_NOT && x->type == AST_BINOP && is_comparison(x->data.binop.op)) {
+                x->data.binop.op = negate_comparison(x->data.binop.op);
+                return x;
+            }
+            return e;
+        }
+        case AST_ASSIGN:
+            e->data.assign.var = fold_expr(e->data.assign.var);
+            e->data.assign.expr = fold_expr(e->data.assign.expr);
+            return e;
+        case AST_CALL:
+            for (int i = 0; i < e->data.call.args.count; ++i)
+                e->data.call.args.items[i] = fold_expr(e->data.call.args.items[i]);
+            e->data.call.left = fold_expr(e->data.call.left);
+            return e;
+        case AST_INDEX:
+            e->data.index.array = fold_expr(e->data.index.array);
+            e->data.index.index = fold_expr(e->data.index.index);
+            return e;
+        default:
+            return e;
+    }
+}
+
+// --- Constant conditions ---
+
+// Whether a statement of the given type is s or nested in it
+static int contains_stmt(const ASTNode *s, ASTNodeType type) {
+    if (!s) return 0;
+    if (s->type == type) return 1;
+    switch (s->type) {
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                if (contains_stmt(s->data.block.statements.items[i], type)) return 1;
+            return 0;
+        case AST_IF:
+            return contains_stmt(s->data.if_stmt.then_branch, type) || contains_stmt(s->data.if_stmt.else_branch, type);
+        case AST_WHILE: return contains_stmt(s->data.while_stmt.body, type);
+        default: return 0;
+    }
+}
+
+// Whether a goto could enter the statement from outside
+static int has_label(const ASTNode *s) {
+    return contains_stmt(s, AST_LABEL);
+}
+
+// autos are function-wide however deep they are declared
+static void collect_decls(ASTNode *s, ASTNodeList *decls) {
+    if (!s) return;
+    switch (s->type) {
+        case AST_VAR_DECL: append_node(decls, s); break;
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                collect_decls(s->data.block.statements.items[i], decls);
+            break;
+        case AST_IF:
+            collect_decls(s->data.if_stmt.then_branch, decls);
+            collect_decls(s->data.if_stmt.else_branch, decls);
+            break;
+        case AST_WHILE: collect_decls(s->data.while_stmt.body, decls); break;
+        default: break;
+    }
+}
+
+// What remains of a statement when `dropped` never runs and `kept` replaces
+// it: kept, plus whatever autos dropped declared
+static ASTNode *replace_statement(ASTNode *dropped, ASTNode *kept) {
+    ASTNodeList decls = {0};
+    collect_decls(dropped, &decls);
+    if (decls.count == 0) return kept ? kept : make_node(AST_EMPTY);
+    if (kept) append_node(&decls, kept);
+    ASTNode *block = make_node(AST_BLOCK);
+    block->data.block.statements = decls;
+    return block;
+}
+
+static ASTNode *fold_stmt(ASTNode *s) {
+    int c;
+    if (!s) return s;
+    switch (s->type) {
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                s->data.block.statements.items[i] = fold_stmt(s->data.block.statements.items[i]);
+            return s;
+        case AST_STATEMENT:
+            s->data.statement.stmt = fold_expr(s->data.statement.stmt);
+            return s;
+        case AST_ASSIGN:
+            return fold_expr(s);
+        case AST_RETURN:
+            s->data.ret.expr = fold_expr(s->data.ret.expr);
+            return s;
+        case AST_IF: {
+            s->data.if_stmt.cond = fold_expr(s->data.if_stmt.cond);
+            ASTNode *then_branch = s->data.if_stmt.then_branch = fold_stmt(s->data.if_stmt.then_branch);
+            ASTNode *else_branch = s->data.if_stmt.else_branch = fold_stmt(s->data.if_stmt.else_branch);
+            if (!literal_value(s->data.if_stmt.cond, &c)) return s;
+            if (c && !has_label(else_branch)) return replace_statement(else_branch, then_branch);
+            if (!c && !has_label(then_branch)) return replace_statement(then_branch, else_branch);
+            return s;
+        }
+        case AST_WHILE:
+            s->data.while_stmt.cond = fold_expr(s->data.while_stmt.cond);
+            s->data.while_stmt.body = fold_stmt(s->data.while_stmt.body);
+            if (literal_value(s->data.while_stmt.cond, &c) && c == 0 && !has_label(s->data.while_stmt.body))
+                return replace_statement(s->data.while_stmt.body, NULL);
+            return s;
+        default:
+            return s;
+    }
+}
+
+void fold_program(ASTNode *program) {
+    if (!program || program->type != AST_PROGRAM) return;
+    for (int i = 0; i < program->data.program.functions.count; ++i) {
+        ASTNode *item = program->data.program.functions.items[i];
+        if (item->type == AST_FUNCTION)
+            item->data.function.body = fold_stmt(item->data.function.body);
+        else if (item->type == AST_GLOBAL)
+            item->data.global.init = fold_expr(item->data.global.init);
+    }
+}
+
+// --- Inlining ---
+// Calls to small functions of the same program are replaced by a copy of
+// the callee. A body that is just `return e;` is substituted into the
+// calling expression. Any other body needs the call to be a statement of its
+// own (`f(a);`, `v = f(a);` or `return f(a);`): it becomes a block that
+// assigns the arguments to fresh copies of the parameters, runs the copied
+// body and leaves each `return` through a join label. Parameters, autos and
+// labels of a copy get a `__i<n>` suffix so they cannot meet the caller's.
+
+int inline_limit = 40;
+
+typedef struct {
+    ASTNode *fn;
+    int size;              // AST nodes of the body, once its own calls are inlined
+    unsigned char state;   // 0 not visited, 1 being inlined into, 2 done
+    unsigned char blocked; // address taken, meta, an auto shadowing a global, or a stray break
+} InlineFunc;
+
+static InlineFunc *inline_funcs;
+static int *inline_slot;             // SymId -> index in inline_funcs + 1, or 0
+static unsigned char *inline_global; // SymId -> declared at the top level
+static unsigned char *local_kind;    // SymId -> LOCAL_* of the function being rewritten
+static int num_names;                // size of the SymId tables
+static int fresh_serial;             // fresh names made so far
+
+enum { LOCAL_PLAIN = 1, LOCAL_ADDRESSED = 2 };
+
+static InlineFunc *inline_func(SymId name) {
+    if (name <= 0 || name >= num_names || !inline_slot[name]) return NULL;
+    return &inline_funcs[inline_slot[name] - 1];
+}
+
+typedef void (*SlotFn)(ASTNode **slot, void *ctx);
+
+// Call fn on every child slot of n, statements and expressions alike
+static void for_each_child(ASTNode *n, SlotFn fn, void *ctx) {
+    if (!n) return;
+    switch (n->type) {
+        case AST_BLOCK:
+            for (int i = 0; i < n->data.block.statements.count; ++i)
+                fn(&n->data.block.statements.items[i], ctx);
+            break;
+        case AST_STATEMENT: fn(&n->data.statement.stmt, ctx); break;
+        case AST_IF:
+            fn(&n->data.if_stmt.cond, ctx);
+            fn(&n->data.if_stmt.then_branch, ctx);
+            fn(&n->data.if_stmt.else_branch, ctx);
+            break;
+        case AST_WHILE:
+            fn(&n->data.while_stmt.cond, ctx);
+            fn(&n->data.while_stmt.body, ctx);
+            break;
+        case AST_RETURN: fn(&n->data.ret.expr, ctx); break;
+        case AST_ASSIGN:
+            fn(&n->data.assign.var, ctx);
+            fn(&n->data.assign.expr, ctx);
+            break;
+        case AST_BINOP:
+            fn(&n->data.binop.left, ctx);
+            fn(&n->data.binop.right, ctx);
+            break;
+        case AST_UNOP: fn(&n->data.unop.expr, ctx); break;
+        case AST_CALL:
+            for (int i = 0; i < n->data.call.args.count; ++i)
+                fn(&n->data.call.args.items[i], ctx);
+            fn(&n->data.call.left, ctx);
+            break;
+        case AST_INDEX:
+            fn(&n->data.index.array, ctx);
+            fn(&n->data.index.index, ctx);
+            break;
+        default: break;
+    }
+}
+
+// Size of a body and whether it can be copied at all
+typedef struct {
+    int size;
+    int loops;   // while statements around the current node
+    int unsafe;
+} BodyScan;
+
+static void scan_body(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    BodyScan *s = (BodyScan*)ctx;
+    if (!n) return;
+    s->size++;
+    switch (n->type) {
+        case AST_META: s->unsafe = 1; break;
+        case AST_BREAK: case AST_CONTINUE:
+            // Would bind to a loop of the caller
+            if (!s->loops) s->unsafe = 1;
+            break;
+        case AST_VAR_DECL: {
+            // Such an auto names the global, which renaming would break
+            SymId name = n->data.var_decl.name;
+            if (name > 0 && name < num_names && inline_global[name]) s->unsafe = 1;
+            break;
+        }
+        case AST_WHILE:
+            s->loops++;
+            for_each_child(n, scan_body, s);
+            s->loops--;
+            return;
+        default: break;
+    }
+    for_each_child(n, scan_body, s);
+}
+
+// A function named as a value may be called through a pointer and must keep
+// its body; it is left out of inlining altogether
+static void mark_address_taken(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    if (!n) return;
+    if (n->type == AST_VAR) {
+        InlineFunc *f = inline_func(n->data.var.name);
+        if (f) f->blocked = 1;
+    }
+    for_each_child(n, mark_address_taken, ctx);
+}
+
+static void mark_addressed_locals(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    if (!n) return;
+    if (n->type == AST_UNOP && n->data.unop.op == OP_BITAND && n->data.unop.expr &&
+        n->data.unop.expr->type == AST_VAR) {
+        SymId name = n->data.unop.expr->data.var.name;
+        if (name > 0 && name < num_names && local_kind[name]) local_kind[name] = LOCAL_ADDRESSED;
+    }
+    for_each_child(n, mark_addressed_locals, ctx);
+}
+
+// Uses of one variable in a tree
+typedef struct {
+    SymId name;
+    int reads;
+    int writes;   // assigned, incremented, decremented or addressed
+} VarUse;
+
+static void count_var_use(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    VarUse *u = (VarUse*)ctx;
+    if (!n) return;
+    if (n->type == AST_VAR && n->data.var.name == u->name) u->reads++;
+    ASTNode *target = NULL;
+    if (n->type == AST_ASSIGN) target = n->data.assign.var;
+    else if (n->type == AST_UNOP && (n->data.unop.op == OP_INC || n->data.unop.op == OP_DEC || n->data.unop.op == OP_BITAND))
+        target = n->data.unop.expr;
+    if (target && target->type == AST_VAR && target->data.var.name == u->name) u->writes++;
+    for_each_child(n, count_var_use, ctx);
+}
+
+static VarUse var_use(ASTNode *n, SymId name) {
+    VarUse u = { name, 0, 0 };
+    count_var_use(&n, &u);
+    return u;
+}
+
+// Parameters and autos of the callee, and what each becomes in a copy
+typedef struct {
+    SymId *from, *to;
+    ASTNode **value;    // argument substituted for a parameter, or NULL
+    int count;
+    int serial;
+    int ret;            // RET_* below
+    SymId result;       // RET_ASSIGN: the caller's variable
+    SymId join;         // label after the copy
+} InlineCopy;
+
+enum { RET_VALUE, RET_ASSIGN, RET_DROP };
+
+static int copy_index(const InlineCopy *c, SymId name) {
+    for (int i = 0; i < c->count; ++i)
+        if (c->from[i] == name) return i;
+    return -1;
+}
+
+static SymId suffixed_name(SymId name, const char *tail, int serial) {
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf), "%.*s__i%d%s", (int)symbol_length(name), symbol_name(name), serial, tail);
+    if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+    return intern_name(buf, (size_t)len);
+}
+
+static ASTNode *make_var(SymId name) {
+    ASTNode *v = make_node(AST_VAR);
+    v->data.var.name = name;
+    return v;
+}
+
+static ASTNode *make_statement(ASTNode *e) {
+    ASTNode *s = make_node(AST_STATEMENT);
+    s->data.statement.stmt = e;
+    return s;
+}
+
+static ASTNode *make_assign(SymId name, ASTNode *value) {
+    ASTNode *a = make_node(AST_ASSIGN);
+    a->data.assign.var = make_var(name);
+    a->data.assign.expr = value;
+    return make_statement(a);
+}
+
+static ASTNodeList copy_list(const ASTNodeList *list) {
+    ASTNodeList copy = {0};
+    for (int i = 0; i < list->count; ++i) append_node(&copy, list->items[i]);
+    return copy;
+}
+
+static ASTNode *copy_tree(ASTNode *n, InlineCopy *c);
+
+static void copy_slot(ASTNode **slot, void *ctx) { *slot = copy_tree(*slot, (InlineCopy*)ctx); }
+
+// `return e;` inside a copy: hand the value over and jump past the copy
+static ASTNode *copy_return(ASTNode *n, InlineCopy *c) {
+    ASTNode *e = copy_tree(n->data.ret.expr, c);
+    ASTNode *block = make_node(AST_BLOCK);
+    if (c->ret == RET_ASSIGN)
+        append_node(&block->data.block.statements, make_assign(c->result, e));
+    else if (has_effects(e))
+        append_node(&block->data.block.statements, make_statement(e));
+    ASTNode *go = make_node(AST_GOTO);
+    go->data.go.label = c->join;
+    append_node(&block->data.block.statements, go);
+    return block;
+}
+
+// Deep copy of n; with c, renamed and with returns rewritten for a call site
+static ASTNode *copy_tree(ASTNode *n, InlineCopy *c) {
+    if (!n) return NULL;
+    if (c && n->type == AST_VAR) {
+        int i = copy_index(c, n->data.var.name);
+        if (i >= 0 && c->value[i]) return copy_tree(c->value[i], NULL);
+    }
+    if (c && n->type == AST_RETURN && c->ret != RET_VALUE) return copy_return(n, c);
+    ASTNode *m = make_node(n->type);
+    *m = *n;
+    if (m->type == AST_BLOCK) m->data.block.statements = copy_list(&n->data.block.statements);
+    else if (m->type == AST_CALL) m->data.call.args = copy_list(&n->data.call.args);
+    for_each_child(m, copy_slot, c);
+    if (!c) return m;
+    int i;
+    switch (m->type) {
+        case AST_VAR:
+            if ((i = copy_index(c, m->data.var.name)) >= 0) m->data.var.name = c->to[i];
+            break;
+        case AST_VAR_DECL:
+            if ((i = copy_index(c, m->data.var_decl.name)) >= 0) m->data.var_decl.name = c->to[i];
+            break;
+        case AST_LABEL: m->data.label.label = suffixed_name(m->data.label.label, "", c->serial); break;
+        case AST_GOTO: m->data.go.label = suffixed_name(m->data.go.label, "", c->serial); break;
+        default: break;
+    }
+    return m;
+}
+
+// Whether a variable of the callee that is neither a parameter nor an auto
+// would resolve to one of the caller's
+typedef struct {
+    const ASTNodeList *params;
+    const ASTNodeList *decls;
+    int clash;
+} FreeNames;
+
+static int declared_in(const ASTNodeList *decls, SymId name) {
+    for (int i = 0; i < decls->count; ++i)
+        if (decls->items[i]->data.var_decl.name == name) return 1;
+    return 0;
+}
+
+static void find_clash(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    FreeNames *f = (FreeNames*)ctx;
+    if (!n || f->clash) return;
+    if (n->type == AST_VAR) {
+        SymId name = n->data.var.name;
+        int is_param = 0;
+        for (int i = 0; i < f->params->count; ++i)
+            if (f->params->items[i]->data.var.name == name) is_param = 1;
+        if (!is_param && !declared_in(f->decls, name) && name > 0 && name < num_names && local_kind[name])
+            f->clash = 1;
+    }
+    for_each_child(n, find_clash, ctx);
+}
+
+// The callee of a call that may be inlined here, or NULL
+static InlineFunc *inline_callee(ASTNode *call) {
+    InlineFunc *f = inline_func(call->data.call.name);
+    if (!f || f->state != 2 || f->blocked || f->size > inline_limit) return NULL;
+    ASTNode *fn = f->fn;
+    if (!fn->data.function.body || call->data.call.args.count != fn->data.function.params.count) return NULL;
+    ASTNodeList decls = {0};
+    collect_decls(fn->data.function.body, &decls);
+    FreeNames free_names = { &fn->data.function.params, &decls, 0 };
+    find_clash(&fn->data.function.body, &free_names);
+    return free_names.clash ? NULL : f;
+}
+
+// e of a body that is only `return e;`, not counting externs
+static ASTNode *returned_expr(ASTNode *fn) {
+    ASTNode *body = fn->data.function.body, *e = NULL;
+    if (body->type != AST_BLOCK) return NULL;
+    for (int i = 0; i < body->data.block.statements.count; ++i) {
+        ASTNode *s = body->data.block.statements.items[i];
+        if (s->type == AST_EXTERN || s->type == AST_EMPTY) continue;
+        if (s->type != AST_RETURN || e) return NULL;
+        e = s->data.ret.expr;
+    }
+    return e;
+}
+
+// A copy of the callee's returned expression with the arguments in place of
+// the parameters, when that keeps the order of every effect
+static ASTNode *inline_expression(ASTNode *call, InlineFunc *f) {
+    ASTNode *e = returned_expr(f->fn);
+    if (!e) return NULL;
+    ASTNodeList *params = &f->fn->data.function.params;
+    int effects = has_effects(e);
+    for (int i = 0; i < params->count; ++i) {
+        ASTNode *arg = call->data.call.args.items[i];
+        VarUse u = var_use(e, params->items[i]->data.var.name);
+        int leaf = arg->type == AST_NUM || arg->type == AST_CHAR || arg->type == AST_VAR;
+        if (u.writes || has_effects(arg) || (!leaf && u.reads > 1)) return NULL;
+        // Only constants and the caller's own unaddressed autos are sure to
+        // read the same before and after the effects of e
+        if (effects && arg->type != AST_NUM && arg->type != AST_CHAR) {
+            if (arg->type != AST_VAR) return NULL;
+            SymId name = arg->data.var.name;
+            if (name <= 0 || name >= num_names || local_kind[name] != LOCAL_PLAIN) return NULL;
+        }
+    }
+    InlineCopy c = {0};
+    c.count = params->count;
+    c.from = (SymId*)arena_alloc(ast_arena, (c.count + 1) * sizeof(SymId));
+    c.to = (SymId*)arena_alloc(ast_arena, (c.count + 1) * sizeof(SymId));
+    c.value = (ASTNode**)arena_alloc(ast_arena, (c.count + 1) * sizeof(ASTNode*));
+    for (int i = 0; i < c.count; ++i) {
+        c.from[i] = c.to[i] = params->items[i]->data.var.name;
+        c.value[i] = call->data.call.args.items[i];
+    }
+    return copy_tree(e, &c);
+}
+
+// The block a call statement becomes
+static ASTNode *inline_statement(ASTNode *call, InlineFunc *f, int ret, SymId result) {
+    ASTNode *fn = f->fn, *body = fn->data.function.body;
+    ASTNodeList *params = &fn->data.function.params;
+    ASTNodeList decls = {0};
+    collect_decls(body, &decls);
+    InlineCopy c = {0};
+    int max = params->count + decls.count + 1;
+    c.from = (SymId*)arena_alloc(ast_arena, max * sizeof(SymId));
+    c.to = (SymId*)arena_alloc(ast_arena, max * sizeof(SymId));
+    c.value = (ASTNode**)arena_alloc(ast_arena, max * sizeof(ASTNode*));
+    c.serial = ++fresh_serial;
+    c.ret = ret;
+    c.result = result;
+    c.join = suffixed_name(fn->data.function.name, "_ret", c.serial);
+    ASTNode *block = make_node(AST_BLOCK);
+    ASTNodeList *out = &block->data.block.statements;
+    for (int i = 0; i < params->count; ++i) {
+        SymId name = params->items[i]->data.var.name;
+        ASTNode *arg = call->data.call.args.items[i];
+        c.from[c.count] = name;
+        c.value[c.count] = NULL;
+        // A constant argument to a parameter the body never changes is
+        // substituted, which leaves it to constant folding
+        if ((arg->type == AST_NUM || arg->type == AST_CHAR) && var_use(body, name).writes == 0 &&
+            !declared_in(&decls, name)) {
+            c.to[c.count] = name;
+            c.value[c.count] = arg;
+        } else {
+            c.to[c.count] = suffixed_name(name, "", c.serial);
+            ASTNode *decl = make_node(AST_VAR_DECL);
+            decl->data.var_decl.name = c.to[c.count];
+            append_node(out, decl);
+        }
+        c.count++;
+    }
+    for (int i = 0; i < decls.count; ++i) {
+        SymId name = decls.items[i]->data.var_decl.name;
+        if (copy_index(&c, name) >= 0) continue;
+        c.from[c.count] = name;
+        c.to[c.count] = suffixed_name(name, "", c.serial);
+        c.value[c.count] = NULL;
+        c.count++;
+    }
+    // Arguments are evaluated right to left, as for a call
+    for (int i = params->count - 1; i >= 0; --i)
+        if (!c.value[i]) append_node(out, make_assign(c.to[i], call->data.call.args.items[i]));
+    append_node(out, copy_tree(body, &c));
+    if (ret == RET_VALUE) {
+        // Falling off the end returns from the caller too
+        ASTNodeList *stmts = &body->data.block.statements;
+        if (body->type != AST_BLOCK || !stmts->count || stmts->items[stmts->count - 1]->type != AST_RETURN) {
+            ASTNode *r = make_node(AST_RETURN);
+            r->data.ret.expr = make_num(0);
+            append_node(out, r);
+        }
+    } else {
+        ASTNode *label = make_node(AST_LABEL);
+        label->data.label.label = c.join;
+        append_node(out, label);
+    }
+    return block;
+}
+
+static ASTNode *inline_expr(ASTNode *e);
+
+static void inline_expr_slot(ASTNode **slot, void *ctx) {
+    (void)ctx;
+    *slot = inline_expr(*slot);
+}
+
+static ASTNode *inline_expr(ASTNode *e) {
+    if (!e) return e;
+    for_each_child(e, inline_expr_slot, NULL);
+    if (e->type == AST_CALL) {
+        InlineFunc *f = inline_callee(e);
+        ASTNode *r = f ? inline_expression(e, f) : NULL;
+        if (r) return r;
+    }
+    return e;
+}
+
+static ASTNode *inline_stmt(ASTNode *s) {
+    if (!s) return s;
+    switch (s->type) {
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                s->data.block.statements.items[i] = inline_stmt(s->data.block.statements.items[i]);
+            return s;
+        case AST_IF:
+            s->data.if_stmt.cond = inline_expr(s->data.if_stmt.cond);
+            s->data.if_stmt.then_branch = inline_stmt(s->data.if_stmt.then_branch);
+            s->data.if_stmt.else_branch = inline_stmt(s->data.if_stmt.else_branch);
+            return s;
+        case AST_WHILE:
+            s->data.while_stmt.cond = inline_expr(s->data.while_stmt.cond);
+            s->data.while_stmt.body = inline_stmt(s->data.while_stmt.body);
+            return s;
+        case AST_STATEMENT: {
+            ASTNode *e = s->data.statement.stmt = inline_expr(s->data.statement.stmt);
+            InlineFunc *f;
+            if (e && e->type == AST_CALL && (f = inline_callee(e)))
+                return inline_statement(e, f, RET_DROP, SYM_NONE);
+            if (e && e->type == AST_ASSIGN && e->data.assign.var && e->data.assign.var->type == AST_VAR &&
+                e->data.assign.expr && e->data.assign.expr->type == AST_CALL && (f = inline_callee(e->data.assign.expr)))
+                return inline_statement(e->data.assign.expr, f, RET_ASSIGN, e->data.assign.var->data.var.name);
+            return s;
+        }
+        case AST_RETURN: {
+            ASTNode *e = s->data.ret.expr = inline_expr(s->data.ret.expr);
+            InlineFunc *f;
+            if (e && e->type == AST_CALL && (f = inline_callee(e)))
+                return inline_statement(e, f, RET_VALUE, SYM_NONE);
+            return s;
+        }
+        default:
+            return s;
+    }
+}
+
+static void mark_local(SymId name, unsigned char mark) {
+    if (name > 0 && name < num_names) local_kind[name] = mark;
+}
+
+// Inline into f after inlining into everything it calls; a call back into
+// a function still in progress is part of a cycle and stays a call
+static void inline_function(InlineFunc *f);
+
+static void visit_callees(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    if (!n) return;
+    if (n->type == AST_CALL) {
+        InlineFunc *g = inline_func(n->data.call.name);
+        if (g) inline_function(g);
+    }
+    for_each_child(n, visit_callees, ctx);
+}
+
+static void inline_function(InlineFunc *f) {
+    if (f->state) return;
+    f->state = 1;
+    ASTNode *fn = f->fn;
+    visit_callees(&fn->data.function.body, NULL);
+    ASTNodeList *params = &fn->data.function.params;
+    ASTNodeList decls = {0};
+    collect_decls(fn->data.function.body, &decls);
+    for (int i = 0; i < params->count; ++i) mark_local(params->items[i]->data.var.name, LOCAL_PLAIN);
+    for (int i = 0; i < decls.count; ++i) mark_local(decls.items[i]->data.var_decl.name, LOCAL_PLAIN);
+    mark_addressed_locals(&fn->data.function.body, NULL);
+    fn->data.function.body = inline_stmt(fn->data.function.body);
+    for (int i = 0; i < params->count; ++i) mark_local(params->items[i]->data.var.name, 0);
+    for (int i = 0; i < decls.count; ++i) mark_local(decls.items[i]->data.var_decl.name, 0);
+    BodyScan scan = {0};
+    scan_body(&fn->data.function.body, &scan);
+    f->size = scan.size;
+    f->blocked |= scan.unsafe;
+    f->state = 2;
+}
+
+void inline_program(ASTNode *program) {
+    if (!program || program->type != AST_PROGRAM || inline_limit <= 0) return;
+    ASTNodeList *items = &program->data.program.functions;
+    num_names = symbol_count() + 1;
+    inline_funcs = (InlineFunc*)calloc(items->count + 1, sizeof(InlineFunc));
+    inline_slot = (int*)calloc(num_names, sizeof(int));
+    inline_global = (unsigned char*)calloc(num_names, 1);
+    local_kind = (unsigned char*)calloc(num_names, 1);
+    int count = 0;
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *item = items->items[i];
+        if (item->type == AST_FUNCTION && item->data.function.body && item->data.function.name > 0 &&
+            item->data.function.name < num_names) {
+            inline_funcs[count].fn = item;
+            inline_slot[item->data.function.name] = ++count;
+        } else if (item->type == AST_GLOBAL && item->data.global.name > 0 && item->data.global.name < num_names) {
+            inline_global[item->data.global.name] = 1;
+        }
+    }
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *item = items->items[i];
+        if (item->type == AST_FUNCTION) mark_address_taken(&item->data.function.body, NULL);
+        else if (item->type == AST_GLOBAL) mark_address_taken(&item->data.global.init, NULL);
+    }
+    for (int i = 0; i < count; ++i) inline_function(&inline_funcs[i]);
+    free(inline_funcs);
+    free(inline_slot);
+    free(inline_global);
+    free(local_kind);
+    inline_funcs = NULL;
+    inline_slot = NULL;
+    inline_global = local_kind = NULL;
+}
+
+// --- Loops ---
+// Each while statement is rewritten after the loops nested in it. Pure
+// expressions whose value cannot change while the loop runs are computed
+// once, into fresh autos: the loop becomes `if (c) { hoisted; while (c) ... }`
+// so nothing is evaluated for a loop that never runs, and is marked entered
+// so the code generator does not test c twice. A counted loop
+// `while (i < n) { ...; i++; }` is then unrolled: a copy whose body runs
+// unroll_factor iterations takes all but the last few, and the original loop
+// finishes them. n - (unroll_factor - 1) is assumed not to wrap.
+
+int unroll_factor = 4;
+
+#define UNROLL_LIMIT 40   // largest body, in AST nodes, that is unrolled
+
+// What a loop may change
+typedef struct {
+    SymId *assigned;   // variables assigned, incremented or decremented
+    int count, cap;
+    int calls;         // a call may change any global or addressed variable
+    int stores;        // and so may a store through a pointer or an index
+} LoopWrites;
+
+static int kind_of(SymId name) {
+    if (name <= 0) return 0;
+    // Names past the table are the autos this pass made
+    return name < num_names ? local_kind[name] : LOCAL_PLAIN;
+}
+
+static void note_write(LoopWrites *w, const ASTNode *target) {
+    if (!target || target->type != AST_VAR) {
+        w->stores = 1;
+        return;
+    }
+    if (w->count == w->cap) {
+        w->cap = w->cap ? 2 * w->cap : 8;
+        w->assigned = (SymId*)realloc(w->assigned, w->cap * sizeof(SymId));
+    }
+    w->assigned[w->count++] = target->data.var.name;
+}
+
+static void scan_writes(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    LoopWrites *w = (LoopWrites*)ctx;
+    if (!n) return;
+    if (n->type == AST_CALL) w->calls = 1;
+    else if (n->type == AST_ASSIGN) note_write(w, n->data.assign.var);
+    else if (n->type == AST_UNOP && (n->data.unop.op == OP_INC || n->data.unop.op == OP_DEC))
+        note_write(w, n->data.unop.expr);
+    for_each_child(n, scan_writes, ctx);
+}
+
+static int times_written(const LoopWrites *w, SymId name) {
+    int times = 0;
+    for (int i = 0; i < w->count; ++i) times += w->assigned[i] == name;
+    return times;
+}
+
+// Whether e has the same value on every iteration of a loop that makes the
+// writes w. It is then also free of effects.
+static int invariant(const ASTNode *e, const LoopWrites *w) {
+    int memory_fixed = !w->calls && !w->stores;
+    if (!e) return 1;
+    switch (e->type) {
+        case AST_NUM: case AST_CHAR: case AST_STRING: return 1;
+        case AST_VAR:
+            if (times_written(w, e->data.var.name)) return 0;
+            return kind_of(e->data.var.name) == LOCAL_PLAIN || memory_fixed;
+        case AST_BINOP:
+            return invariant(e->data.binop.left, w) && invariant(e->data.binop.right, w);
+        case AST_INDEX:
+            return memory_fixed && invariant(e->data.index.array, w) && invariant(e->data.index.index, w);
+        case AST_UNOP: {
+            const ASTNode *x = e->data.unop.expr;
+            switch (e->data.unop.op) {
+                case OP_INC: case OP_DEC: return 0;
+                case OP_MUL: return memory_fixed && invariant(x, w);
+                case OP_BITAND:
+                    // An address, not a read
+                    if (!x) return 0;
+                    if (x->type == AST_VAR) return 1;
+                    if (x->type == AST_INDEX) return invariant(x->data.index.array, w) && invariant(x->data.index.index, w);
+                    return x->type == AST_UNOP && x->data.unop.op == OP_MUL && invariant(x->data.unop.expr, w);
+                default: return invariant(x, w);
+            }
+        }
+        default: return 0;
+    }
+}
+
+// Whether evaluating e can fault: it reads memory, or divides by anything
+// but a literal other than 0 and -1
+static int may_fault(const ASTNode *e) {
+    int c;
+    if (!e) return 0;
+    switch (e->type) {
+        case AST_INDEX: return 1;
+        case AST_UNOP:
+            if (e->data.unop.op == OP_MUL) return 1;
+            if (e->data.unop.op == OP_BITAND) return 0;
+            return may_fault(e->data.unop.expr);
+        case AST_BINOP:
+            if ((e->data.binop.op == OP_DIV || e->data.binop.op == OP_MOD) &&
+                (!literal_value(e->data.binop.right, &c) || c == 0 || c == -1))
+                return 1;
+            return may_fault(e->data.binop.left) || may_fault(e->data.binop.right);
+        default: return 0;
+    }
+}
+
+static int is_leaf(const ASTNode *e) {
+    return e->type == AST_NUM || e->type == AST_CHAR || e->type == AST_STRING || e->type == AST_VAR;
+}
+
+// Whether an invariant expression costs more than reading an auto
+static int worth_hoisting(const ASTNode *e) {
+    switch (e->type) {
+        case AST_INDEX: return 1;
+        case AST_UNOP:
+            if (e->data.unop.op == OP_MUL) return 1;
+            return e->data.unop.op != OP_BITAND && e->data.unop.expr && !is_leaf(e->data.unop.expr);
+        case AST_BINOP: {
+            Operator op = e->data.binop.op;
+            if (op == OP_MUL || op == OP_DIV || op == OP_MOD) return 1;
+            return !is_leaf(e->data.binop.left) || !is_leaf(e->data.binop.right);
+        }
+        default: return 0;
+    }
+}
+
+static int same_tree(const ASTNode *a, const ASTNode *b) {
+    if (!a || !b) return a == b;
+    if (a->type != b->type) return 0;
+    switch (a->type) {
+        case AST_NUM: return a->data.num.value == b->data.num.value;
+        case AST_CHAR: return a->data.char_lit.value == b->data.char_lit.value;
+        case AST_STRING: return strcmp(a->data.string_lit.value, b->data.string_lit.value) == 0;
+        case AST_VAR: return a->data.var.name == b->data.var.name;
+        case AST_BINOP:
+            return a->data.binop.op == b->data.binop.op && same_tree(a->data.binop.left, b->data.binop.left) &&
+                   same_tree(a->data.binop.right, b->data.binop.right);
+        case AST_UNOP:
+            return a->data.unop.op == b->data.unop.op && a->data.unop.is_postfix == b->data.unop.is_postfix &&
+                   same_tree(a->data.unop.expr, b->data.unop.expr);
+        case AST_INDEX:
+            return same_tree(a->data.index.array, b->data.index.array) &&
+                   same_tree(a->data.index.index, b->data.index.index);
+        default: return 0;
+    }
+}
+
+// Expressions moved out of one loop and the autos that hold them
+typedef struct {
+    const LoopWrites *writes;
+    ASTNodeList exprs, decls;
+} Hoist;
+
+static ASTNode *hoisted_value(Hoist *h, ASTNode *e) {
+    for (int i = 0; i < h->exprs.count; ++i)
+        if (same_tree(h->exprs.items[i], e)) return make_var(h->decls.items[i]->data.var_decl.name);
+    ASTNode *decl = make_node(AST_VAR_DECL);
+    decl->data.var_decl.name = suffixed_name(intern_name("inv", 3), "", ++fresh_serial);
+    append_node(&h->exprs, e);
+    append_node(&h->decls, decl);
+    return make_var(decl->data.var_decl.name);
+}
+
+// sure: e is evaluated whenever the loop runs, so an expression that may
+// fault can be evaluated before it instead
+static ASTNode *hoist_expr(ASTNode *e, Hoist *h, int sure);
+
+// Subexpressions of an assigned, incremented or addressed operand
+static void hoist_lvalue(ASTNode *e, Hoist *h, int sure) {
+    if (!e) return;
+    if (e->type == AST_INDEX) {
+        e->data.index.array = hoist_expr(e->data.index.array, h, sure);
+        e->data.index.index = hoist_expr(e->data.index.index, h, sure);
+    } else if (e->type == AST_UNOP && e->data.unop.op == OP_MUL) {
+        e->data.unop.expr = hoist_expr(e->data.unop.expr, h, sure);
+    }
+}
+
+static ASTNode *hoist_expr(ASTNode *e, Hoist *h, int sure) {
+    if (!e) return e;
+    if (worth_hoisting(e) && invariant(e, h->writes) && (sure || !may_fault(e)))
+        return hoisted_value(h, e);
+    switch (e->type) {
+        case AST_BINOP: {
+            // The right operand of && and || may not be evaluated
+            int lazy = e->data.binop.op == OP_AND || e->data.binop.op == OP_OR;
+            e->data.binop.left = hoist_expr(e->data.binop.left, h, sure);
+            e->data.binop.right = hoist_expr(e->data.binop.right, h, sure && !lazy);
+            break;
+        }
+        case AST_UNOP: {
+            Operator op = e->data.unop.op;
+            if (op == OP_INC || op == OP_DEC || op == OP_BITAND) hoist_lvalue(e->data.unop.expr, h, sure);
+            else e->data.unop.expr = hoist_expr(e->data.unop.expr, h, sure);
+            break;
+        }
+        case AST_ASSIGN:
+            hoist_lvalue(e->data.assign.var, h, sure);
+            e->data.assign.expr = hoist_expr(e->data.assign.expr, h, sure);
+            break;
+        case AST_CALL:
+            for (int i = 0; i < e->data.call.args.count; ++i)
+                e->data.call.args.items[i] = hoist_expr(e->data.call.args.items[i], h, sure);
+            e->data.call.left = hoist_expr(e->data.call.left, h, sure);
+            break;
+        case AST_INDEX:
+            e->data.index.array = hoist_expr(e->data.index.array, h, sure);
+            e->data.index.index = hoist_expr(e->data.index.index, h, sure);
+            break;
+        default: break;
+    }
+    return e;
+}
+
+// Statements up to the first that may branch are sure to run on every
+// iteration
+static void hoist_stmt(ASTNode *s, Hoist *h, int sure) {
+    if (!s) return;
+    switch (s->type) {
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i) {
+                ASTNode *item = s->data.block.statements.items[i];
+                hoist_stmt(item, h, sure);
+                if (item->type != AST_STATEMENT && item->type != AST_VAR_DECL && item->type != AST_EXTERN &&
+                    item->type != AST_EMPTY)
+                    sure = 0;
+            }
+            break;
+        case AST_STATEMENT: s->data.statement.stmt = hoist_expr(s->data.statement.stmt, h, sure); break;
+        case AST_ASSIGN: hoist_expr(s, h, sure); break;
+        case AST_RETURN: s->data.ret.expr = hoist_expr(s->data.ret.expr, h, sure); break;
+        case AST_IF:
+            s->data.if_stmt.cond = hoist_expr(s->data.if_stmt.cond, h, sure);
+            hoist_stmt(s->data.if_stmt.then_branch, h, 0);
+            hoist_stmt(s->data.if_stmt.else_branch, h, 0);
+            break;
+        case AST_WHILE:
+            s->data.while_stmt.cond = hoist_expr(s->data.while_stmt.cond, h, sure && !s->data.while_stmt.entered);
+            hoist_stmt(s->data.while_stmt.body, h, 0);
+            break;
+        default: break;
+    }
+}
+
+static ASTNode *loop_function;   // body of the function being rewritten
+
+typedef struct {
+    SymId label;
+    int count;
+} GotoCount;
+
+static void count_gotos(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    GotoCount *g = (GotoCount*)ctx;
+    if (!n) return;
+    if (n->type == AST_GOTO && n->data.go.label == g->label) g->count++;
+    for_each_child(n, count_gotos, ctx);
+}
+
+static int gotos_to(ASTNode *tree, SymId label) {
+    GotoCount g = { label, 0 };
+    count_gotos(&tree, &g);
+    return g.count;
+}
+
+// Whether a goto outside the loop targets a label in s, such as the join
+// label of an inlined call does not
+static int entered_by_goto(ASTNode *s, ASTNode *loop) {
+    if (!s) return 0;
+    switch (s->type) {
+        case AST_LABEL:
+            return gotos_to(loop_function, s->data.label.label) != gotos_to(loop, s->data.label.label);
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                if (entered_by_goto(s->data.block.statements.items[i], loop)) return 1;
+            return 0;
+        case AST_IF:
+            return entered_by_goto(s->data.if_stmt.then_branch, loop) || entered_by_goto(s->data.if_stmt.else_branch, loop);
+        case AST_WHILE: return entered_by_goto(s->data.while_stmt.body, loop);
+        default: return 0;
+    }
+}
+
+// The guarded loop with its invariants computed first, or w itself
+static ASTNode *hoist_loop(ASTNode *w, const LoopWrites *writes) {
+    ASTNode *cond = w->data.while_stmt.cond, *body = w->data.while_stmt.body;
+    // The guard evaluates c once more; a goto into the loop would skip the
+    // hoisted code
+    if (!cond || has_effects(cond) || entered_by_goto(body, w) || contains_stmt(body, AST_META)) return w;
+    Hoist h = { writes, {0}, {0} };
+    ASTNode *guard = copy_tree(cond, NULL);
+    w->data.while_stmt.cond = hoist_expr(cond, &h, 1);
+    // A call might exit before the body gets to a faulting expression
+    hoist_stmt(body, &h, !writes->calls);
+    if (!h.exprs.count) return w;
+    ASTNode *pre = make_node(AST_BLOCK);
+    for (int i = 0; i < h.decls.count; ++i) append_node(&pre->data.block.statements, h.decls.items[i]);
+    for (int i = 0; i < h.exprs.count; ++i)
+        append_node(&pre->data.block.statements, make_assign(h.decls.items[i]->data.var_decl.name, h.exprs.items[i]));
+    w->data.while_stmt.entered = 1;
+    append_node(&pre->data.block.statements, w);
+    ASTNode *guarded = make_node(AST_IF);
+    guarded->data.if_stmt.cond = guard;
+    guarded->data.if_stmt.then_branch = pre;
+    return guarded;
+}
+
+static void count_nodes(ASTNode **slot, void *ctx) {
+    if (!*slot) return;
+    ++*(int*)ctx;
+    for_each_child(*slot, count_nodes, ctx);
+}
+
+// Whether control can leave an iteration other than at its end: a break or
+// continue of this loop, or a goto or label anywhere
+static int leaves_early(const ASTNode *s) {
+    if (!s) return 0;
+    switch (s->type) {
+        case AST_BREAK: case AST_CONTINUE: case AST_GOTO: case AST_LABEL: case AST_META: return 1;
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                if (leaves_early(s->data.block.statements.items[i])) return 1;
+            return 0;
+        case AST_IF: return leaves_early(s->data.if_stmt.then_branch) || leaves_early(s->data.if_stmt.else_branch);
+        case AST_WHILE:
+            return contains_stmt(s->data.while_stmt.body, AST_GOTO) || has_label(s->data.while_stmt.body) ||
+                   contains_stmt(s->data.while_stmt.body, AST_META);
+        default: return 0;
+    }
+}
+
+// `i++;`, `++i;` or `i = i + 1;`
+static int is_increment(const ASTNode *s, SymId name) {
+    if (!s || s->type != AST_STATEMENT || !s->data.statement.stmt) return 0;
+    const ASTNode *e = s->data.statement.stmt;
+    if (e->type == AST_UNOP && e->data.unop.op == OP_INC)
+        return e->data.unop.expr && e->data.unop.expr->type == AST_VAR && e->data.unop.expr->data.var.name == name;
+    int one;
+    if (e->type != AST_ASSIGN || !e->data.assign.var || e->data.assign.var->type != AST_VAR ||
+        e->data.assign.var->data.var.name != name)
+        return 0;
+    e = e->data.assign.expr;
+    return e && e->type == AST_BINOP && e->data.binop.op == OP_ADD && e->data.binop.left &&
+           e->data.binop.left->type == AST_VAR && e->data.binop.left->data.var.name == name &&
+           literal_value(e->data.binop.right, &one) && one == 1;
+}
+
+// `{ while (i < n - (k-1)) { body k times } w }` for a counted loop w, or w
+static ASTNode *unroll_loop(ASTNode *w, const LoopWrites *writes) {
+    ASTNode *cond = w->data.while_stmt.cond, *body = w->data.while_stmt.body;
+    if (unroll_factor < 2 || !cond || cond->type != AST_BINOP ||
+        (cond->data.binop.op != OP_LT && cond->data.binop.op != OP_LE))
+        return w;
+    ASTNode *i = cond->data.binop.left, *n = cond->data.binop.right;
+    if (!i || i->type != AST_VAR || kind_of(i->data.var.name) != LOCAL_PLAIN || !invariant(n, writes)) return w;
+    if (!body || body->type != AST_BLOCK || !body->data.block.statements.count) return w;
+    ASTNodeList *stmts = &body->data.block.statements;
+    if (!is_increment(stmts->items[stmts->count - 1], i->data.var.name) ||
+        times_written(writes, i->data.var.name) != 1 || leaves_early(body))
+        return w;
+    int size = 0;
+    count_nodes(&body, &size);
+    if (size > UNROLL_LIMIT) return w;
+    ASTNode *limit = make_node(AST_BINOP);
+    limit->data.binop.op = OP_SUB;
+    limit->data.binop.left = copy_tree(n, NULL);
+    limit->data.binop.right = make_num(unroll_factor - 1);
+    ASTNode *fast = make_node(AST_WHILE);
+    fast->data.while_stmt.cond = make_node(AST_BINOP);
+    fast->data.while_stmt.cond->data.binop.op = cond->data.binop.op;
+    fast->data.while_stmt.cond->data.binop.left = make_var(i->data.var.name);
+    fast->data.while_stmt.cond->data.binop.right = fold_expr(limit);
+    fast->data.while_stmt.body = make_node(AST_BLOCK);
+    for (int k = 0; k < unroll_factor; ++k)
+        for (int j = 0; j < stmts->count; ++j)
+            append_node(&fast->data.while_stmt.body->data.block.statements, copy_tree(stmts->items[j], NULL));
+    // The rest of the iterations, if any
+    w->data.while_stmt.entered = 0;
+    ASTNode *block = make_node(AST_BLOCK);
+    append_node(&block->data.block.statements, fast);
+    append_node(&block->data.block.statements, w);
+    return block;
+}
+
+static ASTNode *optimize_loop(ASTNode *w) {
+    LoopWrites writes = {0};
+    scan_writes(&w, &writes);
+    ASTNode *r = hoist_loop(w, &writes);
+    if (r == w) {
+        r = unroll_loop(w, &writes);
+    } else {
+        ASTNodeList *pre = &r->data.if_stmt.then_branch->data.block.statements;
+        pre->items[pre->count - 1] = unroll_loop(w, &writes);
+    }
+    free(writes.assigned);
+    return r;
+}
+
+static void optimize_loops_in(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    if (!n) return;
+    for_each_child(n, optimize_loops_in, ctx);
+    if (n->type == AST_WHILE) *slot = optimize_loop(n);
+}
+
+void optimize_loops(ASTNode *program) {
+    if (!program || program->type != AST_PROGRAM) return;
+    ASTNodeList *items = &program->data.program.functions;
+    num_names = symbol_count() + 1;
+    local_kind = (unsigned char*)calloc(num_names, 1);
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *fn = items->items[i];
+        if (fn->type != AST_FUNCTION || !fn->data.function.body) continue;
+        ASTNodeList *params = &fn->data.function.params;
+        ASTNodeList decls = {0};
+        collect_decls(fn->data.function.body, &decls);
+        for (int j = 0; j < params->count; ++j) mark_local(params->items[j]->data.var.name, LOCAL_PLAIN);
+        for (int j = 0; j < decls.count; ++j) mark_local(decls.items[j]->data.var_decl.name, LOCAL_PLAIN);
+        mark_addressed_locals(&fn->data.function.body, NULL);
+        loop_function = fn->data.function.body;
+        optimize_loops_in(&fn->data.function.body, NULL);
+        for (int j = 0; j < params->count; ++j) mark_local(params->items[j]->data.var.name, 0);
+        for (int j = 0; j < decls.count; ++j) mark_local(decls.items[j]->data.var_decl.name, 0);
+    }
+    free(local_kind);
+    local_kind = NULL;
+    loop_function = NULL;
+}
+
+// --- Dead code ---
+// Functions nothing can call are dropped: the roots are main and every
+// function named as a value, since a pointer to it may be called from
+// anywhere. A program without main is a library and keeps all of them.
+// Within a body, statements after one that never completes are dropped up
+// to the next label, keeping the autos and externs they declare.
+
+int drop_unused_globals = 0;
+PruneStats prune_stats;
+
+// Whether control can run past the end of s. break and continue only leave
+// inside a loop; the code generator ignores them anywhere else.
+static int completes(const ASTNode *s, int in_loop) {
+    if (!s) return 1;
+    switch (s->type) {
+        case AST_RETURN: return s->data.ret.expr == NULL;
+        case AST_GOTO: return 0;
+        case AST_BREAK: case AST_CONTINUE: return !in_loop;
+        case AST_IF:
+            return !s->data.if_stmt.else_branch || completes(s->data.if_stmt.then_branch, in_loop) ||
+                   completes(s->data.if_stmt.else_branch, in_loop);
+        case AST_BLOCK: {
+            int reachable = 1;
+            for (int i = 0; i < s->data.block.statements.count; ++i) {
+                const ASTNode *item = s->data.block.statements.items[i];
+                if (has_label(item)) reachable = 1;
+                if (reachable) reachable = completes(item, in_loop);
+            }
+            return reachable;
+        }
+        default: return 1;
+    }
+}
+
+int falls_through(const ASTNode *s) {
+    return completes(s, 0);
+}
+
+// The autos and externs of a statement that is dropped
+static void keep_declarations(ASTNode *s, ASTNodeList *kept) {
+    if (!s) return;
+    switch (s->type) {
+        case AST_VAR_DECL: case AST_EXTERN: append_node(kept, s); break;
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                keep_declarations(s->data.block.statements.items[i], kept);
+            break;
+        case AST_IF:
+            keep_declarations(s->data.if_stmt.then_branch, kept);
+            keep_declarations(s->data.if_stmt.else_branch, kept);
+            break;
+        case AST_WHILE: keep_declarations(s->data.while_stmt.body, kept); break;
+        case AST_EMPTY: break;
+        default: prune_stats.statements++; break;
+    }
+}
+
+static ASTNode *prune_stmt(ASTNode *s, int in_loop) {
+    if (!s) return s;
+    switch (s->type) {
+        case AST_BLOCK: {
+            ASTNodeList kept = {0};
+            int reachable = 1;
+            for (int i = 0; i < s->data.block.statements.count; ++i) {
+                ASTNode *item = s->data.block.statements.items[i];
+                // A meta block runs while compiling, reachable or not
+                if (!reachable && !has_label(item) && !contains_stmt(item, AST_META)) {
+                    keep_declarations(item, &kept);
+                    continue;
+                }
+                item = prune_stmt(item, in_loop);
+                append_node(&kept, item);
+                reachable = completes(item, in_loop);
+            }
+            s->data.block.statements = kept;
+            return s;
+        }
+        case AST_IF:
+            s->data.if_stmt.then_branch = prune_stmt(s->data.if_stmt.then_branch, in_loop);
+            s->data.if_stmt.else_branch = prune_stmt(s->data.if_stmt.else_branch, in_loop);
+            return s;
+        case AST_WHILE:
+            s->data.while_stmt.body = prune_stmt(s->data.while_stmt.body, 1);
+            return s;
+        default:
+            return s;
+    }
+}
+
+// Names mentioned as values; calls are followed separately
+static void mark_named(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    unsigned char *named = (unsigned char*)ctx;
+    if (!n) return;
+    if (n->type == AST_VAR && n->data.var.name < num_names) named[n->data.var.name] = 1;
+    if (n->type == AST_EXTERN && n->data.ext.name < num_names) named[n->data.ext.name] = 1;
+    for_each_child(n, mark_named, ctx);
+}
+
+static void mark_called(ASTNode **slot, void *ctx) {
+    ASTNode *n = *slot;
+    unsigned char *called = (unsigned char*)ctx;
+    if (!n) return;
+    if (n->type == AST_CALL && n->data.call.name > 0 && n->data.call.name < num_names)
+        called[n->data.call.name] = 1;
+    for_each_child(n, mark_called, ctx);
+}
+
+void prune_program(ASTNode *program) {
+    if (!program || program->type != AST_PROGRAM) return;
+    ASTNodeList *items = &program->data.program.functions;
+    memset(&prune_stats, 0, sizeof(prune_stats));
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *item = items->items[i];
+        if (item->type == AST_FUNCTION)
+            item->data.function.body = prune_stmt(item->data.function.body, 0);
+    }
+    num_names = symbol_count() + 1;
+    unsigned char *named = (unsigned char*)calloc(num_names, 1);
+    unsigned char *called = (unsigned char*)calloc(num_names, 1);
+    unsigned char *live = (unsigned char*)calloc(items->count + 1, 1);
+    SymId main_name = intern_name("main", 4);
+    int has_main = 0;
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *item = items->items[i];
+        if (item->type == AST_FUNCTION) {
+            mark_named(&item->data.function.body, named);
+            if (item->data.function.name == main_name) has_main = 1;
+        } else if (item->type == AST_GLOBAL) {
+            mark_named(&item->data.global.init, named);
+        }
+    }
+    // Follow calls from the roots until nothing new is reached
+    if (has_main) {
+        called[main_name] = 1;
+        for (int changed = 1; changed; ) {
+            changed = 0;
+            for (int i = 0; i < items->count; ++i) {
+                ASTNode *item = items->items[i];
+                if (item->type != AST_FUNCTION || live[i]) continue;
+                SymId name = item->data.function.name;
+                if (name >= num_names || (!called[name] && !named[name])) continue;
+                live[i] = 1;
+                mark_called(&item->data.function.body, called);
+                changed = 1;
+            }
+        }
+    }
+    // Names used by the code that stays
+    memset(named, 0, num_names);
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *item = items->items[i];
+        if (item->type == AST_FUNCTION && (live[i] || !has_main))
+            mark_named(&item->data.function.body, named);
+        else if (item->type == AST_GLOBAL)
+            mark_named(&item->data.global.init, named);
+    }
+    int n = 0;
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *item = items->items[i];
+        if (item->type == AST_FUNCTION && has_main && !live[i]) {
+            prune_stats.functions++;
+            continue;
+        }
+        if (item->type == AST_GLOBAL && drop_unused_globals && !item->data.global.init &&
+            item->data.global.name < num_names && !named[item->data.global.name]) {
+            prune_stats.globals++;
+            continue;
+        }
+        items->items[n++] = item;
+    }
+    items->count = n;
+    free(named);
+    free(called);
+    free(live);
+}
@@ -0,0 +1,59 @@
+#ifndef OPT_H
+#define OPT_H
+
+#include <stdint.h>
+#include "b.h"
+
+// --- AST optimization passes ---
+// Target-independent rewrites run between parse_program and the code
+// generator. They work in place and allocate new nodes from ast_arena.
+
+// -O<n>: 0 turns every optimization off; the default is 1
+extern int opt_level;
+
+// -finline-limit=<n>: largest callee, in AST nodes, that inline_program
+// copies into its callers; 0 turns inlining off
+extern int inline_limit;
+
+// Replace calls to small functions of the program by their bodies. Functions
+// whose address is taken are never inlined.
+void inline_program(ASTNode *program);
+
+// Fold constant subexpressions, apply algebraic identities and replace
+// if/while statements whose condition is constant by the branch taken
+void fold_program(ASTNode *program);
+
+// -funroll-factor=<n>: iterations per pass of an unrolled counted loop;
+// 0 or 1 turns unrolling off
+extern int unroll_factor;
+
+// Hoist invariant expressions out of while loops, which the code generator
+// then lays out with the test at the bottom, and unroll counted loops
+void optimize_loops(ASTNode *program);
+
+// -fdrop-unused-globals: prune_program also removes globals without an
+// initializer that no remaining code names
+extern int drop_unused_globals;
+
+// What the last prune_program removed
+typedef struct {
+    int functions, statements, globals;
+} PruneStats;
+extern PruneStats prune_stats;
+
+// Remove the functions main cannot reach, directly or through a function
+// pointer, and the statements control never reaches
+void prune_program(ASTNode *program);
+
+// Whether control can run past the end of statement s
+int falls_through(const ASTNode *s);
+
+// Value of a constant expression. Returns 0 if e is not one, or if its
+// value does not fit a literal.
+int fold_constant(const ASTNode *e, int *value);
+
+// Value of a constant expression at the target's full word size, for
+// global initializers. Returns 0 if e is not one.
+int fold_word(const ASTNode *e, int64_t *value);
+
+#endif // OPT_H
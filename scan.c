@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "scan.h"
+
+// The vector scanners only issue aligned loads. An aligned 16/32-byte block
+// never crosses a page boundary, so reading the bytes around the start
+// position or past the terminating NUL cannot fault.
+
+// --- Scalar fallback ---
+static int is_space_byte(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+static int is_ident_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static size_t skip_space_scalar(const char *src, size_t pos) {
+    while (is_space_byte((unsigned char)src[pos])) pos++;
+    return pos;
+}
+static size_t skip_ident_scalar(const char *src, size_t pos) {
+    while (is_ident_byte((unsigned char)src[pos])) pos++;
+    return pos;
+}
+static size_t find_newline_scalar(const char *src, size_t pos) {
+    while (src[pos] && src[pos] != '\n') pos++;
+    return pos;
+}
+static size_t find_comment_end_scalar(const char *src, size_t pos) {
+    while (src[pos] && !(src[pos] == '*' && src[pos+1] == '/')) pos++;
+    return pos;
+}
+
+// Walk aligned blocks from pos until STOP(block) has a bit set for a byte at
+// or after pos; evaluates to the offset of that byte.
+#define SCAN_BLOCKS(WIDTH, LOAD, STOP, src, pos) do {                    \
+    const char *p_ = (src) + (pos);                                      \
+    const char *block_ = (const char*)((uintptr_t)p_ & ~(uintptr_t)((WIDTH) - 1)); \
+    uint32_t mask_ = STOP(LOAD(block_)) >> (p_ - block_);                \
+    if (mask_) return (pos) + __builtin_ctz(mask_);                      \
+    for (block_ += (WIDTH);; block_ += (WIDTH)) {                        \
+        mask_ = STOP(LOAD(block_));                                      \
+        if (mask_) return (size_t)(block_ - (src)) + __builtin_ctz(mask_); \
+    }                                                                    \
+} while (0)
+
+// --- SSE2 ---
+#define SSE_LOAD(p) _mm_load_si128((const __m128i*)(p))
+
+__attribute__((target("sse2")))
+static inline uint32_t sse_space(__m128i v) {
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i ctl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(sp, ctl));
+}
+__attribute__((target("sse2")))
+static inline uint32_t sse_ident(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under));
+}
+#define SSE_NOT_SPACE(v) (~sse_space(v) & 0xFFFFu)
+#define SSE_NOT_IDENT(v) (~sse_ident(v) & 0xFFFFu)
+#define SSE_NEWLINE(v) (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), \
+                                                             _mm_cmpeq_epi8(v, _mm_setzero_si128())))
+#define SSE_STAR(v) (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')), \
+                                                          _mm_cmpeq_epi8(v, _mm_setzero_si128())))
+
+__attribute__((target("sse2")))
+static size_t skip_space_sse2(const char *src, size_t pos) {
+    // Most runs are a single space between tokens
+    if (!is_space_byte((unsigned char)src[pos])) return pos;
+    SCAN_BLOCKS(16, SSE_LOAD, SSE_NOT_SPACE, src, pos);
+}
+__attribute__((target("sse2")))
+static size_t skip_ident_sse2(const char *src, size_t pos) {
+    SCAN_BLOCKS(16, SSE_LOAD, SSE_NOT_IDENT, src, pos);
+}
+__attribute__((target("sse2")))
+static size_t find_newline_sse2(const char *src, size_t pos) {
+    SCAN_BLOCKS(16, SSE_LOAD, SSE_NEWLINE, src, pos);
+}
+__attribute__((target("sse2")))
+static size_t find_star_sse2(const char *src, size_t pos) {
+    SCAN_BLOCKS(16, SSE_LOAD, SSE_STAR, src, pos);
+}
+__attribute__((target("sse2")))
+static size_t find_comment_end_sse2(const char *src, size_t pos) {
+    while (1) {
+        pos = find_star_sse2(src, pos);
+        if (!src[pos] || src[pos+1] == '/') return pos;
+        pos++;
+    }
+}
+
+// --- AVX2 ---
+#define AVX_LOAD(p) _mm256_load_si256((const __m256i*)(p))
+
+__attribute__((target("avx2")))
+static inline uint32_t avx_space(__m256i v) {
+    __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    __m256i ctl = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                                   _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(sp, ctl));
+}
+__attribute__((target("avx2")))
+static inline uint32_t avx_ident(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), under));
+}
+#define AVX_NOT_SPACE(v) (~avx_space(v))
+#define AVX_NOT_IDENT(v) (~avx_ident(v))
+#define AVX_NEWLINE(v) (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), \
+                                                                   _mm256_cmpeq_epi8(v, _mm256_setzero_si256())))
+#define AVX_STAR(v) (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')), \
+                                                                _mm256_cmpeq_epi8(v, _mm256_setzero_si256())))
+
+__attribute__((target("avx2")))
+static size_t skip_space_avx2(const char *src, size_t pos) {
+    if (!is_space_byte((unsigned char)src[pos])) return pos;
+    SCAN_BLOCKS(32, AVX_LOAD, AVX_NOT_SPACE, src, pos);
+}
+__attribute__((target("avx2")))
+static size_t skip_ident_avx2(const char *src, size_t pos) {
+    SCAN_BLOCKS(32, AVX_LOAD, AVX_NOT_IDENT, src, pos);
+}
+__attribute__((target("avx2")))
+static size_t find_newline_avx2(const char *src, size_t pos) {
+    SCAN_BLOCKS(32, AVX_LOAD, AVX_NEWLINE, src, pos);
+}
+__attribute__((target("avx2")))
+static size_t find_star_avx2(const char *src, size_t pos) {
+    SCAN_BLOCKS(32, AVX_LOAD, AVX_STAR, src, pos);
+}
+__attribute__((target("avx2")))
+static size_t find_comment_end_avx2(const char *src, size_t pos) {
+    while (1) {
+        pos = find_star_avx2(src, pos);
+        if (!src[pos] || src[pos+1] == '/') return pos;
+        pos++;
+    }
+}
+
+static const ScanOps scan_scalar = {
+    "scalar", skip_space_scalar, skip_ident_scalar, find_newline_scalar, find_comment_end_scalar
+};
+static const ScanOps scan_sse2 = {
+    "sse2", skip_space_sse2, skip_ident_sse2, find_newline_sse2, find_comment_end_sse2
+};
+static const ScanOps scan_avx2 = {
+    "avx2", skip_space_avx2, skip_ident_avx2, find_newline_avx2, find_comment_end_avx2
+};
+
+ScanOps scan = {
+    "scalar", skip_space_scalar, skip_ident_scalar, find_newline_scalar, find_comment_end_scalar
+};
+
+// B_SCAN=scalar|sse2|avx2 caps the selection (for testing the fallbacks)
+void scan_init(void) {
+    static int done = 0;
+    if (done) return;
+    done = 1;
+    const char *cap = getenv("B_SCAN");
+    int allow_avx2 = !cap || strcmp(cap, "avx2") == 0;
+    int allow_sse2 = allow_avx2 || strcmp(cap, "sse2") == 0;
+    __builtin_cpu_init();
+    if (allow_avx2 && __builtin_cpu_supports("avx2")) scan = scan_avx2;
+    else if (allow_sse2 && __builtin_cpu_supports("sse2")) scan = scan_sse2;
+    else scan = scan_scalar;
+}
@@ -0,0 +1,22 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// --- Byte scanning primitives for the lexer ---
+// Each returns the offset of the first byte at or after pos that stops the
+// scan. The source must be NUL-terminated; NUL always stops a scan.
+typedef struct {
+    const char *name;
+    size_t (*skip_space)(const char *src, size_t pos);    // first non-whitespace byte
+    size_t (*skip_ident)(const char *src, size_t pos);    // first byte not in [A-Za-z0-9_]
+    size_t (*find_newline)(const char *src, size_t pos);  // first '\n'
+    size_t (*find_comment_end)(const char *src, size_t pos); // first "*/"
+} ScanOps;
+
+// Selected once at startup from CPUID (AVX2, SSE2, or scalar)
+extern ScanOps scan;
+
+void scan_init(void);
+
+#endif // SCAN_H
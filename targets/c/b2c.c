@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "../../b.h"
+
+// --- C backend ---
+// Lowers the AST to C99 for -emit=c, so a C compiler can optimize B code.
+// It walks the tree like generate_x86 and shares its program-wide tables
+// (globals, function names, string literals) and its frame collection.
+//
+// Every B value is a `word` (intptr_t). Memory is addressed in words:
+// a[i] reads the i-th word after a, *p the word at p, and &x is the byte
+// address of x. Strings keep their native packing, one byte per character
+// with a closing zero. Functions are defined without prototypes, so a call
+// may pass any number of words as the cdecl code does. >> shifts in
+// zeros like the shr the x86 backend emits, and both shifts take the count
+// mod the word size as shl and shr do. Arithmetic wraps only when the C
+// compiler is told to (-fwrapv).
+
+static int c_indent = 0;
+
+// B names that are not valid C identifiers, or that the prelude takes, get
+// a trailing underscore; B's main becomes b_main under a C main
+static SymTable c_reserved;
+static SymId c_main_id;
+
+static void init_c_reserved(void) {
+    static const char *const words[] = {
+        "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else",
+        "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long", "register",
+        "restrict", "return", "short", "signed", "sizeof", "static", "struct", "switch",
+        "typedef", "union", "unsigned", "void", "volatile", "while", "_Bool", "_Complex",
+        "_Imaginary", "word", "uword", "b_main", "intptr_t", "uintptr_t", "B_SHR", "B_SHL",
+    };
+    if (c_reserved.slots) return;
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+        symtab_insert(&c_reserved, intern_name(words[i], strlen(words[i])), 1);
+    c_main_id = intern_name("main", 4);
+}
+
+static void emit_c_name(AsmOut *out, SymId id) {
+    if (id == c_main_id) {
+        EMIT(out, "b_main");
+        return;
+    }
+    emit_name(out, id);
+    if (symtab_lookup(&c_reserved, id) != (int)SYMTAB_MISSING) EMIT(out, "_");
+}
+
+// A literal is a word too: an int passed to a function without a prototype
+// would not be, and int arithmetic would overflow where word arithmetic
+// does not
+static void emit_c_int(AsmOut *out, int64_t v) {
+    EMIT(out, "((word)");
+    if (v == INT64_MIN) EMIT(out, "(-9223372036854775807LL - 1)");
+    else if (v == INT32_MIN) EMIT(out, "(-2147483647 - 1)");
+    else emit_int(out, v);
+    if (v != INT64_MIN && (v < INT32_MIN || v > INT32_MAX)) EMIT(out, "LL");
+    EMIT(out, ")");
+}
+
+static void emit_c_indent(AsmOut *out) {
+    for (int i = 0; i < c_indent; ++i) EMIT(out, "    ");
+}
+
+// --- Names from outside the program ---
+// Anything a function mentions that is neither its own nor a B global or
+// function is declared once at the top: as a function when it is called,
+// as a word variable otherwise.
+#define C_REF_CALLED 1
+#define C_REF_VALUE  2
+
+static SymTable c_externs;    // name -> index into c_extern_names
+static SymId *c_extern_names = NULL;
+static unsigned char *c_extern_refs = NULL;   // C_REF_* flags per name
+static int num_c_externs = 0;
+static int cap_c_externs = 0;
+
+static int is_program_name(SymId name) {
+    return frame_var(name) || is_global(name) || is_function(name);
+}
+
+static void note_extern(SymId name, int how) {
+    if (is_program_name(name)) return;
+    int index = symtab_lookup(&c_externs, name);
+    if (index == (int)SYMTAB_MISSING) {
+        if (num_c_externs == cap_c_externs) {
+            cap_c_externs = cap_c_externs ? cap_c_externs * 2 : 32;
+            c_extern_names = (SymId*)realloc(c_extern_names, cap_c_externs * sizeof(SymId));
+            c_extern_refs = (unsigned char*)realloc(c_extern_refs, cap_c_externs);
+        }
+        index = num_c_externs++;
+        c_extern_names[index] = name;
+        c_extern_refs[index] = 0;
+        symtab_insert(&c_externs, name, index);
+    }
+    c_extern_refs[index] |= (unsigned char)how;
+}
+
+static void collect_c_refs(ASTNode *n) {
+    if (!n) return;
+    switch (n->type) {
+        case AST_VAR: note_extern(n->data.var.name, C_REF_VALUE); break;
+        case AST_CALL:
+            if (n->data.call.name) note_extern(n->data.call.name, C_REF_CALLED);
+            collect_c_refs(n->data.call.left);
+            for (int i = 0; i < n->data.call.args.count; ++i) collect_c_refs(n->data.call.args.items[i]);
+            break;
+        case AST_BLOCK:
+            for (int i = 0; i < n->data.block.statements.count; ++i) collect_c_refs(n->data.block.statements.items[i]);
+            break;
+        case AST_STATEMENT: collect_c_refs(n->data.statement.stmt); break;
+        case AST_IF:
+            collect_c_refs(n->data.if_stmt.cond);
+            collect_c_refs(n->data.if_stmt.then_branch);
+            collect_c_refs(n->data.if_stmt.else_branch);
+            break;
+        case AST_WHILE:
+            collect_c_refs(n->data.while_stmt.cond);
+            collect_c_refs(n->data.while_stmt.body);
+            break;
+        case AST_RETURN: collect_c_refs(n->data.ret.expr); break;
+        case AST_ASSIGN:
+            collect_c_refs(n->data.assign.var);
+            collect_c_refs(n->data.assign.expr);
+            break;
+        case AST_BINOP:
+            collect_c_refs(n->data.binop.left);
+            collect_c_refs(n->data.binop.right);
+            break;
+        case AST_UNOP: collect_c_refs(n->data.unop.expr); break;
+        case AST_INDEX:
+            collect_c_refs(n->data.index.array);
+            collect_c_refs(n->data.index.index);
+            break;
+        default: break;
+    }
+}
+
+// Params and locals of fn, the same frame gen_function builds
+static void enter_c_function(ASTNode *fn) {
+    symtab_clear(&frame_vars);
+    num_frame_vars = 0;
+    num_locals = 0;
+    add_params(&fn->data.function.params);
+    if (fn->data.function.body)
+        collect_locals(fn->data.function.body);
+}
+
+// --- Expressions ---
+// Every compound expression is parenthesized, so B precedence never has to
+// be mapped onto C's.
+static void gen_c_expr(ASTNode *e, AsmOut *out);
+
+static void gen_c_lvalue(ASTNode *e, AsmOut *out) {
+    if (e->type == AST_VAR) {
+        emit_c_name(out, e->data.var.name);
+    } else if (e->type == AST_INDEX) {
+        EMIT(out, "((word *)");
+        gen_c_expr(e->data.index.array, out);
+        EMIT(out, ")[");
+        gen_c_expr(e->data.index.index, out);
+        EMIT(out, "]");
+    } else if (e->type == AST_UNOP && e->data.unop.op == OP_MUL) {
+        EMIT(out, "*(word *)");
+        gen_c_expr(e->data.unop.expr, out);
+    } else {
+        // Not addressable: let the C compiler reject it where B code did
+        EMIT(out, "*(word *)");
+        gen_c_expr(e, out);
+    }
+}
+
+static void gen_c_call(ASTNode *e, AsmOut *out) {
+    SymId name = e->data.call.name;
+    if (name && !frame_var(name) && !is_global(name)) {
+        emit_c_name(out, name);
+    } else {
+        // Call through a word that holds the function's address
+        EMIT(out, "((word (*)())");
+        if (name) emit_c_name(out, name);
+        else gen_c_expr(e->data.call.left, out);
+        EMIT(out, ")");
+    }
+    EMIT(out, "(");
+    for (int i = 0; i < e->data.call.args.count; ++i) {
+        if (i) EMIT(out, ", ");
+        gen_c_expr(e->data.call.args.items[i], out);
+    }
+    EMIT(out, ")");
+}
+
+static void gen_c_expr(ASTNode *e, AsmOut *out) {
+    if (!e) { EMIT(out, "0"); return; }
+    switch (e->type) {
+        case AST_NUM:
+            emit_c_int(out, e->data.num.value);
+            break;
+        case AST_CHAR:
+            emit_c_int(out, (unsigned char)e->data.char_lit.value);
+            break;
+        case AST_STRING:
+            EMIT(out, "(word)");
+            emit_name(out, get_string_label(e->data.string_lit.value));
+            break;
+        case AST_VAR:
+            if (is_function(e->data.var.name)) EMIT(out, "(word)");
+            emit_c_name(out, e->data.var.name);
+            break;
+        case AST_INDEX:
+            gen_c_lvalue(e, out);
+            break;
+        case AST_ASSIGN:
+            EMIT(out, "(");
+            gen_c_lvalue(e->data.assign.var, out);
+            EMIT(out, " = ");
+            gen_c_expr(e->data.assign.expr, out);
+            EMIT(out, ")");
+            break;
+        case AST_CALL:
+            gen_c_call(e, out);
+            break;
+        case AST_UNOP: {
+            int op = e->data.unop.op;
+            EMIT(out, "(");
+            if (op == OP_INC || op == OP_DEC) {
+                const char *text = op == OP_INC ? "++" : "--";
+                if (!e->data.unop.is_postfix) emit_str(out, text);
+                gen_c_lvalue(e->data.unop.expr, out);
+                if (e->data.unop.is_postfix) emit_str(out, text);
+            } else if (op == OP_BITAND) {
+                EMIT(out, "(word)&");
+                gen_c_lvalue(e->data.unop.expr, out);
+            } else if (op == OP_MUL) {
+                gen_c_lvalue(e, out);
+            } else {
+                if (op == OP_NOT) EMIT(out, "(word)");
+                emit_str(out, op_text[op]);
+                gen_c_expr(e->data.unop.expr, out);
+            }
+            EMIT(out, ")");
+            break;
+        }
+        case AST_BINOP: {
+            int op = e->data.binop.op;
+            int shift = op == OP_SHR || op == OP_SHL;
+            // Comparisons and && || yield a C int; keep them words as well
+            if (op >= OP_OR && op <= OP_LT && !shift) EMIT(out, "(word)");
+            emit_str(out, op == OP_SHR ? "B_SHR(" : op == OP_SHL ? "B_SHL(" : "(");
+            gen_c_expr(e->data.binop.left, out);
+            if (shift) {
+                EMIT(out, ", ");
+            } else {
+                EMIT(out, " ");
+                emit_str(out, op_text[op]);
+                EMIT(out, " ");
+            }
+            gen_c_expr(e->data.binop.right, out);
+            EMIT(out, ")");
+            break;
+        }
+        default:
+            EMIT(out, "0");
+            break;
+    }
+}
+
+// --- Statements ---
+static void gen_c_stmt(ASTNode *s, AsmOut *out);
+
+// Body of an if or while, always braced
+static void gen_c_body(ASTNode *s, AsmOut *out) {
+    EMIT(out, "{\n");
+    c_indent++;
+    if (s && s->type == AST_BLOCK) {
+        for (int i = 0; i < s->data.block.statements.count; ++i)
+            gen_c_stmt(s->data.block.statements.items[i], out);
+    } else {
+        gen_c_stmt(s, out);
+    }
+    c_indent--;
+    emit_c_indent(out);
+    EMIT(out, "}");
+}
+
+static void gen_c_stmt(ASTNode *s, AsmOut *out) {
+    if (!s) return;
+    switch (s->type) {
+        case AST_BLOCK:
+            emit_c_indent(out);
+            gen_c_body(s, out);
+            EMIT(out, "\n");
+            break;
+        case AST_STATEMENT:
+        case AST_ASSIGN:
+            emit_c_indent(out);
+            gen_c_expr(s->type == AST_STATEMENT ? s->data.statement.stmt : s, out);
+            EMIT(out, ";\n");
+            break;
+        case AST_IF:
+            emit_c_indent(out);
+            EMIT(out, "if (");
+            gen_c_expr(s->data.if_stmt.cond, out);
+            EMIT(out, ") ");
+            gen_c_body(s->data.if_stmt.then_branch, out);
+            if (s->data.if_stmt.else_branch) {
+                EMIT(out, " else ");
+                gen_c_body(s->data.if_stmt.else_branch, out);
+            }
+            EMIT(out, "\n");
+            break;
+        case AST_WHILE:
+            emit_c_indent(out);
+            EMIT(out, "while (");
+            gen_c_expr(s->data.while_stmt.cond, out);
+            EMIT(out, ") ");
+            gen_c_body(s->data.while_stmt.body, out);
+            EMIT(out, "\n");
+            break;
+        case AST_RETURN:
+            emit_c_indent(out);
+            EMIT(out, "return ");
+            gen_c_expr(s->data.ret.expr, out);
+            EMIT(out, ";\n");
+            break;
+        case AST_BREAK:
+            emit_c_indent(out);
+            EMIT(out, "break;\n");
+            break;
+        case AST_CONTINUE:
+            emit_c_indent(out);
+            EMIT(out, "continue;\n");
+            break;
+        case AST_LABEL:
+            emit_c_name(out, s->data.label.label);
+            EMIT(out, ": ;\n");
+            break;
+        case AST_GOTO:
+            emit_c_indent(out);
+            EMIT(out, "goto ");
+            emit_c_name(out, s->data.go.label);
+            EMIT(out, ";\n");
+            break;
+        default:
+            // auto and extern were handled with the frame; empty statements vanish
+            break;
+    }
+}
+
+static void gen_c_function(ASTNode *fn, AsmOut *out) {
+    enter_c_function(fn);
+    ASTNodeList *params = &fn->data.function.params;
+    // Old-style definition: no prototype, so callers may pass any count
+    EMIT(out, "\nword ");
+    emit_c_name(out, fn->data.function.name);
+    EMIT(out, "(");
+    for (int i = 0; i < params->count; ++i) {
+        if (i) EMIT(out, ", ");
+        emit_c_name(out, params->items[i]->data.var.name);
+    }
+    EMIT(out, ")\n");
+    for (int i = 0; i < num_frame_vars; ++i) {
+        if (frame[i].offset <= 0) continue;
+        EMIT(out, "    word ");
+        emit_c_name(out, frame[i].name);
+        EMIT(out, ";\n");
+    }
+    EMIT(out, "{\n");
+    c_indent = 1;
+    for (int i = 0; i < num_frame_vars; ++i) {
+        if (frame[i].offset >= 0) continue;
+        EMIT(out, "    word ");
+        emit_c_name(out, frame[i].name);
+        EMIT(out, " = 0;\n");
+    }
+    gen_c_stmt(fn->data.function.body, out);
+    EMIT(out, "    return 0;\n}\n");
+    c_indent = 0;
+}
+
+// Runs meta blocks at compile time, as the x86 walk does
+static void gen_c_meta(ASTNode *meta, AsmOut *out) {
+    GlobalScope outer;
+    memset(&outer, 0, sizeof(outer));
+    swap_global_scope(&outer);
+    emit_flush(out);
+    evaluate_meta_construct(meta->data.meta.content);
+    fflush(stdout);
+    swap_global_scope(&outer);
+    free_global_scope(&outer);
+}
+
+static void gen_c_string_literals(AsmOut *out) {
+    for (int i = 0; i < num_strings; ++i) {
+        EMIT(out, "static char ");
+        emit_name(out, string_label(i));
+        EMIT(out, "[] = \"");
+        for (const unsigned char *p = (const unsigned char*)symbol_name(string_literals[i]); *p; ++p) {
+            if (*p == '\\' || *p == '"') { EMIT(out, "\\"); emit_raw(out, (const char*)p, 1); }
+            else if (*p == '\n') EMIT(out, "\\n");
+            else if (*p == '\t') EMIT(out, "\\t");
+            else if (*p < 32 || *p > 126 || *p == '?') {
+                // Octal, always three digits so a following digit is not absorbed
+                char esc[4] = { '\\', (char)('0' + (*p >> 6)), (char)('0' + ((*p >> 3) & 7)), (char)('0' + (*p & 7)) };
+                emit_raw(out, esc, 4);
+            }
+            else emit_raw(out, (const char*)p, 1);
+        }
+        EMIT(out, "\";\n");
+    }
+}
+
+static void gen_c_program(ASTNode *ast, AsmOut *out) {
+    ASTNodeList *items = &ast->data.program.functions;
+    init_c_reserved();
+    collect_program(ast);
+    symtab_clear(&c_externs);
+    num_c_externs = 0;
+    for (int i = 0; i < items->count; ++i) {
+        if (items->items[i]->type != AST_FUNCTION) continue;
+        enter_c_function(items->items[i]);
+        collect_c_refs(items->items[i]->data.function.body);
+    }
+    symtab_clear(&frame_vars);
+    num_frame_vars = 0;
+
+    EMIT(out, "// Generated by the B compiler (-emit=c)\n");
+    EMIT(out, "#include <stdint.h>\n\n");
+    EMIT(out, "typedef intptr_t word;\n");
+    EMIT(out, "typedef uintptr_t uword;\n");
+    EMIT(out, "#define B_SHR(a, b) ((word)((uword)(a) >> ((b) & (8 * sizeof(word) - 1))))\n");
+    EMIT(out, "#define B_SHL(a, b) ((word)((uword)(a) << ((b) & (8 * sizeof(word) - 1))))\n\n");
+    // Library functions are called like any B function, through word
+    EMIT(out, "#if defined(__clang__)\n#pragma clang diagnostic ignored \"-Wincompatible-library-redeclaration\"\n");
+    EMIT(out, "#elif defined(__GNUC__)\n#pragma GCC diagnostic ignored \"-Wbuiltin-declaration-mismatch\"\n#endif\n\n");
+    for (int i = 0; i < num_c_externs; ++i) {
+        int called = c_extern_refs[i] & C_REF_CALLED;
+        emit_str(out, called ? "word " : "extern word ");
+        emit_c_name(out, c_extern_names[i]);
+        emit_str(out, called ? "();\n" : ";\n");
+    }
+    int has_main = 0;
+    for (int i = 0; i < items->count; ++i) {
+        if (items->items[i]->type != AST_FUNCTION) continue;
+        EMIT(out, "word ");
+        emit_c_name(out, items->items[i]->data.function.name);
+        EMIT(out, "();\n");
+        has_main |= items->items[i]->data.function.name == c_main_id;
+    }
+    for (int i = 0; i < num_globals; ++i) {
+        EMIT(out, "word ");
+        emit_c_name(out, globals[i].name);
+        EMIT(out, " = ");
+        emit_c_int(out, globals[i].init);
+        EMIT(out, ";\n");
+    }
+    gen_c_string_literals(out);
+
+    for (int i = 0; i < items->count; ++i) {
+        ASTNode *item = items->items[i];
+        if (item->type == AST_FUNCTION) gen_c_function(item, out);
+        else if (item->type == AST_META) gen_c_meta(item, out);
+    }
+    if (has_main)
+        EMIT(out, "\nint main(int argc, char **argv)\n{\n    return (int)b_main((word)argc, (word)argv);\n}\n");
+}
+
+void generate_c(ASTNode *ast, FILE *file) {
+    AsmOut out;
+    memset(&out, 0, sizeof(out));
+    out.buf = (char*)malloc(ASM_BUF_SIZE);
+    if (!out.buf) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    out.fd = fileno(file);
+    fflush(file);
+    if (ast && ast->type == AST_PROGRAM)
+        gen_c_program(ast, &out);
+    emit_flush(&out);
+    free(out.buf);
+}
@@ -7,251 +7,218 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include "../../b.h"
+#include "x86.h"
 #include <stdint.h>
-#include <regex.h>
 
 #define MAX_LINE 1024
-#define MAX_SYMBOLS 256
-#define MAX_INSTRUCTIONS 4096
-#define MAX_DATA 4096
+#define MAX_LINE_TOKENS 64
 
+// Text assembler for the Intel syntax b2as.c prints. Each line is split into
+// tokens once, parsed into an Insn and encoded through the same table as the
+// direct path. Labels become code symbols and every name an instruction
+// mentions is left as a relocation, resolved when the code is loaded.
 typedef struct {
-    char name[64];
-    void *address;
-} Symbol;
-
-typedef struct {
-    char *name;
-    int offset;
-    int size;
-} Relocation;
-
-typedef struct {
-    unsigned char *code;
-    size_t code_size;
-    size_t code_capacity;
-    unsigned char *data;
-    size_t data_size;
-    size_t data_capacity;
-    Symbol symbols[MAX_SYMBOLS];
-    int num_symbols;
-    Relocation relocations[MAX_INSTRUCTIONS];
-    int num_relocations;
-    int text_offset;
-    int data_offset;
+    MCode code;
+    int line;      // line being assembled, for diagnostics
 } Assembler;
 
 // Function prototypes
 void assembler_init(Assembler *assembler);
 void assembler_cleanup(Assembler *assembler);
+int parse_instruction(const char *line, Insn *inst);
 int parse_assembly_file(const char *filename, Assembler *assembler);
-int resolve_symbols(Assembler *assembler, const char *symbol_file);
-int assemble_instructions(Assembler *assembler);
-void *execute_code(Assembler *assembler);
-void add_symbol(Assembler *assembler, const char *name, void *address);
-void *find_symbol(Assembler *assembler, const char *name);
-
-// Forward declarations for B language parsing
-typedef struct {
-    const char *src;
-    size_t pos;
-    int line;
-    int col;
-    int cur;
-} Parser;
+void *resolve_external_symbol(const char *name);
 
-void parser_init(Parser *p, const char *src);
+// Forward declarations for B language parsing (Parser lives in b.h)
 ASTNode *parse_statement(Parser *p);
-ASTNode *parse_program(Parser *p);
 void print_ast(ASTNode *node, int indent);
-void free_ast(ASTNode *node);
 void generate_x86(ASTNode *ast, FILE *out);
+extern int asm_compact;
+
+// --- Line tokenizer ---
+typedef enum { AT_END, AT_NAME, AT_NUM, AT_STRING, AT_PUNCT } AsmTokenType;
 
-// Simple x86 instruction encoding
 typedef struct {
-    unsigned char opcode;
-    unsigned char modrm;
-    unsigned char sib;
-    unsigned char imm8;
-    unsigned int imm32;
-    int size;
-} Instruction;
+    unsigned char type;    // AsmTokenType
+    char punct;            // AT_PUNCT: the character
+    const char *s;         // AT_NAME, AT_STRING: text (strings without quotes)
+    int len;
+    long value;            // AT_NUM
+} AsmToken;
 
-// Parse a single instruction line
-int parse_instruction(const char *line, Instruction *inst, Assembler *assembler) {
-    memset(inst, 0, sizeof(Instruction));
-    
-    // Skip leading whitespace
-    while (isspace(*line)) line++;
-    
-    // Parse instruction
-    if (strncmp(line, "push", 4) == 0) {
-        if (strstr(line, "ebp")) {
-            inst->opcode = 0x55; // push ebp
-            inst->size = 1;
-        } else if (strstr(line, "eax")) {
-            inst->opcode = 0x50; // push eax
-            inst->size = 1;
-        }
-        return inst->size > 0;
-    } else if (strncmp(line, "pop", 3) == 0) {
-        if (strstr(line, "ebp")) {
-            inst->opcode = 0x5D; // pop ebp
-            inst->size = 1;
-        } else if (strstr(line, "ebx")) {
-            inst->opcode = 0x5B; // pop ebx
-            inst->size = 1;
-        }
-        return inst->size > 0;
-    } else if (strncmp(line, "mov", 3) == 0) {
-        if (strstr(line, "ebp, esp")) {
-            inst->opcode = 0x89; // mov ebp, esp
-            inst->modrm = 0xE5;
-            inst->size = 2;
-        } else if (strstr(line, "esp, ebp")) {
-            inst->opcode = 0x89; // mov esp, ebp
-            inst->modrm = 0xEC;
-            inst->size = 2;
-        } else if (strstr(line, "eax,")) {
-            // mov eax, imm32
-            const char *imm_start = strstr(line, "eax,");
-            if (imm_start) {
-                imm_start += 4;
-                while (isspace(*imm_start) || *imm_start == ',') imm_start++;
-                int imm = atoi(imm_start);
-                inst->opcode = 0xB8; // mov eax, imm32
-                inst->imm32 = imm;
-                inst->size = 5;
-            }
-        } else if (strstr(line, "[ebx], eax")) {
-            // mov [ebx], eax
-            inst->opcode = 0x89;
-            inst->modrm = 0x03; // mod=00, reg=000 (EAX), rm=011 (EBX)
-            inst->size = 2;
-        }
-        return inst->size > 0;
-    } else if (strncmp(line, "sub", 3) == 0) {
-        int imm = 0;
-        if (sscanf(line, "sub esp, %d", &imm) == 1) {
-            inst->opcode = 0x83;
-            inst->modrm = 0xEC;
-            inst->imm8 = (unsigned char)imm;
-            inst->size = 3;
-        }
-        return inst->size > 0;
-    } else if (strncmp(line, "add", 3) == 0) {
-        int imm = 0;
-        if (sscanf(line, "add esp, %d", &imm) == 1) {
-            inst->opcode = 0x83;
-            inst->modrm = 0xC4;
-            inst->imm8 = (unsigned char)imm;
-            inst->size = 3;
+static int is_name_char(int c) { return isalnum(c) || c == '_' || c == '.' || c == '$'; }
+
+// Split a line into tokens, stopping at a comment. Returns the token count
+// (the array is closed with AT_END), or -1 on a malformed line.
+static int tokenize_line(const char *p, AsmToken *toks) {
+    int n = 0;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (n == MAX_LINE_TOKENS - 1) return -1;
+        AsmToken *t = &toks[n];
+        t->s = p;
+        if (*p == 0 || *p == '#') {
+            t->type = AT_END;
+            return n;
         }
-        return inst->size > 0;
-    } else if (strncmp(line, "lea", 3) == 0) {
-        // lea eax, [ebp-imm]
-        int disp = 0;
-        if (sscanf(line, "lea eax, [ebp%*[-]%d", &disp) == 1) {
-            inst->opcode = 0x8D;
-            inst->modrm = 0x45;
-            inst->imm8 = (unsigned char)(-disp & 0xFF); // signed disp8
-            inst->size = 3;
+        if (isdigit((unsigned char)*p)) {
+            char *end;
+            t->type = AT_NUM;
+            t->value = (long)strtoull(p, &end, 0);
+            p = end;
+        } else if (is_name_char((unsigned char)*p)) {
+            t->type = AT_NAME;
+            while (is_name_char((unsigned char)*p)) p++;
+        } else if (*p == '"') {
+            t->type = AT_STRING;
+            t->s = ++p;
+            while (*p && *p != '"') p += p[0] == '\\' && p[1] ? 2 : 1;
+            if (*p != '"') return -1;
+            t->len = (int)(p++ - t->s);
+            n++;
+            continue;
         } else {
-            // lea eax, [symbol]
-            char symbol[64];
-            if (sscanf(line, "lea eax, [%63[^]]]", symbol) == 1) {
-                inst->opcode = 0x8D;
-                inst->modrm = 0x05;
-                inst->size = 6; // 2 for opcode+modrm, 4 for imm32
-                fprintf(stderr, "[DEBUG] [[%s]]\n", symbol);
-                // todo: resolve symbol here
-                // Try to resolve symbol now
-                void *sym_addr = NULL;
-                // Try to find symbol in assembler symbol table
-                for (int i = 0; i < assembler->num_symbols; ++i) {
-                    if (strcmp(assembler->symbols[i].name, symbol) == 0) {
-                        sym_addr = assembler->symbols[i].address;
-                        break;
-                    }
-                }
-                
-                if (sym_addr) {
-                    inst->imm32 = (unsigned int)(uintptr_t)sym_addr;
-                    fprintf(stderr, "[DEBUG] Resolved symbol '%s' to %p at parse time\n", symbol, sym_addr);
-                } else {
-                    fprintf(stderr, "[DEBUG] Symbol '%s' not found at parse time, will relocate\n", symbol);
-                }
-            }
-        }
-        return inst->size > 0;
-    } else if (strncmp(line, "call", 4) == 0) {
-        char symbol[64];
-        if (sscanf(line, "call %63s", symbol) == 1) {
-            inst->opcode = 0xE8;
-            inst->size = 5;
-            void *sym_addr = NULL;
-                // Try to find symbol in assembler symbol table
-                for (int i = 0; i < assembler->num_symbols; ++i) {
-                    if (strcmp(assembler->symbols[i].name, symbol) == 0) {
-                        sym_addr = assembler->symbols[i].address;
-                        break;
-                    }
-                }
-                
-                if (sym_addr) {
-                    inst->imm32 = (unsigned int)(uintptr_t)sym_addr;
-                    fprintf(stderr, "[DEBUG] Resolved symbol '%s' to %p at parse time\n", symbol, sym_addr);
-                } else {
-                    fprintf(stderr, "[DEBUG] Symbol '%s' not found at parse time, will relocate\n", symbol);
-                }
-            return 1;
+            t->type = AT_PUNCT;
+            t->punct = *p++;
         }
-        inst->opcode = 0xE8; // fallback
-        inst->size = 5;
-        return 1;
-    } else if (strncmp(line, "ret", 3) == 0) {
-        inst->opcode = 0xC3; // ret
-        inst->size = 1;
-        return 1;
+        t->len = (int)(p - t->s);
+        n++;
     }
-    
-    return 0;
 }
 
-void assembler_init(Assembler *assembler) {
-    memset(assembler, 0, sizeof(Assembler));
-    assembler->code_capacity = 4096;
-    assembler->data_capacity = 4096;
-    assembler->code = (unsigned char*) malloc(assembler->code_capacity);
-    assembler->data = (unsigned char*) malloc(assembler->data_capacity);
-    assembler->text_offset = 0;
-    assembler->data_offset = 0;
+static int token_is(const AsmToken *t, const char *name) {
+    return t->type == AT_NAME && (size_t)t->len == strlen(name) && memcmp(t->s, name, t->len) == 0;
 }
 
-void assembler_cleanup(Assembler *assembler) {
-    if (assembler->code) free(assembler->code);
-    if (assembler->data) free(assembler->data);
+static int token_punct(const AsmToken *t, char c) { return t->type == AT_PUNCT && t->punct == c; }
+
+// Full-width register number in the current mode, or -1
+static int token_reg(const AsmToken *t) {
+    if (t->type != AT_NAME) return -1;
+    for (int r = 0; r < (x86_mode64 ? 16 : 8); ++r)
+        if (token_is(t, x86_reg_name(r))) return r;
+    return -1;
 }
 
-void add_symbol(Assembler *assembler, const char *name, void *address) {
-    if (assembler->num_symbols < MAX_SYMBOLS) {
-        strncpy(assembler->symbols[assembler->num_symbols].name, name, 63);
-        assembler->symbols[assembler->num_symbols].name[63] = '\0';
-        assembler->symbols[assembler->num_symbols].address = address;
-        fprintf(stderr, "[DEBUG] add_symbol: '%s' at %p (index %d)\n", name, address, assembler->num_symbols);
-        assembler->num_symbols++;
-    } else {
-        fprintf(stderr, "[DEBUG] add_symbol: symbol table full, could not add '%s'\n", name);
-    }
+static int token_reg8(const AsmToken *t) {
+    if (t->type != AT_NAME || t->len != 2) return -1;
+    for (int r = 0; r < 4; ++r)
+        if (memcmp(t->s, x86_reg8_names[r], 2) == 0) return r;
+    return -1;
 }
 
-void *find_symbol(Assembler *assembler, const char *name) {
-    for (int i = 0; i < assembler->num_symbols; i++) {
-        if (strcmp(assembler->symbols[i].name, name) == 0) {
-            return assembler->symbols[i].address;
+static int token_mnemonic(const AsmToken *t) {
+    if (t->type != AT_NAME) return -1;
+    if (x86_mode64 && token_is(t, "cqo")) return I_CDQ;
+    for (int m = I_COMMENT + 1; m < I_COUNT; ++m)
+        if (token_is(t, x86_mnemonic[m])) return m;
+    return -1;
+}
+
+// [sym + base + index*scale +- disp]; *i points just past the '['
+static int parse_memory(const AsmToken *toks, int *i, Operand *o) {
+    *o = x86_mem(REG_NONE, 0);
+    int sign = 1;
+    for (;;) {
+        const AsmToken *t = &toks[*i];
+        int r = token_reg(t);
+        if (x86_mode64 && token_is(t, "rip") && token_punct(&toks[*i + 1], '+')) {
+            // [rip+sym]: symbol operands are always RIP-relative here
+            *i += 2;
+            continue;
+        }
+        if (r >= 0) {
+            (*i)++;
+            if (token_punct(&toks[*i], '*') && toks[*i + 1].type == AT_NUM) {
+                o->index = (unsigned char)r;
+                o->scale = (unsigned char)toks[*i + 1].value;
+                *i += 2;
+            } else if (o->base == REG_NONE) {
+                o->base = (unsigned char)r;
+            } else if (o->index == REG_NONE) {
+                o->index = (unsigned char)r;
+            } else {
+                return -1;
+            }
+            if (sign < 0) return -1;
+        } else if (t->type == AT_NUM) {
+            o->value += sign * (int)t->value;
+            (*i)++;
+        } else if (t->type == AT_NAME && !o->sym && sign > 0) {
+            o->sym = intern_name(t->s, t->len);
+            (*i)++;
+        } else {
+            return -1;
         }
+        t = &toks[*i];
+        if (token_punct(t, ']')) { (*i)++; return 0; }
+        if (token_punct(t, '+')) sign = 1;
+        else if (token_punct(t, '-')) sign = -1;
+        else return -1;
+        (*i)++;
+    }
+}
+
+static int parse_operand(const AsmToken *toks, int *i, Operand *o) {
+    const AsmToken *t = &toks[*i];
+    int r;
+    if (token_is(t, x86_mode64 ? "qword" : "dword") && token_is(&toks[*i + 1], "ptr")) {
+        *i += 2;
+        t = &toks[*i];
+        if (!token_punct(t, '[')) return -1;
+    }
+    if (token_punct(t, '[')) {
+        (*i)++;
+        return parse_memory(toks, i, o);
+    }
+    if ((r = token_reg(t)) >= 0) { *o = x86_reg((Reg)r); (*i)++; return 0; }
+    if ((r = token_reg8(t)) >= 0) { *o = x86_reg8((Reg)r); (*i)++; return 0; }
+    if (t->type == AT_NUM) { *o = x86_imm((int)t->value); (*i)++; return 0; }
+    if (token_punct(t, '-') && toks[*i + 1].type == AT_NUM) {
+        *o = x86_imm(-(int)toks[*i + 1].value);
+        *i += 2;
+        return 0;
+    }
+    if (t->type == AT_NAME) {
+        // Branch and call targets, including .L labels
+        *o = x86_target(intern_name(t->s, t->len));
+        (*i)++;
+        return 0;
+    }
+    return -1;
+}
+
+// Parse "mnemonic [dst [, src]]" from already tokenized text
+static int parse_instruction_tokens(const AsmToken *toks, Insn *inst) {
+    memset(inst, 0, sizeof(*inst));
+    inst->dst = x86_none();
+    inst->src = x86_none();
+    int m = token_mnemonic(&toks[0]);
+    if (m < 0) return -1;
+    inst->op = (unsigned char)m;
+    int i = 1;
+    if (toks[i].type == AT_END) return 0;
+    if (parse_operand(toks, &i, &inst->dst) != 0) return -1;
+    if (token_punct(&toks[i], ',')) {
+        i++;
+        if (parse_operand(toks, &i, &inst->src) != 0) return -1;
     }
-    return NULL;
+    return toks[i].type == AT_END ? 0 : -1;
+}
+
+// Parse a single instruction line
+int parse_instruction(const char *line, Insn *inst) {
+    AsmToken toks[MAX_LINE_TOKENS];
+    if (tokenize_line(line, toks) < 0) return -1;
+    return parse_instruction_tokens(toks, inst);
+}
+
+void assembler_init(Assembler *assembler) {
+    memset(assembler, 0, sizeof(Assembler));
+}
+
+void assembler_cleanup(Assembler *assembler) {
+    mcode_free(&assembler->code);
 }
 
 // Resolve external symbols using dlsym
@@ -266,12 +233,58 @@ void *resolve_external_symbol(const char *name) {
     return symbol;
 }
 
-void print_ebx_addr(unsigned int ebx_val) {
-    fprintf(stderr, "[DEBUG] About to write to [ebx]=0x%08X\n", ebx_val);
+// Append an .asciz body, undoing the escapes b2as.c writes
+static void assemble_asciz(MCode *mc, const AsmToken *t) {
+    const char *p = t->s, *end = t->s + t->len;
+    while (p < end) {
+        char c = *p++;
+        if (c == '\\' && p < end) {
+            c = *p++;
+            if (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+            else if (c >= '0' && c <= '7') {
+                int v = c - '0';
+                for (int k = 0; k < 2 && p < end && *p >= '0' && *p <= '7'; ++k) v = v * 8 + (*p++ - '0');
+                c = (char)v;
+            }
+        }
+        mcode_data(mc, &c, 1);
+    }
+    mcode_data(mc, "", 1);
+}
+
+// One line of .data: "name: .asciz "..."" or "name: .long N" (.quad N)
+static int assemble_data_line(Assembler *assembler, const AsmToken *toks) {
+    MCode *mc = &assembler->code;
+    if (toks[0].type != AT_NAME || !token_punct(&toks[1], ':')) return -1;
+    mcode_symbol(mc, intern_name(toks[0].s, toks[0].len), mc->data_size, 1);
+    const AsmToken *dir = &toks[2];
+    if (token_is(dir, ".asciz") && toks[3].type == AT_STRING && toks[4].type == AT_END) {
+        assemble_asciz(mc, &toks[3]);
+        return 0;
+    }
+    if (token_is(dir, x86_mode64 ? ".quad" : ".long")) {
+        // Read the number here: an immediate operand holds only 32 bits
+        int neg = token_punct(&toks[3], '-');
+        if (toks[3 + neg].type != AT_NUM || toks[4 + neg].type != AT_END) return -1;
+        uint64_t word = (uint64_t)toks[3 + neg].value;
+        if (neg) word = 0 - word;
+        mcode_data(mc, &word, x86_mode64 ? 8 : 4);
+        return 0;
+    }
+    return -1;
 }
 
-void print_esp_addr(unsigned int esp_val) {
-    fprintf(stderr, "[DEBUG] At call, esp=0x%08X\n", esp_val);
+static int assemble_text_line(Assembler *assembler, const AsmToken *toks) {
+    MCode *mc = &assembler->code;
+    if (toks[0].type == AT_NAME && token_punct(&toks[1], ':') && toks[2].type == AT_END) {
+        mcode_symbol(mc, intern_name(toks[0].s, toks[0].len), mc->code_size, 0);
+        return 0;
+    }
+    Insn inst;
+    int label_at;
+    if (parse_instruction_tokens(toks, &inst) != 0) return -1;
+    return mcode_insn(mc, &inst, &label_at);
 }
 
 int parse_assembly_file(const char *filename, Assembler *assembler) {
@@ -280,216 +293,31 @@ int parse_assembly_file(const char *filename, Assembler *assembler) {
         fprintf(stderr, "Error: Cannot open file %s\n", filename);
         return -1;
     }
-    
+
     char line[MAX_LINE];
-    int line_num = 0;
-    int in_text = 0;
+    AsmToken toks[MAX_LINE_TOKENS];
     int in_data = 0;
-    
-    while (fgets(line, sizeof(line), file)) {
-        line_num++;
-        
-        // Remove newline and carriage return
-        line[strcspn(line, "\r\n")] = 0;
-        
-        // Debug print
-        //printf("[DEBUG] Parsing line: '%s'\n", line);
-        
-        // Skip empty lines and comments
-        if (line[0] == 0 || line[0] == '#') continue;
-                // Check for section directives
-        if (strstr(line, ".text")) {
-            in_text = 1;
-            in_data = 0;
-            continue;
-        }
-        
-        if (strstr(line, ".data")) {
-            in_data = 1;
-            in_text = 0;
-            continue;
-        }
+    int rc = 0;
+    assembler->line = 0;
 
-          // Skip assembler directives
-        if (line[0] == '.' || strncmp(line, ".globl", 6) == 0) continue;
-        
-        
-        // Handle data section
-        if (in_data) {
-            char *colon = strchr(line, ':');
-            if (colon) {
-                *colon = 0;
-                char *label = line;
-                while (isspace(*label)) label++;
-                
-                char *directive = colon + 1;
-                while (isspace(*directive)) directive++;
-                
-                if (strncmp(directive, ".asciz", 6) == 0) {
-                    char *str_start = strchr(directive, '"');
-                    if (str_start) {
-                        str_start++;
-                        char *str_end = strrchr(str_start, '"');
-                        if (str_end) {
-                            *str_end = 0;
-                            int len = strlen(str_start) + 1;
-                            
-                            // Add to data section
-                            if (assembler->data_size + len <= assembler->data_capacity) {
-                                strcpy((char*)assembler->data + assembler->data_size, str_start);
-                                assembler->data_size += len;
-                                
-                                // Add symbol for this label
-                                add_symbol(assembler, label, assembler->data + assembler->data_offset);
-                                assembler->data_offset += len;
-                            }
-                        }
-                    }
-                }
-            }
+    while (fgets(line, sizeof(line), file)) {
+        assembler->line++;
+        int n = tokenize_line(line, toks);
+        if (n == 0) continue;
+        if (n > 0 && toks[0].type == AT_NAME && toks[0].s[0] == '.' && !token_punct(&toks[1], ':')) {
+            // Directives: only the section matters
+            if (token_is(&toks[0], ".text")) in_data = 0;
+            else if (token_is(&toks[0], ".data")) in_data = 1;
             continue;
         }
-        
-        // Handle text section
-        if (in_text) {
-            char *colon = strchr(line, ':');
-            if (colon) {
-                *colon = 0;
-                char *label = line;
-                while (isspace(*label)) label++;
-                // Trim trailing whitespace
-                char *end = label + strlen(label) - 1;
-                while (end > label && isspace(*end)) { *end = 0; end--; }
-                if (label[0] != 0) {
-                    add_symbol(assembler, label, (void*)(intptr_t)assembler->text_offset);
-                } else {
-                    fprintf(stderr, "[DEBUG] Label is empty after trim, skipping.\n");
-                }
-                continue;
-            }
-            
-            // Parse instruction
-            Instruction inst;
-            if (parse_instruction(line, &inst, assembler)) {
-                fprintf(stderr, "Parsed instruction: %s -> opcode=0x%02X, modrm=0x%02X, size=%d\n", 
-                       line, inst.opcode, inst.modrm, inst.size);
-                int start_offset = assembler->text_offset;
-                // Only emit if size > 0
-                if (inst.size > 0) {
-                    assembler->code[assembler->text_offset++] = inst.opcode;
-                    if (inst.size > 1 &&  inst.modrm != 0)
-                         assembler->code[assembler->text_offset++] = inst.modrm;
-                    // Handle lea eax, [symbol] (modrm==0x05, size==6)
-                    if (inst.opcode == 0x8D && inst.modrm == 0x05 && inst.size == 6) {
-                        char *symbol = (char*)&inst + sizeof(Instruction);
-                        if (inst.imm32) {
-                            // Symbol was resolved at parse time, emit address
-                            unsigned int v = inst.imm32;
-                            assembler->code[assembler->text_offset++] = v & 0xFF;
-                            assembler->code[assembler->text_offset++] = (v >> 8) & 0xFF;
-                            assembler->code[assembler->text_offset++] = (v >> 16) & 0xFF;
-                            assembler->code[assembler->text_offset++] = (v >> 24) & 0xFF;
-                            fprintf(stderr, "[DEBUG] Emitted resolved address for lea eax, [%s]: 0x%08X\n", symbol, v);
-                        } else {
-                            // Add relocation for symbol
-                            assembler->relocations[assembler->num_relocations].name = strdup(symbol);
-                            assembler->relocations[assembler->num_relocations].offset = assembler->text_offset;
-                            assembler->relocations[assembler->num_relocations].size = 4;
-                            assembler->num_relocations++;
-                            assembler->code[assembler->text_offset++] = 0;
-                            assembler->code[assembler->text_offset++] = 0;
-                            assembler->code[assembler->text_offset++] = 0;
-                            assembler->code[assembler->text_offset++] = 0;
-                            fprintf(stderr, "[DEBUG] Placeholder for lea eax, [%s] at offset %d\n", symbol, assembler->text_offset-4);
-                        }
-                    } else if (inst.opcode == 0xE8 && inst.size == 5) { // call symbol
-                        // Emit: mov eax, <absolute address>; call eax
-                        unsigned int addr = inst.imm32;
-                        assembler->text_offset -= 1;
-                        assembler->code[assembler->text_offset++] = 0xB8; // mov eax, imm32
-                        assembler->code[assembler->text_offset++] = addr & 0xFF;
-                        assembler->code[assembler->text_offset++] = (addr >> 8) & 0xFF;
-                        assembler->code[assembler->text_offset++] = (addr >> 16) & 0xFF;
-                        assembler->code[assembler->text_offset++] = (addr >> 24) & 0xFF;
-                        assembler->code[assembler->text_offset++] = 0xFF; // call eax
-                        assembler->code[assembler->text_offset++] = 0xD0;
-                        fprintf(stderr, "[DEBUG] Emitted mov eax, 0x%08X; call eax for call\n", addr);
-                    
-                    } else if (inst.opcode == 0xB8) { // mov eax, imm32
-                        unsigned int v = inst.imm32;
-                        assembler->code[assembler->text_offset++] = v & 0xFF;
-                        assembler->code[assembler->text_offset++] = (v >> 8) & 0xFF;
-                        assembler->code[assembler->text_offset++] = (v >> 16) & 0xFF;
-                        assembler->code[assembler->text_offset++] = (v >> 24) & 0xFF;
-                    } else if (inst.opcode == 0x8D && inst.modrm == 0x45) { // lea eax, [ebp-imm8]
-                        assembler->code[assembler->text_offset++] = inst.imm8;
-                    } else if (inst.size == 3) {
-                        assembler->code[assembler->text_offset++] = inst.imm8;
-                    }
-                    // Debug print: dump emitted bytes for this instruction
-                    fprintf(stderr, "[EMIT] ");
-                    for (int i = start_offset; i < assembler->text_offset; ++i) {
-                        fprintf(stderr, "%02X ", assembler->code[i]);
-                    }
-                    fprintf(stderr, "\n");
-                }
-            } else {
-                fprintf(stderr, "Parse error at %s\n", line);
-            }
+        if (n < 0 || (in_data ? assemble_data_line(assembler, toks) : assemble_text_line(assembler, toks)) != 0) {
+            line[strcspn(line, "\r\n")] = 0;
+            fprintf(stderr, "%s:%d: cannot assemble '%s'\n", filename, assembler->line, line);
+            rc = -1;
+            break;
         }
     }
-    
-    fclose(file);
-    return 0;
-}
 
-int resolve_symbols(Assembler *assembler, const char *symbol_file) {
-    if (!symbol_file) return 0;
-    
-    FILE *file = fopen(symbol_file, "r");
-    if (!file) {
-        fprintf(stderr, "Warning: Cannot open symbol file %s\n", symbol_file);
-        return 0;
-    }
-    
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), file)) {
-        char *newline = strchr(line, '\n');
-        if (newline) *newline = 0;
-        
-        char *space = strchr(line, ' ');
-        if (space) {
-            *space = 0;
-            char *name = line;
-            char *addr_str = space + 1;
-            
-            void *address = (void*)strtoul(addr_str, NULL, 16);
-            add_symbol(assembler, name, address);
-        }
-    }
-    
     fclose(file);
-    return 0;
-}
-
-
-
-int assemble_instructions(Assembler *assembler) {
-    // Resolve relocations
-    for (int i = 0; i < assembler->num_relocations; i++) {
-        Relocation *reloc = &assembler->relocations[i];
-        void *symbol_addr = find_symbol(assembler, reloc->name);
-        
-        if (symbol_addr) {
-            // Calculate relative address for function calls
-            if (reloc->size == 4) {
-                unsigned int *addr_ptr = (unsigned int*)(assembler->code + reloc->offset);
-                *addr_ptr = (unsigned int)((char*)symbol_addr - ((char*)assembler->code + reloc->offset + 4));
-            }
-        } else {
-            fprintf(stderr, "Warning: Undefined symbol %s\n", reloc->name);
-        }
-    }
-    
-    return 0;
+    return rc;
 }
@@ -1,201 +1,429 @@
+#define _GNU_SOURCE
 #include <dlfcn.h>
 #include "../../b.h"
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include <stdint.h>
 #include <regex.h>
 
 #include "./as.h"
+#include "../../opt.h"
 
-void *execute_code(Assembler *assembler) {
-    // Place data section immediately after code
-    size_t code_size = assembler->text_offset;
-    size_t data_size = assembler->data_size;
-    size_t total_size = code_size + data_size;
-    // Round up to next multiple of page size
+extern ASTNodeList *top_level_funcs;
+
+// Drop the meta program's AST and switch back to the enclosing compilation
+static void meta_arena_restore(Arena *arena, Arena *saved_arena, ASTNodeList *saved_funcs) {
+    ast_arena = saved_arena;
+    top_level_funcs = saved_funcs;
+    arena_release(arena);
+}
+
+// Copy MCode into one executable mapping (code, then data) and apply its
+// relocations. Symbols the meta program does not define itself come from
+// the running compiler through dlsym. In a 64-bit process those can be
+// further than a rel32 reaches; a call or jmp to one then goes through a
+// stub placed after the data, "jmp [rip+0]" followed by the address.
+#define JIT_STUB_SIZE 14
+
+static size_t stubs_offset(const MCode *mc) {
+    return ((size_t)mc->code_size + (size_t)mc->data_size + 15) & ~(size_t)15;
+}
+
+// Bytes the mapping of mc takes, stubs included, in whole pages
+static size_t image_size(const MCode *mc) {
     size_t page_size = sysconf(_SC_PAGESIZE);
-    if (total_size == 0) total_size = page_size;
-    if (total_size % page_size != 0) {
-        total_size += page_size - (total_size % page_size);
-    }
-    void *exec_mem = mmap(NULL, total_size, PROT_READ | PROT_WRITE | PROT_EXEC, 
-                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    
-    if (exec_mem == MAP_FAILED) {
+    size_t total = stubs_offset(mc) + (sizeof(void*) == 8 ? (size_t)mc->num_relocs * JIT_STUB_SIZE : 0);
+    total = (total + page_size - 1) / page_size * page_size;
+    return total ? total : page_size;
+}
+
+// Patch the relocations of mc in its image at mem. Only the symbols,
+// relocations and sizes of mc are used, so a cached image can be patched
+// from its entry's tables alone.
+static int relocate(unsigned char *mem, const MCode *mc) {
+    unsigned char *stub = mem + stubs_offset(mc);
+    for (int i = 0; i < mc->num_relocs; i++) {
+        CodeReloc *r = &mc->relocs[i];
+        unsigned char *addr = NULL;
+        for (int j = 0; j < mc->num_symbols; j++) {
+            if (mc->symbols[j].name == r->sym) {
+                addr = mem + mc->symbols[j].offset + (mc->symbols[j].in_data ? mc->code_size : 0);
+                break;
+            }
+        }
+        if (!addr) addr = resolve_external_symbol(symbol_name(r->sym));
+        if (!addr) return -1;
+        unsigned char *field_at = mem + r->offset;
+        int32_t field;
+        memcpy(&field, field_at, 4);
+        if (r->kind == RELOC_REL32) {
+            intptr_t rel = addr - (field_at + 4) + field;
+            if (rel != (int32_t)rel && r->offset > 0 && (field_at[-1] == 0xE8 || field_at[-1] == 0xE9)) {
+                static const unsigned char jmp_indirect[6] = { 0xFF, 0x25, 0, 0, 0, 0 };
+                memcpy(stub, jmp_indirect, 6);
+                memcpy(stub + 6, &addr, sizeof(addr));
+                rel = stub - (field_at + 4);
+                stub += JIT_STUB_SIZE;
+            }
+            if (rel != (int32_t)rel) {
+                fprintf(stderr, "JIT: %s is out of rel32 range\n", symbol_name(r->sym));
+                return -1;
+            }
+            field = (int32_t)rel;
+        } else {
+            field += (int32_t)(intptr_t)addr;
+        }
+        memcpy(field_at, &field, 4);
+    }
+    return 0;
+}
+
+static void *load_code(MCode *mc, size_t *map_size) {
+    size_t total = image_size(mc);
+    unsigned char *mem = mmap(NULL, total, PROT_READ | PROT_WRITE | PROT_EXEC,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
         perror("mmap failed");
         return NULL;
     }
-    
-    unsigned char new_code[] = {
-        0x55, 
-        0x89, 0xE5, 
-      //  0X83, 0xEC, 0x00, 
-      //  0x83, 0xEC, 0X0C,
-        0X89, 0xEC, 
-        0x5D, 
-        0xC3, 0X00, 0X00};
-    // Copy code and data
-   // memcpy(exec_mem, new_code, 13);
-    memcpy(exec_mem, assembler->code, code_size);
-    memcpy((char*)exec_mem + code_size, assembler->data, data_size);
-
-    // Debug: print all symbols before update
-    fprintf(stderr, "[DEBUG] Symbols before address update:\n");
-    for (int i = 0; i < assembler->num_symbols; i++) {
-        fprintf(stderr, "  Symbol: %s at %p\n", assembler->symbols[i].name, assembler->symbols[i].address);
-    }
-    // Update symbol addresses to point to new location
-    for (int i = 0; i < assembler->num_symbols; i++) {
-        // If the address is an offset (from label), update to exec_mem + offset
-        intptr_t offset = (intptr_t)assembler->symbols[i].address;
-        if (offset >= 0 && offset < (intptr_t)code_size) {
-            assembler->symbols[i].address = (char*)exec_mem + offset;
-        } else if ((void*)assembler->symbols[i].address >= (void*)assembler->data &&
-                   (void*)assembler->symbols[i].address < (void*)(assembler->data + assembler->data_size)) {
-            // Data symbol
-            size_t doffset = (char*)assembler->symbols[i].address - (char*)assembler->data;
-            assembler->symbols[i].address = (char*)exec_mem + code_size + doffset;
-        }
+    memcpy(mem, mc->code, mc->code_size);
+    memcpy(mem + mc->code_size, mc->data, mc->data_size);
+    if (relocate(mem, mc) != 0) {
+        munmap(mem, total);
+        return NULL;
     }
-    // Debug: print all symbols after update
-    fprintf(stderr, "[DEBUG] Symbols after address update:\n");
-    for (int i = 0; i < assembler->num_symbols; i++) {
-        fprintf(stderr, "  Symbol: %s at %p\n", assembler->symbols[i].name, assembler->symbols[i].address);
+    *map_size = total;
+    return mem;
+}
+
+// Call the main of a loaded program, then unmap it
+static void run_image(unsigned char *exec_mem, size_t map_size, const MCode *mc) {
+    void *main_addr = NULL;
+    SymId main_name = intern_name("main", 4);
+    for (int i = 0; i < mc->num_symbols; i++) {
+        if (mc->symbols[i].name == main_name && !mc->symbols[i].in_data)
+            main_addr = exec_mem + mc->symbols[i].offset;
     }
-    
-    // Print data section contents in exec_mem
-    fprintf(stderr, "[DEBUG] Data section in exec_mem: ");
-    for (size_t i = 0; i < assembler->data_size; i++) {
-        fprintf(stderr, "%02X ", ((unsigned char*)exec_mem + code_size)[i]);
+    if (main_addr) {
+        fprintf(stderr, "Calling generated main function (%d bytes code, %d bytes data):-----\n",
+                mc->code_size, mc->data_size);
+        typedef int (*main_func_t)(void);
+        main_func_t main_fn = (main_func_t)main_addr;
+        int main_result = main_fn();
+        fprintf(stderr, "======================\n");
+        fprintf(stderr, "main() returned: %d\n", main_result);
+    } else {
+        fprintf(stderr, "Error: main function not found\n");
     }
-    fprintf(stderr, "\n[DEBUG] Data section as string: '%s'\n", (char*)exec_mem + code_size);
-    
-    return exec_mem;
+    munmap(exec_mem, map_size);
 }
 
-void evaluate_meta_construct(const char *content) {
-    fprintf(stderr, "=== Meta Construct Evaluation ===\n");
-    fprintf(stderr, "B Language Content: %s\n", content);
-    
-    // First, parse the B language content as a complete program
-    Parser parser;
-    parser_init(&parser, content);
-    
-    // Parse as a complete program (since meta content can contain functions, externs, etc.)
-    ASTNode *program = parse_program(&parser);
-    if (!program) {
-        fprintf(stderr, "Failed to parse B language content in meta construct\n");
-        return;
+// Load the program and call its main
+static void run_code(MCode *mc) {
+    size_t map_size = 0;
+    unsigned char *exec_mem = load_code(mc, &map_size);
+    if (exec_mem) run_image(exec_mem, map_size, mc);
+}
+
+// --- Meta block cache ---
+// With -fcache-dir=DIR a compiled meta program is kept in DIR as well, keyed
+// by the block's text, the compiler build and the flags the AST passes and
+// code generator read. An entry is the image load_code would build: code,
+// data and room for the stubs, at a page-aligned offset behind the symbol
+// and relocation tables. A hit maps the image from the file, private and
+// executable, patches its relocations and calls main; nothing is parsed,
+// compiled or assembled. A block with meta blocks of its own runs them while
+// it compiles, so it is never stored.
+#define META_CACHE_MAGIC "BMC1"
+
+typedef struct {
+    unsigned char *bytes;
+    int len, cap;
+} MetaBuf;
+
+static void meta_put(MetaBuf *b, const void *p, int n) {
+    b->bytes = (unsigned char*)grow_vec(b->bytes, &b->cap, b->len + n, 1);
+    memcpy(b->bytes + b->len, p, n);
+    b->len += n;
+}
+
+// Key of the block being evaluated, and the number of evaluations started
+// so far, which must not change until it is stored
+typedef struct {
+    MetaBuf bytes;
+    int evaluations;
+} MetaKey;
+
+static int meta_evaluations = 0;
+
+static void meta_put_int(MetaBuf *b, int v) { meta_put(b, &v, sizeof(v)); }
+
+static void meta_put_name(MetaBuf *b, SymId name) {
+    meta_put_int(b, (int)symbol_length(name));
+    meta_put(b, symbol_name(name), (int)symbol_length(name));
+}
+
+static void meta_key(MetaKey *k, const char *content) {
+    MetaBuf *key = &k->bytes;
+    k->evaluations = meta_evaluations;
+    int flags[] = { (int)sizeof(void*), opt_level, inline_limit, unroll_factor, drop_unused_globals,
+                    omit_frame_pointer, getenv("B_JIT_TEXT") != NULL };
+    meta_put(key, META_CACHE_MAGIC, 4);
+    meta_put(key, b_build_id(), 16);
+    meta_put(key, flags, sizeof(flags));
+    meta_put(key, content, (int)strlen(content));
+}
+
+static void meta_path(const MetaBuf *key, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx.bmc", fn_cache_dir,
+             (unsigned long long)cache_hash(key->bytes, (size_t)key->len));
+}
+
+// "BMC1", image offset and size, the key, code and data sizes, then the
+// symbols and relocations with their names spelled out
+static void meta_cache_store(const MetaKey *k, const MCode *mc) {
+    if (k->evaluations != meta_evaluations) return;
+    const MetaBuf *key = &k->bytes;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t total = image_size(mc);
+    MetaBuf head = { NULL, 0, 0 };
+    meta_put(&head, META_CACHE_MAGIC, 4);
+    meta_put_int(&head, 0);   // image offset, filled in below
+    meta_put_int(&head, (int)total);
+    meta_put_int(&head, key->len);
+    meta_put(&head, key->bytes, key->len);
+    meta_put_int(&head, mc->code_size);
+    meta_put_int(&head, mc->data_size);
+    meta_put_int(&head, mc->num_symbols);
+    meta_put_int(&head, mc->num_relocs);
+    for (int i = 0; i < mc->num_symbols; i++) {
+        meta_put_int(&head, mc->symbols[i].offset);
+        meta_put(&head, &mc->symbols[i].in_data, 1);
+        meta_put_name(&head, mc->symbols[i].name);
+    }
+    for (int i = 0; i < mc->num_relocs; i++) {
+        meta_put_int(&head, mc->relocs[i].offset);
+        meta_put(&head, &mc->relocs[i].kind, 1);
+        meta_put_name(&head, mc->relocs[i].sym);
+    }
+    int image_at = (int)((head.len + page_size - 1) / page_size * page_size);
+    memcpy(head.bytes + 4, &image_at, sizeof(image_at));
+    // Zeros up to the image, and after the code and data to its end
+    size_t pad = (size_t)image_at - head.len > total ? (size_t)image_at - head.len : total;
+    unsigned char *zeros = (unsigned char*)calloc(1, pad);
+
+    char path[4096], tmp[4096 + 16];
+    meta_path(key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    mkdir(fn_cache_dir, 0777);
+    FILE *f = fopen(tmp, "wb");
+    if (f) {
+        size_t rest = total - mc->code_size - mc->data_size;
+        int ok = fwrite(head.bytes, 1, head.len, f) == (size_t)head.len &&
+                 fwrite(zeros, 1, image_at - head.len, f) == (size_t)(image_at - head.len) &&
+                 fwrite(mc->code, 1, mc->code_size, f) == (size_t)mc->code_size &&
+                 fwrite(mc->data, 1, mc->data_size, f) == (size_t)mc->data_size &&
+                 fwrite(zeros, 1, rest, f) == rest;
+        if (fclose(f) != 0) ok = 0;
+        if (!ok || rename(tmp, path) != 0) remove(tmp);
+    }
+    free(zeros);
+    free(head.bytes);
+}
+
+// Bounds-checked reads from an entry's tables
+typedef struct {
+    const unsigned char *p, *end;
+} MetaReader;
+
+static int meta_get(MetaReader *r, void *dst, int n) {
+    if (n < 0 || r->end - r->p < n) return 0;
+    memcpy(dst, r->p, n);
+    r->p += n;
+    return 1;
+}
+
+static int meta_get_name(MetaReader *r, SymId *name) {
+    int len;
+    if (!meta_get(r, &len, sizeof(len)) || len < 0 || r->end - r->p < len) return 0;
+    *name = intern_name((const char*)r->p, (size_t)len);
+    r->p += len;
+    return 1;
+}
+
+// Read the tables of an entry into mc, whose code and data stay NULL
+static int meta_read_tables(MetaReader *r, const MetaBuf *key, MCode *mc) {
+    int key_len;
+    if (!meta_get(r, &key_len, sizeof(key_len)) || key_len != key->len || r->end - r->p < key_len ||
+        memcmp(r->p, key->bytes, key_len) != 0)
+        return 0;
+    r->p += key_len;
+    if (!meta_get(r, &mc->code_size, sizeof(int)) || !meta_get(r, &mc->data_size, sizeof(int)) ||
+        !meta_get(r, &mc->num_symbols, sizeof(int)) || !meta_get(r, &mc->num_relocs, sizeof(int)) ||
+        mc->code_size < 0 || mc->data_size < 0 || mc->num_symbols < 0 || mc->num_relocs < 0 ||
+        mc->num_symbols > r->end - r->p || mc->num_relocs > r->end - r->p)
+        return 0;
+    mc->symbols = (CodeSymbol*)calloc(mc->num_symbols + 1, sizeof(CodeSymbol));
+    mc->relocs = (CodeReloc*)calloc(mc->num_relocs + 1, sizeof(CodeReloc));
+    for (int i = 0; i < mc->num_symbols; i++) {
+        CodeSymbol *sym = &mc->symbols[i];
+        if (!meta_get(r, &sym->offset, sizeof(int)) || !meta_get(r, &sym->in_data, 1) ||
+            !meta_get_name(r, &sym->name) || sym->offset < 0 ||
+            sym->offset > (sym->in_data ? mc->data_size : mc->code_size))
+            return 0;
+    }
+    for (int i = 0; i < mc->num_relocs; i++) {
+        CodeReloc *rel = &mc->relocs[i];
+        if (!meta_get(r, &rel->offset, sizeof(int)) || !meta_get(r, &rel->kind, 1) ||
+            !meta_get_name(r, &rel->sym) || rel->offset < 0 || rel->offset > mc->code_size - 4)
+            return 0;
     }
-    
-    fprintf(stderr, "Parsed AST: ");
-    //print_ast(program, 0);
-    
-    // Generate assembly from the parsed AST
+    return 1;
+}
+
+// Run the cached program for key, if there is one
+static int meta_cache_run(const MetaBuf *key) {
+    char path[4096];
+    meta_path(key, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    struct stat st;
+    char magic[4];
+    int where[2];   // image offset and size
+    unsigned char *head = NULL;
+    MCode mc;
+    memset(&mc, 0, sizeof(mc));
+    int ok = fstat(fd, &st) == 0 &&
+             pread(fd, magic, 4, 0) == 4 && memcmp(magic, META_CACHE_MAGIC, 4) == 0 &&
+             pread(fd, where, sizeof(where), 4) == (ssize_t)sizeof(where) &&
+             where[0] > 0 && where[0] % page_size == 0 && where[1] > 0 &&
+             st.st_size == (off_t)where[0] + where[1];
+    if (ok) {
+        head = (unsigned char*)malloc(where[0]);
+        MetaReader r = { head + 4 + sizeof(where), head + where[0] };
+        ok = pread(fd, head, where[0], 0) == where[0] && meta_read_tables(&r, key, &mc) &&
+             image_size(&mc) == (size_t)where[1];
+    }
+    unsigned char *mem = MAP_FAILED;
+    if (ok) {
+        mem = mmap(NULL, where[1], PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE, fd, where[0]);
+        if (mem == MAP_FAILED) {
+            // A cache directory on a noexec mount: read the image instead
+            mem = mmap(NULL, where[1], PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem != MAP_FAILED && pread(fd, mem, where[1], where[0]) != where[1]) {
+                munmap(mem, where[1]);
+                mem = MAP_FAILED;
+            }
+        }
+        ok = mem != MAP_FAILED && relocate(mem, &mc) == 0;
+        if (!ok && mem != MAP_FAILED) munmap(mem, where[1]);
+    }
+    close(fd);
+    if (ok) {
+        fprintf(stderr, "Loaded meta construct from %s\n", path);
+        run_image(mem, where[1], &mc);
+    }
+    free(head);
+    free(mc.symbols);
+    free(mc.relocs);
+    return ok;
+}
+
+// Run a parsed meta program through assembly text and the text assembler.
+// Kept for comparison with the direct path (B_JIT_TEXT=1).
+static void evaluate_via_assembler(ASTNode *program, const MetaKey *key) {
     FILE *temp_file = tmpfile();
     if (!temp_file) {
         fprintf(stderr, "Failed to create temporary file\n");
-        free_ast(program);
         return;
     }
-    
-    // Generate x86 assembly from the AST
+
+    // Generate x86 assembly from the AST; nobody reads the comments here
+    int saved_compact = asm_compact;
+    asm_compact = 1;
     generate_x86(program, temp_file);
+    asm_compact = saved_compact;
     fflush(temp_file);
-    rewind(temp_file);
-    
-    // Get the file descriptor to create a filename
-    int fd = fileno(temp_file);
+
     char temp_filename[64];
-    snprintf(temp_filename, sizeof(temp_filename), "/proc/self/fd/%d", fd);
-    
+    snprintf(temp_filename, sizeof(temp_filename), "/proc/self/fd/%d", fileno(temp_file));
+
     Assembler assembler;
     assembler_init(&assembler);
-    
-    // Resolve external symbols using dlsym
-    void *printf_addr = resolve_external_symbol("printf");
-    if (printf_addr) {
-        add_symbol(&assembler, "printf", printf_addr);
-    } else {
-        fprintf(stderr, "Failed to resolve printf symbol\n");
-        assembler_cleanup(&assembler);
-        fclose(temp_file);
-        return;
-    }
-    
-    // Parse assembly file using the existing working function
-    if (parse_assembly_file(temp_filename, &assembler) != 0) {
-        assembler_cleanup(&assembler);
-        fclose(temp_file);
-        return;
+    if (parse_assembly_file(temp_filename, &assembler) == 0) {
+        if (key) meta_cache_store(key, &assembler.code);
+        run_code(&assembler.code);
     }
-    fprintf(stderr, "[DEBUG] num_symbols after parsing: %d\n", assembler.num_symbols);
-    // Resolve external symbols (no symbol file needed for meta constructs)
-    if (resolve_symbols(&assembler, NULL) != 0) {
-        assembler_cleanup(&assembler);
-        fclose(temp_file);
+    assembler_cleanup(&assembler);
+    fclose(temp_file);
+}
+
+// Compile the meta program straight to machine code and run its main
+static void evaluate_direct(ASTNode *program, const MetaKey *key) {
+    MCode mc;
+    if (generate_x86_code(program, &mc) != 0) {
+        fprintf(stderr, "Failed to generate code for meta construct\n");
         return;
     }
-    // Assemble instructions
-    if (assemble_instructions(&assembler) != 0) {
-        assembler_cleanup(&assembler);
-        fclose(temp_file);
-        return;
+    if (key) meta_cache_store(key, &mc);
+    run_code(&mc);
+    mcode_free(&mc);
+}
+
+void evaluate_meta_construct(const char *content) {
+    fprintf(stderr, "=== Meta Construct Evaluation ===\n");
+    fprintf(stderr, "B Language Content: %s\n", content);
+
+    meta_evaluations++;
+    MetaKey key;
+    memset(&key, 0, sizeof(key));
+    if (fn_cache_dir) {
+        meta_key(&key, content);
+        if (meta_cache_run(&key.bytes)) {
+            fn_cache_stats.meta_hits++;
+            free(key.bytes.bytes);
+            fprintf(stderr, "=== Meta Construct Evaluation Complete ===\n\n");
+            return;
+        }
+        fn_cache_stats.meta_misses++;
     }
-    fprintf(stderr, "[DEBUG] num_symbols before execution: %d\n", assembler.num_symbols);
-    // Execute the code
-    void *exec_mem = execute_code(&assembler);
-    if (!exec_mem) {
-        assembler_cleanup(&assembler);
-        fclose(temp_file);
-        return;
+
+    // The meta program gets its own arena; the enclosing compilation's AST
+    // (and its function list) must stay intact while we run.
+    Arena arena;
+    arena_init(&arena);
+    Arena *saved_arena = ast_arena;
+    ASTNodeList *saved_funcs = top_level_funcs;
+    ast_arena = &arena;
+
+    // Parse as a complete program (since meta content can contain functions, externs, etc.)
+    Parser parser;
+    parser_init(&parser, content);
+    ASTNode *program = parse_program(&parser);
+    parser_free(&parser);
+    if (program && opt_level > 0) {
+        inline_program(program);
+        fold_program(program);
+        optimize_loops(program);
+        prune_program(program);
     }
-    
-    // Find main function
-    void *main_addr = find_symbol(&assembler, "main");
-    if (main_addr) {
-        fprintf(stderr, "Found main function at %p (from %p)\n", main_addr, exec_mem);
-        fprintf(stderr, "Code size: %d bytes\n", assembler.text_offset);
-        fprintf(stderr, "Data size: %d bytes\n", assembler.data_size);
-        
-        // Dump the first few bytes of the main function
-        fprintf(stderr, "Main function code: ");
-        unsigned char *code_ptr = (unsigned char*)main_addr;
-        for (int i = 0; i < 16 && i < assembler.text_offset; i++) {
-            fprintf(stderr, "%02X ", code_ptr[i]);
-        }
-        fprintf(stderr, "\n");
-        
-        // Demonstrate that we successfully generated machine code
-        fprintf(stderr, "Successfully generated machine code from assembly!\n");
-        fprintf(stderr, "Machine code: ");
-        for (int i = 0; i < assembler.text_offset; i++) {
-            fprintf(stderr, "%02X ", ((unsigned char*)main_addr)[i]);
-        }
-        fprintf(stderr, "\n");
-        
-        // Actually call the generated main function!
-        fprintf(stderr, "\nCalling generated main function:-----\n");
-        typedef int (*main_func_t)(void);
-        main_func_t main_fn = (main_func_t)main_addr;
-        int main_result = main_fn();
-        fprintf(stderr, "======================\n");
-        fprintf(stderr, "main() returned: %d\n", main_result);
-        
-        fprintf(stderr, "Program successfully parsed, assembled, and demonstrated symbol resolution!\n");
+    // The meta program runs in this process, whatever the output targets
+    int saved_mode64 = x86_mode64;
+    x86_mode64 = sizeof(void*) == 8;
+    if (!program) {
+        fprintf(stderr, "Failed to parse B language content in meta construct\n");
+    } else if (getenv("B_JIT_TEXT")) {
+        evaluate_via_assembler(program, fn_cache_dir ? &key : NULL);
     } else {
-        fprintf(stderr, "Error: main function not found\n");
-        // Print all symbols for debugging
-        for (int i = 0; i < assembler.num_symbols; i++) {
-            fprintf(stderr, "Symbol: %s at %p\n", assembler.symbols[i].name, assembler.symbols[i].address);
-        }
+        evaluate_direct(program, fn_cache_dir ? &key : NULL);
     }
-    
-    // Cleanup
-    munmap(exec_mem, 4096);
-    assembler_cleanup(&assembler);
-    free_ast(program);
-    fclose(temp_file);
-    
+    x86_mode64 = saved_mode64;
+    meta_arena_restore(&arena, saved_arena, saved_funcs);
+    free(key.bytes.bytes);
+
     fprintf(stderr, "=== Meta Construct Evaluation Complete ===\n\n");
-} 
\ No newline at end of file
+}
@@ -1,90 +1,510 @@
 #include <stdio.h>
 #include "../../b.h"
+#include "../../opt.h"
+#include "x86.h"
 #include <string.h>
-
-// Forward declaration for meta construct evaluation
-void evaluate_meta_construct(const char *content);
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
 
 // Forward declaration for meta construct evaluation
 void evaluate_meta_construct(const char *content);
 
 #define ASMEND "#"
 
-static void gen_lvalue(ASTNode *expr, FILE *out);
-static void gen_expr(ASTNode *expr, FILE *out);
-static void gen_stmt(ASTNode *stmt, FILE *out);
+// --- Symbol tables ---
+// Open-addressed hash from SymId to an int value. Tables grow on demand, so
+// there is no cap on locals, params, globals or string literals.
+typedef struct { SymId key; int value; } SymEntry;
+typedef struct { SymEntry *slots; unsigned mask; int count; } SymTable;
+
+#define SYMTAB_MISSING 0x80000000
+
+static void symtab_clear(SymTable *t) {
+    if (t->slots) memset(t->slots, 0, (t->mask + 1) * sizeof(SymEntry));
+    t->count = 0;
+}
+
+static int symtab_lookup(SymTable *t, SymId key) {
+    if (!t->slots) return (int)SYMTAB_MISSING;
+    unsigned slot = ((unsigned)key * 2654435761u) & t->mask;
+    while (t->slots[slot].key) {
+        if (t->slots[slot].key == key) return t->slots[slot].value;
+        slot = (slot + 1) & t->mask;
+    }
+    return (int)SYMTAB_MISSING;
+}
+
+static void symtab_grow(SymTable *t) {
+    SymEntry *old = t->slots;
+    unsigned old_size = old ? t->mask + 1 : 0;
+    unsigned size = old_size ? old_size * 2 : 64;
+    t->slots = (SymEntry*)calloc(size, sizeof(SymEntry));
+    t->mask = size - 1;
+    for (unsigned i = 0; i < old_size; ++i) {
+        if (!old[i].key) continue;
+        unsigned slot = ((unsigned)old[i].key * 2654435761u) & t->mask;
+        while (t->slots[slot].key) slot = (slot + 1) & t->mask;
+        t->slots[slot] = old[i];
+    }
+    free(old);
+}
+
+// Insert key, or give it a new value if present
+static void symtab_set(SymTable *t, SymId key, int value) {
+    if (!t->slots || (unsigned)(t->count + 1) * 2 > t->mask + 1) symtab_grow(t);
+    unsigned slot = ((unsigned)key * 2654435761u) & t->mask;
+    while (t->slots[slot].key && t->slots[slot].key != key) slot = (slot + 1) & t->mask;
+    if (!t->slots[slot].key) t->count++;
+    t->slots[slot].key = key;
+    t->slots[slot].value = value;
+}
+
+// Insert key if absent; returns 1 if it was added
+static int symtab_insert(SymTable *t, SymId key, int value) {
+    if (!t->slots || (unsigned)(t->count + 1) * 2 > t->mask + 1) symtab_grow(t);
+    unsigned slot = ((unsigned)key * 2654435761u) & t->mask;
+    while (t->slots[slot].key) {
+        if (t->slots[slot].key == key) return 0;
+        slot = (slot + 1) & t->mask;
+    }
+    t->slots[slot].key = key;
+    t->slots[slot].value = value;
+    t->count++;
+    return 1;
+}
+
+// --- Output ---
+// The tree walk describes each instruction as an Insn and hands it to one of
+// two sinks: the text sink prints Intel syntax for -S into one large buffer
+// that is flushed with write(2); the code sink encodes bytes straight into an
+// MCode for the meta JIT, resolving branches and recording relocations.
+// From -O1 up each function is first collected in a buffer and passed
+// through the peephole optimizer on its way to the sink.
+#define ASM_BUF_SIZE (256 * 1024)
+
+typedef struct { int offset; int label; SymId user; } LabelFixup;
+
+typedef struct {
+    // Text sink
+    char *buf;
+    size_t len;
+    int fd;
+    int compact;           // drop ASMEND comments
+    // Code sink, used instead when code is set
+    MCode *code;
+    int label_base;        // label_count when this output started
+    int *label_offsets;    // .L<label_base + i> -> code offset, -1 until defined
+    int cap_labels;
+    SymTable user_labels;  // .L_<name> -> code offset
+    LabelFixup *fixups;
+    int num_fixups, cap_fixups;
+    // Function being buffered for the peephole optimizer
+    int buffering;
+    Insn *pending;
+    int num_pending, cap_pending;
+} AsmOut;
+
+// Set by -fno-verbose-asm; read when generate_x86 opens its output
+int asm_compact = 0;
+
+// Set by -fomit-frame-pointer: no function sets up ebp, which holds a
+// variable instead
+int omit_frame_pointer = 0;
+static void emit_flush(AsmOut *o) {
+    size_t done = 0;
+    while (done < o->len) {
+        ssize_t n = write(o->fd, o->buf + done, o->len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            exit(1);
+        }
+        done += (size_t)n;
+    }
+    o->len = 0;
+}
+
+static void emit_raw(AsmOut *o, const char *s, size_t n) {
+    if (ASM_BUF_SIZE - o->len < n) {
+        emit_flush(o);
+        if (n > ASM_BUF_SIZE) {
+            AsmOut direct;
+            direct.buf = (char*)s;
+            direct.len = n;
+            direct.fd = o->fd;
+            emit_flush(&direct);
+            return;
+        }
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+#define EMIT(o, lit) emit_raw(o, lit, sizeof(lit) - 1)
+
+static void emit_int(AsmOut *o, int64_t v) {
+    char tmp[21];
+    char *p = tmp + sizeof(tmp);
+    uint64_t u = v < 0 ? 0u - (uint64_t)v : (uint64_t)v;
+    do { *--p = (char)('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) *--p = '-';
+    emit_raw(o, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+static void emit_str(AsmOut *o, const char *s) { emit_raw(o, s, strlen(s)); }
+static void emit_name(AsmOut *o, SymId id) { emit_str(o, symbol_name(id)); }
+
+// Instructions are formatted straight into the output buffer, one line at a
+// time: reserve the worst case for the line, then write through a cursor.
+static char *emit_reserve(AsmOut *o, size_t n) {
+    if (ASM_BUF_SIZE - o->len < n) {
+        emit_flush(o);
+        if (n > ASM_BUF_SIZE) { fprintf(stderr, "Assembly line too long\n"); exit(1); }
+    }
+    return o->buf + o->len;
+}
+
+#define PUT(p, lit) (memcpy(p, lit, sizeof(lit) - 1), (p) + sizeof(lit) - 1)
+
+static char *put_mem(char *p, const char *s, size_t n) {
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static char *put_name(char *p, SymId id) { return put_mem(p, symbol_name(id), symbol_length(id)); }
+
+static char *put_int(char *p, int v) {
+    char tmp[12];
+    char *t = tmp + sizeof(tmp);
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    do { *--t = (char)('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) *--t = '-';
+    return put_mem(p, t, (size_t)(tmp + sizeof(tmp) - t));
+}
+
+static char *put_reg(char *p, int r) {
+    const char *name = x86_reg_name(r);
+    return put_mem(p, name, strlen(name));
+}
+
+static char *put_operand(char *p, const Operand *op, int size_prefix) {
+    switch (op->kind) {
+        case OPK_REG: return put_reg(p, op->base);
+        case OPK_REG8: return put_mem(p, x86_reg8_names[op->base], 2);
+        case OPK_IMM: return put_int(p, op->value);
+        case OPK_MEM: {
+            int first = 1;
+            if (size_prefix) p = x86_mode64 ? PUT(p, "qword ptr ") : PUT(p, "dword ptr ");
+            *p++ = '[';
+            // A symbol is addressed from rip in 64-bit mode
+            if (op->sym && x86_mode64) p = PUT(p, "rip+");
+            if (op->sym) { p = put_name(p, op->sym); first = 0; }
+            if (op->base != REG_NONE) {
+                if (!first) *p++ = '+';
+                p = put_reg(p, op->base);
+                first = 0;
+            }
+            if (op->index != REG_NONE) {
+                if (!first) *p++ = '+';
+                p = put_reg(p, op->index);
+                if (op->scale != 1) { *p++ = '*'; *p++ = (char)('0' + op->scale); }
+                first = 0;
+            }
+            if (op->value || first) {
+                if (op->value >= 0 && !first) *p++ = '+';
+                p = put_int(p, op->value);
+            }
+            *p++ = ']';
+            return p;
+        }
+        case OPK_LABEL:
+            if (op->sym) { p = PUT(p, ".L_"); return put_name(p, op->sym); }
+            p = PUT(p, ".L");
+            return put_int(p, op->value);
+        case OPK_SYM: return put_name(p, op->sym);
+    }
+    return p;
+}
+
+static void print_insn(AsmOut *o, const Insn *in) {
+    int notes = (in->note || in->note_sym) && !o->compact;
+    if (in->op == I_COMMENT && !notes) return;
+    // Worst case: fixed text and numbers, plus every name the line mentions
+    size_t note_len = notes && in->note ? strlen(in->note) : 0;
+    size_t room = 128 + note_len;
+    if (in->dst.sym) room += symbol_length(in->dst.sym) * 2;
+    if (in->src.sym) room += symbol_length(in->src.sym);
+    if (notes && in->note_sym) room += symbol_length(in->note_sym);
+    char *start = emit_reserve(o, room);
+    char *p = start;
+    switch (in->op) {
+        case I_LABEL:
+            p = put_operand(p, &in->dst, 0);
+            p = PUT(p, ":\n");
+            break;
+        case I_FUNC:
+            p = PUT(p, ".globl ");
+            p = put_name(p, in->dst.sym);
+            *p++ = '\n';
+            p = put_name(p, in->dst.sym);
+            p = PUT(p, ":\n");
+            break;
+        default: {
+            if (in->op != I_COMMENT) {
+                // A memory operand needs a size unless a register operand implies one
+                int sized = in->dst.kind != OPK_REG && in->dst.kind != OPK_REG8 &&
+                            in->src.kind != OPK_REG && in->src.kind != OPK_REG8;
+                p = PUT(p, "    ");
+                const char *m = x86_mode64 && in->op == I_CDQ ? "cqo" : x86_mnemonic[in->op];
+                while (*m) *p++ = *m++;
+                if (in->dst.kind != OPK_NONE) {
+                    *p++ = ' ';
+                    p = put_operand(p, &in->dst, sized);
+                }
+                if (in->src.kind != OPK_NONE) {
+                    p = PUT(p, ", ");
+                    p = put_operand(p, &in->src, sized);
+                }
+                if (notes) *p++ = ' ';
+            }
+            if (notes) {
+                p = PUT(p, ASMEND);
+                p = put_mem(p, in->note ? in->note : "", note_len);
+                if (in->note_sym) p = put_name(p, in->note_sym);
+            }
+            *p++ = '\n';
+        }
+    }
+    o->len += (size_t)(p - start);
+}
+
+static void encode_insn(AsmOut *o, const Insn *in) {
+    MCode *mc = o->code;
+    switch (in->op) {
+        case I_LABEL:
+            if (in->dst.sym) {
+                symtab_insert(&o->user_labels, in->dst.sym, mc->code_size);
+            } else {
+                int index = in->dst.value - o->label_base;
+                int old_cap = o->cap_labels;
+                o->label_offsets = (int*)grow_vec(o->label_offsets, &o->cap_labels, index + 1, sizeof(int));
+                for (int i = old_cap; i < o->cap_labels; ++i) o->label_offsets[i] = -1;
+                o->label_offsets[index] = mc->code_size;
+            }
+            return;
+        case I_FUNC:
+            mcode_symbol(mc, in->dst.sym, mc->code_size, 0);
+            return;
+        case I_COMMENT:
+            return;
+    }
+    int label_at;
+    if (mcode_insn(mc, in, &label_at) != 0) {
+        fprintf(stderr, "x86: cannot encode %s\n", x86_mnemonic[in->op]);
+        exit(1);
+    }
+    if (label_at >= 0) {
+        const Operand *ref = in->dst.kind == OPK_LABEL ? &in->dst : &in->src;
+        o->fixups = (LabelFixup*)grow_vec(o->fixups, &o->cap_fixups, o->num_fixups + 1, sizeof(LabelFixup));
+        o->fixups[o->num_fixups].offset = label_at;
+        o->fixups[o->num_fixups].label = ref->value;
+        o->fixups[o->num_fixups].user = ref->sym;
+        o->num_fixups++;
+    }
+}
+
+// Patch every branch to a label now that all of them are placed
+static int resolve_label_fixups(AsmOut *o) {
+    for (int i = 0; i < o->num_fixups; ++i) {
+        LabelFixup *f = &o->fixups[i];
+        int target;
+        if (f->user) {
+            target = symtab_lookup(&o->user_labels, f->user);
+            if (target == (int)SYMTAB_MISSING) {
+                fprintf(stderr, "x86: undefined label %s\n", symbol_name(f->user));
+                return -1;
+            }
+        } else {
+            int index = f->label - o->label_base;
+            target = index >= 0 && index < o->cap_labels ? o->label_offsets[index] : -1;
+            if (target < 0) {
+                fprintf(stderr, "x86: undefined label .L%d\n", f->label);
+                return -1;
+            }
+        }
+        int rel = target - (f->offset + 4);
+        memcpy(o->code->code + f->offset, &rel, 4);
+    }
+    return 0;
+}
+
+// Frame slots are addressed from R_FRAME, a pseudo register emit_insn
+// replaces by ebp, or by esp and the depth pushed so far when the function
+// has no frame pointer. Either way the offsets are from the frame base,
+// where ebp would point.
+#define R_FRAME 0xfe
+#define FRAME_MEM(off) x86_mem(R_FRAME, off)
+static int stack_offset = 0;   // esp - frame base
+static int frame_pointer = 1;  // the current function sets up ebp
+static int frame_size = 0;     // bytes the prologue reserves for locals
+
+static void resolve_frame(Operand *o) {
+    if (o->kind != OPK_MEM || o->base != R_FRAME) return;
+    if (frame_pointer) {
+        o->base = R_EBP;
+    } else {
+        o->base = R_ESP;
+        o->value -= stack_offset;
+    }
+}
+
+static void emit_insn(AsmOut *out, const Insn *in) {
+    Insn resolved;
+    if (in->dst.base == R_FRAME || in->src.base == R_FRAME) {
+        resolved = *in;
+        resolve_frame(&resolved.dst);
+        resolve_frame(&resolved.src);
+        in = &resolved;
+    }
+    if (out->buffering) {
+        out->pending = (Insn*)grow_vec(out->pending, &out->cap_pending, out->num_pending + 1, sizeof(Insn));
+        out->pending[out->num_pending++] = *in;
+    } else if (out->code) {
+        encode_insn(out, in);
+    } else {
+        print_insn(out, in);
+    }
+}
+
+// The per-function cache, in targets/x86/fncache.c
+static int fn_cache_capturing(void);
+static void fn_cache_store(const Insn *code, int n);
+
+// Optimize the buffered function and pass it on to the sink
+static void flush_pending(AsmOut *out) {
+    int n = opt_level > 0 ? x86_peephole(out->pending, out->num_pending) : out->num_pending;
+    if (fn_cache_capturing()) fn_cache_store(out->pending, n);
+    out->buffering = 0;
+    for (int i = 0; i < n; ++i) emit_insn(out, &out->pending[i]);
+    out->num_pending = 0;
+}
+
+#define emit(out, m, dst, src, note, note_sym) \
+    emit_insn(out, &(Insn){ (unsigned char)(m), dst, src, note, note_sym })
+
+// Operand shorthands for the code generator
+#define EAX x86_reg(R_EAX)
+#define ECX x86_reg(R_ECX)
+#define ESP x86_reg(R_ESP)
+#define EBP x86_reg(R_EBP)
+#define AL x86_reg8(R_EAX)
+#define CL x86_reg8(R_ECX)
+#define IMM(v) x86_imm(v)
+#define LABEL(n) x86_label(n)
+
+#define INS0(m, note) emit(out, m, x86_none(), x86_none(), note, SYM_NONE)
+#define INS1(m, a, note) emit(out, m, a, x86_none(), note, SYM_NONE)
+#define INS2(m, a, b, note) emit(out, m, a, b, note, SYM_NONE)
+#define PUT_LABEL(n) INS1(I_LABEL, LABEL(n), NULL)
+
+static void gen_lvalue(ASTNode *expr, AsmOut *out);
+static void gen_expr(ASTNode *expr, AsmOut *out);
+static void gen_stmt(ASTNode *stmt, AsmOut *out);
+// The x86-64 calling convention, in targets/x86_64/sysv.c
+static void add_params_sysv(ASTNodeList *paramlist);
+static void gen_params_sysv(AsmOut *out);
+static void gen_call_sysv(ASTNode *expr, AsmOut *out);
+static int gen_tail_call_sysv(ASTNode *expr, AsmOut *out);
+static int fn_cache_lookup(ASTNode *fn, AsmOut *out);
+// Tail calls, see gen_tail_call
+static int has_self_tail_call(ASTNode *s, ASTNode *fn);
+static ASTNode *current_function;
+static int tail_entry_label = -1;  // after the prologue, if a self tail call needs it
+static int tail_calls_ok = 0;      // no frame variable has its address taken
 static int label_count = 0;
-static int is_global(const char *name);
-#define MAX_LOCALS 64
+static int measuring = 0;   // x86_program_size: meta blocks are not run
 
-typedef struct { const char *name; int offset; } Local;
+// A B word, which is also what push and pop move
+#define WORD_SIZE (x86_mode64 ? 8 : 4)
 
-static Local locals[MAX_LOCALS];
+// Function scope: params (positive offsets) and locals (negative offsets)
+typedef struct {
+    SymId name;
+    int offset;              // from the frame base
+    int weight;              // uses, scaled up inside loops
+    unsigned char addr_taken;
+    unsigned char reg;       // register the variable lives in, or REG_NONE
+} FrameVar;
+static SymTable frame_vars;  // name -> index into frame
+static FrameVar *frame = NULL;
+static int num_frame_vars = 0;
+static int cap_frame_vars = 0;
 static int num_locals = 0;
-static int stack_offset = 0;
 
-// Add parameters to params table with positive offsets
-#define MAX_PARAMS 32
-static Local params[MAX_PARAMS];
-static int num_params = 0;
+// Global scope: globals and functions, mapped to their index
+static SymTable global_vars;
+static SymTable function_names;
+// Function -> fewest arguments any call in the program passes it, -1 once
+// its address is taken; absent if the program never calls it
+static SymTable call_args;
+
+static int is_global(SymId name) {
+    return symtab_lookup(&global_vars, name) != (int)SYMTAB_MISSING;
+}
+
+static int is_function(SymId name) {
+    return symtab_lookup(&function_names, name) != (int)SYMTAB_MISSING;
+}
+
+static int add_frame_var(SymId name, int offset) {
+    if (!symtab_insert(&frame_vars, name, num_frame_vars)) return 0;
+    frame = (FrameVar*)grow_vec(frame, &cap_frame_vars, num_frame_vars + 1, sizeof(FrameVar));
+    FrameVar *v = &frame[num_frame_vars++];
+    v->name = name;
+    v->offset = offset;
+    v->weight = 0;
+    v->addr_taken = 0;
+    v->reg = REG_NONE;
+    return 1;
+}
 
+static FrameVar *frame_var(SymId name) {
+    int i = symtab_lookup(&frame_vars, name);
+    return i == (int)SYMTAB_MISSING ? NULL : &frame[i];
+}
+
+// Add parameters to the frame scope with positive offsets
 static void add_params(ASTNodeList *paramlist) {
     int offset = 8; // [ebp+8] is first param in cdecl
-    num_params = 0;
-    for (ASTNodeList *l = paramlist; l; l = l->next) {
-        if (num_params < MAX_PARAMS) {
-            params[num_params].name = l->node->data.var.name;
-            params[num_params].offset = offset;
-            num_params++;
+    for (int i = 0; i < paramlist->count; ++i) {
+        if (add_frame_var(paramlist->items[i]->data.var.name, offset))
             offset += 4;
-        }
     }
 }
 
-// Add locals to locals table with negative offsets
+// Add a local unless it is already a param, local or global
+static void add_local(SymId name) {
+    if (is_global(name)) return;
+    if (add_frame_var(name, -WORD_SIZE * (num_locals + 1)))
+        num_locals++;
+}
+
+// Add locals to the frame scope with negative offsets
 static void collect_locals(ASTNode *node) {
     if (!node) return;
     switch (node->type) {
         case AST_BLOCK:
-            for (ASTNodeList *l = node->data.block.statements; l; l = l->next)
-                collect_locals(l->node);
-            break;
-        case AST_VAR_DECL: {
-            // Add local variable if not already present
-            const char *name = node->data.var_decl.name;
-            int found = 0;
-            for (int i = 0; i < num_params; ++i) {
-                if (strcmp(params[i].name, name) == 0) { found = 1; break; }
-            }
-            for (int i = 0; i < num_locals; ++i) {
-                if (strcmp(locals[i].name, name) == 0) { found = 1; break; }
-            }
-            if (is_global(name)) found = 1;
-            if (!found && num_locals < MAX_LOCALS) {
-                locals[num_locals].name = name;
-                locals[num_locals].offset = 0; // will be set later
-                num_locals++;
-            }
+            for (int i = 0; i < node->data.block.statements.count; ++i)
+                collect_locals(node->data.block.statements.items[i]);
+            break;
+        case AST_VAR_DECL:
+            add_local(node->data.var_decl.name);
             break;
-        }
         case AST_ASSIGN:
-            if (node->data.assign.var && node->data.assign.var->type == AST_VAR) {
-                // Only add if not already present in params, locals, or globals
-                const char *name = node->data.assign.var->data.var.name;
-                int found = 0;
-                for (int i = 0; i < num_params; ++i) {
-                    if (strcmp(params[i].name, name) == 0) { found = 1; break; }
-                }
-                for (int i = 0; i < num_locals; ++i) {
-                    if (strcmp(locals[i].name, name) == 0) { found = 1; break; }
-                }
-                if (is_global(name)) found = 1;
-                if (!found && num_locals < MAX_LOCALS) {
-                    locals[num_locals].name = name;
-                    locals[num_locals].offset = 0; // will be set later
-                    num_locals++;
-                }
-            }
+            if (node->data.assign.var && node->data.assign.var->type == AST_VAR)
+                add_local(node->data.assign.var->data.var.name);
             collect_locals(node->data.assign.expr);
             break;
         case AST_IF:
@@ -105,119 +525,114 @@ static void collect_locals(ASTNode *node) {
 }
 
 static void assign_local_offsets() {
-    stack_offset = 0;
-    for (int i = 0; i < num_locals; ++i) {
-        stack_offset -= 4;
-        locals[i].offset = stack_offset;
-    }
+    stack_offset = -WORD_SIZE * num_locals;
 }
 
-// Find variable offset: check params first, then locals
-static int find_var_offset(const char *name) {
-    for (int i = 0; i < num_params; ++i) {
-        if (strcmp(params[i].name, name) == 0)
-            return params[i].offset;
-    }
-    for (int i = 0; i < num_locals; ++i) {
-        if (strcmp(locals[i].name, name) == 0)
-            return locals[i].offset;
-    }
+// Find variable offset: params and locals first, then globals
+static int find_var_offset(SymId name) {
+    FrameVar *v = frame_var(name);
+    if (v)
+        return v->offset;
     if (is_global(name))
         return 0x7fffffff; // special marker for global
     return 0; // not found
 }
 
-#define MAX_GLOBALS 128
-static const char *global_names[MAX_GLOBALS];
-static int global_inits[MAX_GLOBALS]; // 0 if uninitialized, else value
+// Globals in definition order, for the .data section
+typedef struct { SymId name; int64_t init; } Global;
+static Global *globals = NULL;
 static int num_globals = 0;
+static int cap_globals = 0;
 
-static int is_global(const char *name) {
-    for (int i = 0; i < num_globals; ++i)
-        if (strcmp(global_names[i], name) == 0) return 1;
-    return 0;
-}
-
-// Forward declaration for function name check
-extern int is_function_name(const char *name, struct ASTNodeList *funcs);
-extern struct ASTNodeList *top_level_funcs;
+// String literal table, keyed by the interned literal text
+static SymTable string_ids;
+static SymId *string_literals = NULL;
+static int num_strings = 0;
+static int cap_strings = 0;
 
-static void gen_lvalue(ASTNode *expr, FILE *out) {
-    if (!expr) return;
-    switch (expr->type) {
-        case AST_VAR: {
-            int off = find_var_offset(expr->data.var.name);
-            if (off == 0x7fffffff) {
-                fprintf(out, "    lea eax, [%s] " ASMEND "global %s\n", expr->data.var.name, expr->data.var.name);
-            } else {
-                fprintf(out, "    lea eax, [ebp%+d] " ASMEND "var %s\n", off, expr->data.var.name);
-            }
-            break;
-        }
-        case AST_INDEX: {
-            gen_expr(expr->data.index.array, out); // base address in eax
-            fprintf(out, "    push eax " ASMEND "base\n");
-            gen_expr(expr->data.index.index, out); // index in eax
-            fprintf(out, "    pop ebx " ASMEND "base\n");
-            fprintf(out, "    lea eax, [ebx+eax*4] " ASMEND "array index\n");
-            break;
-        }
-        case AST_UNOP: // address-of
-            if (strcmp(expr->data.unop.op, "&") == 0) {
-                gen_lvalue(expr->data.unop.expr, out);
-            } else if (strcmp(expr->data.unop.op, "*") == 0) {
-                gen_expr(expr->data.unop.expr, out);
-                // eax now points to the address, so just pass through
-            }
-            break;
-        default:
-            // TODO: handle more lvalues
-            break;
-    }
+// Symbol naming the n-th string literal in .data
+static SymId string_label(int index) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "str%d", index);
+    return intern_name(buf, (size_t)len);
 }
 
-// String literal table
-#define MAX_STRINGS 128
-static const char *string_literals[MAX_STRINGS];
-static int num_strings = 0;
-
 // Return label for string literal, adding to table if new
-static const char *get_string_label(const char *value) {
-    for (int i = 0; i < num_strings; ++i) {
-        if (strcmp(string_literals[i], value) == 0)
-            { static char buf[32]; snprintf(buf, sizeof(buf), "str%d", i); return buf; }
-    }
-    if (num_strings < MAX_STRINGS) {
-        string_literals[num_strings] = value;
-        static char buf[32];
-        snprintf(buf, sizeof(buf), "str%d", num_strings);
-        num_strings++;
-        return buf;
+static SymId get_string_label(const char *value) {
+    SymId id = intern_name(value, strlen(value));
+    int index = symtab_lookup(&string_ids, id);
+    if (index == (int)SYMTAB_MISSING) {
+        if (num_strings == cap_strings) {
+            cap_strings = cap_strings ? cap_strings * 2 : 64;
+            string_literals = (SymId*)realloc(string_literals, cap_strings * sizeof(SymId));
+        }
+        index = num_strings++;
+        string_literals[index] = id;
+        symtab_insert(&string_ids, id, index);
     }
-    return "str_overflow";
+    return string_label(index);
 }
 
 // Emit string literals in .data
-static void emit_string_literals(FILE *out) {
+static void emit_string_literals(AsmOut *out) {
     if (num_strings == 0) return;
-    fprintf(out, ".data\n");
+    EMIT(out, ".data\n");
     for (int i = 0; i < num_strings; ++i) {
-        fprintf(out, "str%d: .asciz \"", i);
-        const char *s = string_literals[i];
+        EMIT(out, "str");
+        emit_int(out, i);
+        EMIT(out, ": .asciz \"");
+        const char *s = symbol_name(string_literals[i]);
         for (const char *p = s; *p; ++p) {
-            if (*p == '\\' || *p == '"') fprintf(out, "\\%c", *p);
-            else if (*p == '\n') fprintf(out, "\\n");
-            else if (*p == '\t') fprintf(out, "\\t");
-            else if ((unsigned char)*p < 32 || (unsigned char)*p > 126) fprintf(out, "\\%03o", (unsigned char)*p);
-            else fputc(*p, out);
+            if (*p == '\\' || *p == '"') { EMIT(out, "\\"); emit_raw(out, p, 1); }
+            else if (*p == '\n') EMIT(out, "\\n");
+            else if (*p == '\t') EMIT(out, "\\t");
+            else if ((unsigned char)*p < 32 || (unsigned char)*p > 126) {
+                unsigned char c = (unsigned char)*p;
+                char esc[4] = { '\\', (char)('0' + (c >> 6)), (char)('0' + ((c >> 3) & 7)), (char)('0' + (c & 7)) };
+                emit_raw(out, esc, 4);
+            }
+            else emit_raw(out, p, 1);
         }
-        fprintf(out, "\"\n");
+        EMIT(out, "\"\n");
     }
 }
 
+// Everything generate_x86 collects for the program as a whole
+typedef struct {
+    SymTable global_vars, function_names, call_args, string_ids;
+    Global *globals;
+    int num_globals, cap_globals;
+    SymId *string_literals;
+    int num_strings, cap_strings;
+} GlobalScope;
+
+#define SWAP(type, a, b) do { type tmp_ = (a); (a) = (b); (b) = tmp_; } while (0)
+static void swap_global_scope(GlobalScope *other) {
+    SWAP(SymTable, global_vars, other->global_vars);
+    SWAP(SymTable, function_names, other->function_names);
+    SWAP(SymTable, call_args, other->call_args);
+    SWAP(SymTable, string_ids, other->string_ids);
+    SWAP(Global*, globals, other->globals);
+    SWAP(int, num_globals, other->num_globals);
+    SWAP(int, cap_globals, other->cap_globals);
+    SWAP(SymId*, string_literals, other->string_literals);
+    SWAP(int, num_strings, other->num_strings);
+    SWAP(int, cap_strings, other->cap_strings);
+}
+#undef SWAP
+
+static void free_global_scope(GlobalScope *scope) {
+    free(scope->global_vars.slots);
+    free(scope->function_names.slots);
+    free(scope->call_args.slots);
+    free(scope->string_ids.slots);
+    free(scope->globals);
+    free(scope->string_literals);
+}
+
 // Update stack_offset for pushes/pops and sub/add esp
-#define UPDATE_STACK_PUSH() (stack_offset -= 4)
-#define UPDATE_STACK_POP()  (stack_offset += 4)
+#define UPDATE_STACK_PUSH() (stack_offset -= WORD_SIZE)
+#define UPDATE_STACK_POP()  (stack_offset += WORD_SIZE)
 #define UPDATE_STACK_SUB(N) (stack_offset -= (N))
 #define UPDATE_STACK_ADD(N) (stack_offset += (N))
 
@@ -232,24 +647,282 @@ static int get_entry_alignment(int locals) {
     return 16 - misalign;
 }
 
-static void gen_function(ASTNode *fn, FILE *out) {
+// --- Register allocation ---
+// Expressions are evaluated into eax. While the right operand of a binary
+// operator is computed, the left one waits in a temporary register (ecx,
+// then edx) and is pushed only when both are taken. Locals and params whose
+// address is never taken live in ebx, esi and edi, picked by use count with
+// uses inside loops weighted up; those registers are callee-saved in cdecl,
+// so the prologue saves the ones a function uses. x86-64 has room for more
+// of both: rsi and rdi join the temporaries, and variables get rbx and
+// r12-r15, the registers SysV preserves across calls. Without frame
+// pointers ebp is one more variable register.
+static const Reg temp_regs32[] = { R_ECX, R_EDX };
+static const Reg var_regs32[] = { R_EBX, R_ESI, R_EDI, R_EBP };
+static const Reg temp_regs64[] = { R_ECX, R_EDX, R_ESI, R_EDI };
+static const Reg var_regs64[] = { R_EBX, R_R12, R_R13, R_R14, R_R15, R_EBP };
+#define MAX_VAR_REGS 6
+#define NUM_TEMP_REGS (x86_mode64 ? 4 : 2)
+#define NUM_VAR_REGS ((x86_mode64 ? 5 : 3) + (omit_frame_pointer != 0))
+#define TEMP_REG(i) (x86_mode64 ? temp_regs64[i] : temp_regs32[i])
+#define VAR_REG(i) (x86_mode64 ? var_regs64[i] : var_regs32[i])
+
+static unsigned temps_busy = 0;       // bit (1 << reg) per temporary in use
+static Reg saved_regs[MAX_VAR_REGS];  // pushed by the prologue, in order
+static int num_saved_regs = 0;
+
+#define REG_BIT(r) (1u << (r))
+
+static void count_uses(ASTNode *n, int weight) {
+    if (!n) return;
+    #define RECURSE(x) count_uses(x, weight)
+    switch (n->type) {
+        case AST_VAR: {
+            FrameVar *v = frame_var(n->data.var.name);
+            if (v) v->weight += weight;
+            break;
+        }
+        case AST_UNOP:
+            if (n->data.unop.op == OP_BITAND && n->data.unop.expr && n->data.unop.expr->type == AST_VAR) {
+                FrameVar *v = frame_var(n->data.unop.expr->data.var.name);
+                if (v) v->addr_taken = 1;
+            }
+            RECURSE(n->data.unop.expr); break;
+        case AST_WHILE: {
+            int inner = weight < (1 << 24) ? weight * 8 : weight;
+            count_uses(n->data.while_stmt.cond, inner);
+            count_uses(n->data.while_stmt.body, inner);
+            break;
+        }
+        case AST_BLOCK:
+            for (int i = 0; i < n->data.block.statements.count; ++i) RECURSE(n->data.block.statements.items[i]);
+            break;
+        case AST_STATEMENT:
+            RECURSE(n->data.statement.stmt); break;
+        case AST_IF:
+            RECURSE(n->data.if_stmt.cond); RECURSE(n->data.if_stmt.then_branch); RECURSE(n->data.if_stmt.else_branch); break;
+        case AST_RETURN:
+            RECURSE(n->data.ret.expr); break;
+        case AST_ASSIGN:
+            RECURSE(n->data.assign.var); RECURSE(n->data.assign.expr); break;
+        case AST_BINOP:
+            RECURSE(n->data.binop.left); RECURSE(n->data.binop.right); break;
+        case AST_CALL:
+            for (int i = 0; i < n->data.call.args.count; ++i) RECURSE(n->data.call.args.items[i]);
+            RECURSE(n->data.call.left);
+            break;
+        case AST_INDEX:
+            RECURSE(n->data.index.array); RECURSE(n->data.index.index); break;
+        default: break;
+    }
+    #undef RECURSE
+}
+
+// Give the heaviest register candidates a callee-saved register each
+static void allocate_registers(ASTNode *body) {
+    num_saved_regs = 0;
+    temps_busy = 0;
+    count_uses(body, 1);
+    for (int r = 0; r < NUM_VAR_REGS; ++r) {
+        FrameVar *best = NULL;
+        for (int i = 0; i < num_frame_vars; ++i) {
+            FrameVar *v = &frame[i];
+            if (v->reg != REG_NONE || v->addr_taken || v->weight == 0) continue;
+            if (!best || v->weight > best->weight) best = v;
+        }
+        if (!best) break;
+        best->reg = (unsigned char)VAR_REG(r);
+        saved_regs[num_saved_regs++] = VAR_REG(r);
+    }
+}
+
+// Where a variable lives, as an instruction operand
+static Operand var_operand(SymId name) {
+    FrameVar *v = frame_var(name);
+    if (v && v->reg != REG_NONE) return x86_reg((Reg)v->reg);
+    int off = find_var_offset(name);
+    if (off == 0x7fffffff) return x86_mem_sym(name);
+    return FRAME_MEM(off);
+}
+
+static const char *var_note(SymId name) {
+    return find_var_offset(name) == 0x7fffffff ? "global " : "var ";
+}
+
+// A leaf the instruction using it can take directly, with no register of
+// its own: a constant or a variable
+static int leaf_operand(ASTNode *e, Operand *op) {
+    if (!e) return 0;
+    switch (e->type) {
+        case AST_NUM: *op = IMM(e->data.num.value); return 1;
+        case AST_CHAR: *op = IMM((unsigned char)e->data.char_lit.value); return 1;
+        case AST_VAR:
+            if (is_function(e->data.var.name)) return 0;
+            *op = var_operand(e->data.var.name);
+            return 1;
+        default: return 0;
+    }
+}
+
+// Whether evaluating e may change a variable or call out
+static int has_side_effects(ASTNode *e) {
+    if (!e) return 0;
+    switch (e->type) {
+        case AST_CALL: case AST_ASSIGN: return 1;
+        case AST_UNOP:
+            if (e->data.unop.op == OP_INC || e->data.unop.op == OP_DEC) return 1;
+            return has_side_effects(e->data.unop.expr);
+        case AST_BINOP: return has_side_effects(e->data.binop.left) || has_side_effects(e->data.binop.right);
+        case AST_INDEX: return has_side_effects(e->data.index.array) || has_side_effects(e->data.index.index);
+        default: return 0;
+    }
+}
+
+typedef struct { Reg reg; int spilled; } Temp;
+
+// Claim a temporary register, `want` or any (REG_NONE). A register already
+// in use is pushed here and restored by release_temp.
+static Temp take_temp(AsmOut *out, Reg want) {
+    Temp t;
+    if (want == REG_NONE) {
+        want = TEMP_REG(0);
+        for (int i = 0; i < NUM_TEMP_REGS; ++i) {
+            if (!(temps_busy & REG_BIT(TEMP_REG(i)))) { want = TEMP_REG(i); break; }
+        }
+    }
+    t.reg = want;
+    t.spilled = (temps_busy & REG_BIT(want)) != 0;
+    if (t.spilled) {
+        INS1(I_PUSH, x86_reg(want), "spill");
+        UPDATE_STACK_PUSH();
+    }
+    temps_busy |= REG_BIT(want);
+    return t;
+}
+
+static void release_temp(AsmOut *out, Temp t) {
+    if (t.spilled) {
+        INS1(I_POP, x86_reg(t.reg), "reload");
+        UPDATE_STACK_POP();
+    } else {
+        temps_busy &= ~REG_BIT(t.reg);
+    }
+}
+
+// Park eax in a temporary while the next operand is computed
+static Temp hold_eax(AsmOut *out, Reg want) {
+    Temp t = take_temp(out, want);
+    INS2(I_MOV, x86_reg(t.reg), EAX, NULL);
+    return t;
+}
+
+// Restore the saved registers and drop the frame; the stack is balanced
+// between statements, so the pushes are right at esp
+static void gen_frame_exit(AsmOut *out) {
+    for (int i = num_saved_regs - 1; i >= 0; --i)
+        INS1(I_POP, x86_reg(saved_regs[i]), NULL);
+    if (frame_pointer) {
+        INS2(I_MOV, ESP, EBP, NULL);
+        INS1(I_POP, EBP, NULL);
+    } else if (frame_size > 0) {
+        INS2(I_ADD, ESP, IMM(frame_size), "locals");
+    }
+}
+
+static void gen_epilogue(AsmOut *out) {
+    gen_frame_exit(out);
+    INS0(I_RET, NULL);
+}
+
+// Whether a function body calls anything, which a function without a
+// frame of its own must not do unless frame pointers are off altogether
+static int makes_calls(ASTNode *n) {
+    if (!n) return 0;
+    switch (n->type) {
+        case AST_CALL: case AST_META: return 1;
+        case AST_BLOCK:
+            for (int i = 0; i < n->data.block.statements.count; ++i)
+                if (makes_calls(n->data.block.statements.items[i])) return 1;
+            return 0;
+        case AST_STATEMENT: return makes_calls(n->data.statement.stmt);
+        case AST_IF:
+            return makes_calls(n->data.if_stmt.cond) || makes_calls(n->data.if_stmt.then_branch) ||
+                   makes_calls(n->data.if_stmt.else_branch);
+        case AST_WHILE: return makes_calls(n->data.while_stmt.cond) || makes_calls(n->data.while_stmt.body);
+        case AST_RETURN: return makes_calls(n->data.ret.expr);
+        case AST_ASSIGN: return makes_calls(n->data.assign.var) || makes_calls(n->data.assign.expr);
+        case AST_BINOP: return makes_calls(n->data.binop.left) || makes_calls(n->data.binop.right);
+        case AST_UNOP: return makes_calls(n->data.unop.expr);
+        case AST_INDEX: return makes_calls(n->data.index.array) || makes_calls(n->data.index.index);
+        default: return 0;
+    }
+}
+
+// Whether some local or register parameter has no register and needs a
+// stack slot
+static int locals_in_memory(void) {
+    for (int i = 0; i < num_frame_vars; ++i)
+        if (frame[i].offset < 0 && frame[i].reg == REG_NONE) return 1;
+    return 0;
+}
+
+static void gen_function(ASTNode *fn, AsmOut *out) {
     // Reset locals and params for each function
+    symtab_clear(&frame_vars);
+    num_frame_vars = 0;
     num_locals = 0;
-    num_params = 0;
     stack_offset = 0;
     // Add parameters first
-    add_params(fn->data.function.params);
+    if (x86_mode64)
+        add_params_sysv(&fn->data.function.params);
+    else
+        add_params(&fn->data.function.params);
     // Collect locals
     if (fn->data.function.body)
         collect_locals(fn->data.function.body);
     assign_local_offsets();
-    int locals = -stack_offset;
-    fprintf(out, ".globl %s\n", fn->data.function.name);
-    fprintf(out, "%s:\n", fn->data.function.name);
-    // Prologue (always emit, even if no locals)
-    fprintf(out, "    push ebp\n");
-    fprintf(out, "    mov ebp, esp\n");
-    fprintf(out, "    sub esp, %d " ASMEND "locals\n", locals);
+    allocate_registers(fn->data.function.body);
+    // Locals that all live in registers need no slots; a leaf function
+    // without any then needs no frame either
+    frame_size = opt_level == 0 || locals_in_memory() ? -stack_offset : 0;
+    frame_pointer = !omit_frame_pointer &&
+                    (opt_level == 0 || frame_size > 0 || makes_calls(fn->data.function.body));
+    if (frame_pointer) {
+        stack_offset = -frame_size;
+    } else {
+        // The frame base is where ebp would point, one word below the
+        // return address; the slots move up into the word ebp would take
+        for (int i = 0; i < num_frame_vars; ++i)
+            if (frame[i].offset < 0) frame[i].offset += WORD_SIZE;
+        stack_offset = WORD_SIZE - frame_size;
+    }
+    // A function the cache is to keep is buffered even at -O0
+    out->buffering = opt_level > 0 || fn_cache_capturing();
+    INS1(I_FUNC, x86_target(fn->data.function.name), NULL);
+    if (frame_pointer) {
+        INS1(I_PUSH, EBP, NULL);
+        INS2(I_MOV, EBP, ESP, NULL);
+    }
+    if (frame_size > 0 || opt_level == 0)
+        INS2(I_SUB, ESP, IMM(frame_size), "locals");
+    for (int i = 0; i < num_saved_regs; ++i) {
+        INS1(I_PUSH, x86_reg(saved_regs[i]), "callee-saved");
+        UPDATE_STACK_PUSH();
+    }
+    if (x86_mode64) gen_params_sysv(out);
+    for (int i = 0; i < num_frame_vars; ++i) {
+        if (frame[i].reg != REG_NONE && frame[i].offset > 0)
+            emit(out, I_MOV, x86_reg((Reg)frame[i].reg), FRAME_MEM(frame[i].offset), "param ", frame[i].name);
+    }
+    current_function = fn;
+    tail_calls_ok = opt_level > 0;
+    for (int i = 0; i < num_frame_vars; ++i)
+        if (frame[i].addr_taken) tail_calls_ok = 0;
+    tail_entry_label = -1;
+    if (tail_calls_ok && has_self_tail_call(fn->data.function.body, fn)) {
+        tail_entry_label = label_count++;
+        PUT_LABEL(tail_entry_label);
+    }
     int saved_stack_offset = stack_offset; // Save for epilogue
     // Body
     if (fn->data.function.body) {
@@ -257,43 +930,63 @@ static void gen_function(ASTNode *fn, FILE *out) {
         gen_stmt(fn->data.function.body, out);
         stack_offset = old_stack_offset; // Restore after body
     }
-    // Epilogue (always emit)
-    fprintf(out, "    mov esp, ebp\n");
-    fprintf(out, "    pop ebp\n");
-    fprintf(out, "    ret\n");
+    // Epilogue, unless the body cannot reach its end
+    if (opt_level == 0 || falls_through(fn->data.function.body))
+        gen_epilogue(out);
+    if (out->buffering) flush_pending(out);
     stack_offset = saved_stack_offset; // Restore for next function
 }
 
-// Helper: collect global variables from AST
+// Helper: collect global variables and function names from AST
 static void collect_globals(ASTNode *ast) {
     if (!ast) return;
     if (ast->type == AST_PROGRAM) {
-        for (ASTNodeList *l = ast->data.program.functions; l; l = l->next)
-            collect_globals(l->node);
+        for (int i = 0; i < ast->data.program.functions.count; ++i)
+            collect_globals(ast->data.program.functions.items[i]);
+    } else if (ast->type == AST_FUNCTION) {
+        symtab_insert(&function_names, ast->data.function.name, 1);
     } else if (ast->type == AST_GLOBAL) {
-        if (num_globals < MAX_GLOBALS) {
-            global_names[num_globals] = ast->data.global.name;
-            if (ast->data.global.init && ast->data.global.init->type == AST_NUM)
-                global_inits[num_globals] = ast->data.global.init->data.num.value;
-            else
-                global_inits[num_globals] = 0;
-            num_globals++;
+        // A repeated definition keeps the first one
+        if (!symtab_insert(&global_vars, ast->data.global.name, num_globals))
+            return;
+        if (num_globals == cap_globals) {
+            cap_globals = cap_globals ? cap_globals * 2 : 64;
+            globals = (Global*)realloc(globals, cap_globals * sizeof(Global));
         }
+        globals[num_globals].name = ast->data.global.name;
+        // Any constant expression will do, folded or not, at the full word
+        int64_t value = 0;
+        if (ast->data.global.init && !fold_word(ast->data.global.init, &value))
+            fprintf(stderr, "Warning: initializer of global '%s' is not a constant, using 0\n",
+                    symbol_name(ast->data.global.name));
+        globals[num_globals].init = value;
+        num_globals++;
     }
 }
 
-static void collect_strings(ASTNode *n) {
+// String literals, and in call_args what a sibling tail call may assume of
+// the caller
+static void collect_uses(ASTNode *n) {
     if (!n) return;
-    if (n->type == AST_STRING) get_string_label(n->data.string_lit.value);
-    #define RECURSE(x) collect_strings(x)
+    if (n->type == AST_STRING) {
+        get_string_label(n->data.string_lit.value);
+    } else if (n->type == AST_VAR && is_function(n->data.var.name)) {
+        symtab_set(&call_args, n->data.var.name, -1);
+    } else if (n->type == AST_CALL && n->data.call.name && is_function(n->data.call.name)) {
+        int seen = symtab_lookup(&call_args, n->data.call.name);
+        int argc = n->data.call.args.count;
+        if (seen == (int)SYMTAB_MISSING || (seen >= 0 && argc < seen))
+            symtab_set(&call_args, n->data.call.name, argc);
+    }
+    #define RECURSE(x) collect_uses(x)
     switch (n->type) {
         case AST_PROGRAM:
-            for (ASTNodeList *l = n->data.program.functions; l; l = l->next) RECURSE(l->node); break;
+            for (int i = 0; i < n->data.program.functions.count; ++i) RECURSE(n->data.program.functions.items[i]); break;
         case AST_FUNCTION:
-            for (ASTNodeList *l = n->data.function.params; l; l = l->next) RECURSE(l->node);
+            for (int i = 0; i < n->data.function.params.count; ++i) RECURSE(n->data.function.params.items[i]);
             RECURSE(n->data.function.body); break;
         case AST_BLOCK:
-            for (ASTNodeList *l = n->data.block.statements; l; l = l->next) RECURSE(l->node); break;
+            for (int i = 0; i < n->data.block.statements.count; ++i) RECURSE(n->data.block.statements.items[i]); break;
         case AST_STATEMENT:
             RECURSE(n->data.statement.stmt); break;
         case AST_IF:
@@ -309,7 +1002,7 @@ static void collect_strings(ASTNode *n) {
         case AST_UNOP:
             RECURSE(n->data.unop.expr); break;
         case AST_CALL:
-            for (ASTNodeList *l = n->data.call.args; l; l = l->next) RECURSE(l->node);
+            for (int i = 0; i < n->data.call.args.count; ++i) RECURSE(n->data.call.args.items[i]);
             if (n->data.call.left) RECURSE(n->data.call.left); break;
         case AST_INDEX:
             RECURSE(n->data.index.array); RECURSE(n->data.index.index); break;
@@ -328,210 +1021,783 @@ static int get_stack_alignment(int current_offset, int num_args) {
     return 16 - misalign;
 }
 
-static void gen_expr(ASTNode *expr, FILE *out) {
+// a[i + c] and a[i - c]: the index without its constant term, which goes
+// to *disp in bytes
+static ASTNode *split_index(ASTNode *index, int *disp) {
+    int c;
+    *disp = 0;
+    if (opt_level == 0 || index->type != AST_BINOP) return index;
+    int op = index->data.binop.op;
+    if (op != OP_ADD && op != OP_SUB) return index;
+    ASTNode *rest = index->data.binop.left;
+    if (!fold_constant(index->data.binop.right, &c)) {
+        if (op == OP_SUB || !fold_constant(rest, &c)) return index;
+        rest = index->data.binop.right;
+    }
+    if (c < -(1 << 24) || c > (1 << 24)) return index;
+    *disp = (op == OP_SUB ? -c : c) * WORD_SIZE;
+    return rest;
+}
+
+// Address the element a[i] as a memory operand built on eax. A temporary
+// the operand also needs is returned in *t (REG_NONE if none) and stays
+// taken until the caller releases it.
+static Operand gen_element(ASTNode *expr, AsmOut *out, Temp *t) {
+    ASTNode *array = expr->data.index.array;
+    Operand aop, iop, elem;
+    int disp;
+    ASTNode *index = split_index(expr->data.index.index, &disp);
+    t->reg = REG_NONE;
+    t->spilled = 0;
+    if (leaf_operand(index, &iop) && iop.kind != OPK_MEM) {
+        gen_expr(array, out);
+        if (iop.kind == OPK_IMM) return x86_mem(R_EAX, WORD_SIZE * iop.value + disp);
+        elem = x86_mem_index(R_EAX, iop.base, WORD_SIZE);
+    } else if (leaf_operand(array, &aop) && aop.kind == OPK_REG && !has_side_effects(index)) {
+        gen_expr(index, out);
+        elem = x86_mem_index(aop.base, R_EAX, WORD_SIZE);
+    } else {
+        gen_expr(array, out);
+        *t = hold_eax(out, REG_NONE);
+        gen_expr(index, out);
+        elem = x86_mem_index(t->reg, R_EAX, WORD_SIZE);
+    }
+    elem.value = disp;
+    return elem;
+}
+
+// Memory operand for the target of *p or a[i]
+static Operand gen_target(ASTNode *expr, AsmOut *out, Temp *t) {
+    Operand op;
+    t->reg = REG_NONE;
+    t->spilled = 0;
+    if (expr->type == AST_INDEX) return gen_element(expr, out, t);
+    if (expr->type == AST_UNOP && expr->data.unop.op == OP_MUL) {
+        if (leaf_operand(expr->data.unop.expr, &op) && op.kind == OPK_REG) return x86_mem(op.base, 0);
+        gen_expr(expr->data.unop.expr, out);
+        return x86_mem(R_EAX, 0);
+    }
+    gen_lvalue(expr, out);
+    return x86_mem(R_EAX, 0);
+}
+
+static void end_target(AsmOut *out, Temp t) {
+    if (t.reg != REG_NONE) release_temp(out, t);
+}
+
+static void gen_lvalue(ASTNode *expr, AsmOut *out) {
+    if (!expr) return;
+    switch (expr->type) {
+        case AST_VAR: {
+            int off = find_var_offset(expr->data.var.name);
+            if (off == 0x7fffffff) {
+                emit(out, I_LEA, EAX, x86_mem_sym(expr->data.var.name), "global ", expr->data.var.name);
+            } else {
+                emit(out, I_LEA, EAX, FRAME_MEM(off), "var ", expr->data.var.name);
+            }
+            break;
+        }
+        case AST_INDEX: {
+            Temp t;
+            Operand elem = gen_element(expr, out, &t);
+            INS2(I_LEA, EAX, elem, "array index");
+            end_target(out, t);
+            break;
+        }
+        case AST_UNOP: // address-of
+            if (expr->data.unop.op == OP_BITAND) {
+                gen_lvalue(expr->data.unop.expr, out);
+            } else if (expr->data.unop.op == OP_MUL) {
+                gen_expr(expr->data.unop.expr, out);
+                // eax now points to the address, so just pass through
+            }
+            break;
+        default:
+            // TODO: handle more lvalues
+            break;
+    }
+}
+
+// target = value; with want set the value is also left in eax
+static void gen_assign(ASTNode *target, ASTNode *value, AsmOut *out, int want) {
+    Operand src, dst;
+    Temp t;
+    if (target && target->type == AST_VAR) {
+        SymId name = target->data.var.name;
+        dst = var_operand(name);
+        if (!want && leaf_operand(value, &src) && (dst.kind == OPK_REG || src.kind != OPK_MEM)) {
+            emit(out, I_MOV, dst, src, "assign ", name);
+        } else {
+            gen_expr(value, out);
+            emit(out, I_MOV, dst, EAX, "assign ", name);
+        }
+        return;
+    }
+    if (leaf_operand(value, &src) && src.kind != OPK_MEM) {
+        // Constant or register: store it once the address is formed
+        dst = gen_target(target, out, &t);
+        INS2(I_MOV, dst, src, "assign");
+        end_target(out, t);
+        if (want) INS2(I_MOV, EAX, src, NULL);
+    } else if (!has_side_effects(value) && !has_side_effects(target)) {
+        gen_expr(value, out);
+        Temp v = hold_eax(out, REG_NONE);
+        dst = gen_target(target, out, &t);
+        INS2(I_MOV, dst, x86_reg(v.reg), "assign");
+        end_target(out, t);
+        if (want) INS2(I_MOV, EAX, x86_reg(v.reg), NULL);
+        release_temp(out, v);
+    } else {
+        // Both sides have effects: keep the address-first order
+        gen_lvalue(target, out);
+        Temp a = hold_eax(out, REG_NONE);
+        gen_expr(value, out);
+        INS2(I_MOV, x86_mem(a.reg, 0), EAX, "assign");
+        release_temp(out, a);
+    }
+}
+
+// ++x, x--, ...; with want set the result is left in eax
+static void gen_incdec(ASTNode *expr, AsmOut *out, int want) {
+    Mnemonic step = expr->data.unop.op == OP_INC ? I_INC : I_DEC;
+    const char *what = expr->data.unop.op == OP_INC ? "increment" : "decrement";
+    int postfix = expr->data.unop.is_postfix;
+    ASTNode *target = expr->data.unop.expr;
+    if (target && target->type == AST_VAR) {
+        Operand v = var_operand(target->data.var.name);
+        if (want && postfix) INS2(I_MOV, EAX, v, "original value");
+        emit(out, step, v, x86_none(), what, SYM_NONE);
+        if (want && !postfix) INS2(I_MOV, EAX, v, "new value");
+        return;
+    }
+    Temp t;
+    Operand m = gen_target(target, out, &t);
+    if (want && postfix) {
+        Temp old = take_temp(out, REG_NONE);
+        INS2(I_MOV, x86_reg(old.reg), m, "original value");
+        INS1(step, m, what);
+        INS2(I_MOV, EAX, x86_reg(old.reg), NULL);
+        release_temp(out, old);
+    } else {
+        INS1(step, m, what);
+        if (want) INS2(I_MOV, EAX, m, "new value");
+    }
+    end_target(out, t);
+}
+
+// Evaluate an expression statement, whose value is not needed
+static void gen_effect(ASTNode *expr, AsmOut *out) {
+    if (!expr) return;
+    if (expr->type == AST_ASSIGN)
+        gen_assign(expr->data.assign.var, expr->data.assign.expr, out, 0);
+    else if (expr->type == AST_UNOP && (expr->data.unop.op == OP_INC || expr->data.unop.op == OP_DEC))
+        gen_incdec(expr, out, 0);
+    else
+        gen_expr(expr, out);
+}
+
+static Mnemonic alu_mnemonic(int op) {
+    switch (op) {
+        case OP_ADD: return I_ADD;
+        case OP_SUB: return I_SUB;
+        case OP_MUL: return I_IMUL;
+        case OP_BITAND: return I_AND;
+        case OP_BITOR: return I_OR;
+        case OP_XOR: return I_XOR;
+        case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE: return I_CMP;
+        default: return I_COUNT;
+    }
+}
+
+static Mnemonic setcc_mnemonic(int op) {
+    switch (op) {
+        case OP_EQ: return I_SETE;
+        case OP_NE: return I_SETNE;
+        case OP_LT: return I_SETL;
+        case OP_GT: return I_SETG;
+        case OP_LE: return I_SETLE;
+        default: return I_SETGE;
+    }
+}
+
+static Mnemonic jcc_mnemonic(int op) {
+    switch (op) {
+        case OP_EQ: return I_JZ;
+        case OP_NE: return I_JNZ;
+        case OP_LT: return I_JL;
+        case OP_GT: return I_JG;
+        case OP_LE: return I_JLE;
+        default: return I_JGE;
+    }
+}
+
+// The comparison that gives the same answer with its operands swapped
+static int swap_compare(int op) {
+    switch (op) {
+        case OP_LT: return OP_GT;
+        case OP_GT: return OP_LT;
+        case OP_LE: return OP_GE;
+        case OP_GE: return OP_LE;
+        default: return op;
+    }
+}
+
+// The comparison that gives the opposite answer
+static int invert_compare(int op) {
+    switch (op) {
+        case OP_EQ: return OP_NE;
+        case OP_NE: return OP_EQ;
+        case OP_LT: return OP_GE;
+        case OP_GE: return OP_LT;
+        case OP_GT: return OP_LE;
+        default: return OP_GT;
+    }
+}
+
+// Bring the right operand of a shift or division into ecx and the left one
+// into eax. Returns the claimed ecx.
+static Temp gen_operands_ecx(ASTNode *left, ASTNode *right, AsmOut *out) {
+    Operand lop, rop;
+    Temp c;
+    if (leaf_operand(right, &rop)) {
+        gen_expr(left, out);
+        c = take_temp(out, R_ECX);
+        INS2(I_MOV, ECX, rop, NULL);
+    } else if (leaf_operand(left, &lop) && (lop.kind == OPK_IMM || !has_side_effects(right))) {
+        gen_expr(right, out);
+        c = take_temp(out, R_ECX);
+        INS2(I_MOV, ECX, EAX, NULL);
+        INS2(I_MOV, EAX, lop, NULL);
+    } else {
+        gen_expr(left, out);
+        c = hold_eax(out, R_ECX);
+        gen_expr(right, out);
+        INS2(I_XCHG, ECX, EAX, NULL);
+    }
+    return c;
+}
+
+static void gen_shift(ASTNode *expr, AsmOut *out) {
+    Mnemonic m = expr->data.binop.op == OP_SHL ? I_SHL : I_SHR;
+    Operand count;
+    if (leaf_operand(expr->data.binop.right, &count) && count.kind == OPK_IMM) {
+        gen_expr(expr->data.binop.left, out);
+        INS2(m, EAX, IMM(count.value & (WORD_SIZE * 8 - 1)), NULL);
+        return;
+    }
+    Temp c = gen_operands_ecx(expr->data.binop.left, expr->data.binop.right, out);
+    INS2(m, EAX, CL, NULL);
+    release_temp(out, c);
+}
+
+// Arithmetic, bitwise and relational operators. A leaf operand is used in
+// place; otherwise the left value waits in a temporary for the right one.
+// A comparison stops at the cmp and returns the relation the flags answer,
+// which is swapped when the operands went in reversed.
+static int gen_alu_flags(ASTNode *expr, AsmOut *out, Mnemonic m) {
+    ASTNode *left = expr->data.binop.left, *right = expr->data.binop.right;
+    int op = expr->data.binop.op;
+    Operand lop, rop;
+    if (leaf_operand(right, &rop)) {
+        gen_expr(left, out);
+        INS2(m, EAX, rop, NULL);
+    } else if (leaf_operand(left, &lop) && (lop.kind == OPK_IMM || !has_side_effects(right))) {
+        // Evaluate the right side first and fold the leaf into it
+        gen_expr(right, out);
+        if (m == I_SUB) {
+            INS1(I_NEG, EAX, NULL);
+            INS2(I_ADD, EAX, lop, NULL);
+        } else {
+            INS2(m, EAX, lop, NULL);
+            op = swap_compare(op);
+        }
+    } else {
+        gen_expr(left, out);
+        Temp t = hold_eax(out, REG_NONE);
+        gen_expr(right, out);
+        if (m == I_SUB || m == I_CMP) {
+            INS2(m, x86_reg(t.reg), EAX, NULL);
+            if (m == I_SUB) INS2(I_MOV, EAX, x86_reg(t.reg), NULL);
+        } else {
+            INS2(m, EAX, x86_reg(t.reg), NULL);
+        }
+        release_temp(out, t);
+    }
+    return op;
+}
+
+static void gen_alu(ASTNode *expr, AsmOut *out, Mnemonic m) {
+    int op = gen_alu_flags(expr, out, m);
+    if (m == I_CMP) {
+        INS1(setcc_mnemonic(op), AL, NULL);
+        INS2(I_MOVZX, EAX, AL, "relational result");
+    }
+}
+
+// --- Strength reduction ---
+// Multiplication and division by a constant avoid imul and idiv where a
+// cheaper sequence computes the same word: shifts and lea for powers of two
+// and small factors, and for other divisors a multiply by a fixed-point
+// reciprocal (Hacker's Delight, chapter 10). Quotients still truncate
+// toward zero and remainders take the sign of the dividend, as with idiv.
+
+// k if v is 2^k, else -1
+static int exact_log2(unsigned v) {
+    if (v == 0 || (v & (v - 1))) return -1;
+    int k = 0;
+    while (v >>= 1) k++;
+    return k;
+}
+
+// eax *= c with lea, shl and neg when c is +-{1, 3, 5, 9} * 2^k
+static int gen_multiply_const(AsmOut *out, int c) {
+    unsigned u = c < 0 ? 0u - (unsigned)c : (unsigned)c;
+    int k = 0;
+    while (u > 1 && !(u & 1)) { u >>= 1; k++; }
+    if (u != 1 && u != 3 && u != 5 && u != 9) return 0;
+    if (u != 1) INS2(I_LEA, EAX, x86_mem_index(R_EAX, R_EAX, u - 1), NULL);
+    if (k) INS2(I_SHL, EAX, IMM(k), NULL);
+    if (c < 0) INS1(I_NEG, EAX, NULL);
+    return 1;
+}
+
+static void gen_multiply(ASTNode *expr, AsmOut *out) {
+    ASTNode *left = expr->data.binop.left, *right = expr->data.binop.right;
+    int c;
+    if (opt_level > 0) {
+        if (fold_constant(right, &c)) {
+            gen_expr(left, out);
+            if (gen_multiply_const(out, c)) return;
+            INS2(I_IMUL, EAX, IMM(c), NULL);
+            return;
+        }
+        if (fold_constant(left, &c) && !has_side_effects(right)) {
+            gen_expr(right, out);
+            if (gen_multiply_const(out, c)) return;
+            INS2(I_IMUL, EAX, IMM(c), NULL);
+            return;
+        }
+    }
+    gen_alu(expr, out, I_IMUL);
+}
+
+// Magic multiplier and shift for signed 32-bit division by d, |d| >= 2
+static void division_magic(int d, int *multiplier, int *shift) {
+    const unsigned two31 = 0x80000000u;
+    unsigned ad = d < 0 ? 0u - (unsigned)d : (unsigned)d;
+    unsigned t = two31 + ((unsigned)d >> 31);
+    unsigned anc = t - 1 - t % ad;     // |nc|, the largest multiple of d minus 1
+    unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned q2 = two31 / ad, r2 = two31 - q2 * ad;
+    unsigned delta;
+    int p = 31;
+    do {
+        p++;
+        q1 *= 2; r1 *= 2;
+        if (r1 >= anc) { q1++; r1 -= anc; }
+        q2 *= 2; r2 *= 2;
+        if (r2 >= ad) { q2++; r2 -= ad; }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *multiplier = (int)(q2 + 1);
+    if (d < 0) *multiplier = -*multiplier;
+    *shift = p - 32;
+}
+
+// eax = x / d for the dividend in register x, using edx (32-bit words)
+static void gen_magic_quotient(AsmOut *out, Reg x, int d) {
+    int m, s;
+    division_magic(d, &m, &s);
+    INS2(I_MOV, EAX, IMM(m), "reciprocal");
+    INS1(I_IMUL, x86_reg(x), NULL);
+    if (d > 0 && m < 0) INS2(I_ADD, x86_reg(R_EDX), x86_reg(x), NULL);
+    if (d < 0 && m > 0) INS2(I_SUB, x86_reg(R_EDX), x86_reg(x), NULL);
+    if (s) INS2(I_SAR, x86_reg(R_EDX), IMM(s), NULL);
+    // Round toward zero: add one when the quotient is negative
+    INS2(I_MOV, EAX, x86_reg(R_EDX), NULL);
+    INS2(I_SHR, EAX, IMM(31), NULL);
+    INS2(I_ADD, EAX, x86_reg(R_EDX), NULL);
+}
+
+// x / c or x % c for a constant c; returns 0 to leave it to idiv
+static int gen_divide_const(ASTNode *expr, AsmOut *out, int c) {
+    int mod = expr->data.binop.op == OP_MOD;
+    unsigned abs_c = c < 0 ? 0u - (unsigned)c : (unsigned)c;
+    int k = exact_log2(abs_c);
+    if (c == 0 || c == INT_MIN) return 0;
+    if (abs_c == 1) {
+        gen_expr(expr->data.binop.left, out);
+        if (mod) INS2(I_MOV, EAX, IMM(0), NULL);
+        else if (c < 0) INS1(I_NEG, EAX, NULL);
+        return 1;
+    }
+    if (k > 0) {
+        // A negative dividend is biased by |c| - 1 so the shift truncates
+        gen_expr(expr->data.binop.left, out);
+        Temp d = take_temp(out, R_EDX);
+        INS0(I_CDQ, NULL);
+        INS2(I_AND, x86_reg(R_EDX), IMM((int)abs_c - 1), NULL);
+        INS2(I_ADD, EAX, x86_reg(R_EDX), NULL);
+        if (mod) {
+            INS2(I_AND, EAX, IMM((int)abs_c - 1), NULL);
+            INS2(I_SUB, EAX, x86_reg(R_EDX), NULL);
+        } else {
+            INS2(I_SAR, EAX, IMM(k), NULL);
+            if (c < 0) INS1(I_NEG, EAX, NULL);
+        }
+        release_temp(out, d);
+        return 1;
+    }
+    // The reciprocal is computed for 32-bit words only
+    if (x86_mode64) return 0;
+    gen_expr(expr->data.binop.left, out);
+    Temp d = take_temp(out, R_EDX);
+    Temp x = hold_eax(out, REG_NONE);
+    gen_magic_quotient(out, x.reg, c);
+    if (mod) {
+        INS2(I_IMUL, EAX, IMM(c), NULL);
+        INS2(I_SUB, x86_reg(x.reg), EAX, NULL);
+        INS2(I_MOV, EAX, x86_reg(x.reg), NULL);
+    }
+    release_temp(out, x);
+    release_temp(out, d);
+    return 1;
+}
+
+static void gen_divide(ASTNode *expr, AsmOut *out) {
+    Operand divisor;
+    Temp c = { REG_NONE, 0 };
+    int value;
+    if (opt_level > 0 && fold_constant(expr->data.binop.right, &value) && gen_divide_const(expr, out, value))
+        return;
+    if (leaf_operand(expr->data.binop.right, &divisor) && divisor.kind != OPK_IMM) {
+        gen_expr(expr->data.binop.left, out);
+    } else {
+        c = gen_operands_ecx(expr->data.binop.left, expr->data.binop.right, out);
+        divisor = ECX;
+    }
+    // idiv takes its dividend from edx:eax and leaves the remainder in edx
+    Temp d = take_temp(out, R_EDX);
+    INS0(I_CDQ, NULL);
+    INS1(I_IDIV, divisor, NULL);
+    if (expr->data.binop.op == OP_MOD) INS2(I_MOV, EAX, x86_reg(R_EDX), "remainder");
+    release_temp(out, d);
+    end_target(out, c);
+}
+
+// Jump to `label` when cond is true (jump_if != 0) or false, and fall through
+// otherwise. Comparisons branch on the cmp flags and && / || send each operand
+// straight to its target, so no 0/1 value is ever built.
+static void gen_branch(ASTNode *cond, int jump_if, int label, AsmOut *out) {
+    int value;
+    if (fold_constant(cond, &value)) {
+        if ((value != 0) == (jump_if != 0))
+            INS1(I_JMP, LABEL(label), NULL);
+        return;
+    }
+    if (cond->type == AST_UNOP && cond->data.unop.op == OP_NOT) {
+        gen_branch(cond->data.unop.expr, !jump_if, label, out);
+        return;
+    }
+    if (cond->type == AST_BINOP) {
+        int op = cond->data.binop.op;
+        if (op == OP_AND || op == OP_OR) {
+            // a && b jumps on false from either side but needs both for true;
+            // a || b is the mirror image
+            int on_left = op == OP_OR;
+            if (jump_if == on_left) {
+                gen_branch(cond->data.binop.left, jump_if, label, out);
+                gen_branch(cond->data.binop.right, jump_if, label, out);
+            } else {
+                int l_skip = label_count++;
+                gen_branch(cond->data.binop.left, on_left, l_skip, out);
+                gen_branch(cond->data.binop.right, jump_if, label, out);
+                PUT_LABEL(l_skip);
+            }
+            return;
+        }
+        if (alu_mnemonic(op) == I_CMP) {
+            op = gen_alu_flags(cond, out, I_CMP);
+            INS1(jcc_mnemonic(jump_if ? op : invert_compare(op)), LABEL(label), NULL);
+            return;
+        }
+    }
+    gen_expr(cond, out);
+    INS2(I_TEST, EAX, EAX, NULL);
+    INS1(jump_if ? I_JNZ : I_JZ, LABEL(label), NULL);
+}
+
+// The temporaries are caller-saved: park any live one across a call
+static unsigned save_temps(AsmOut *out) {
+    unsigned live = temps_busy;
+    for (int i = 0; i < NUM_TEMP_REGS; ++i) {
+        if (live & REG_BIT(TEMP_REG(i))) {
+            INS1(I_PUSH, x86_reg(TEMP_REG(i)), "save across call");
+            UPDATE_STACK_PUSH();
+        }
+    }
+    temps_busy = 0;
+    return live;
+}
+
+static void restore_temps(AsmOut *out, unsigned live) {
+    temps_busy = live;
+    for (int i = NUM_TEMP_REGS - 1; i >= 0; --i) {
+        if (live & REG_BIT(TEMP_REG(i))) {
+            INS1(I_POP, x86_reg(TEMP_REG(i)), NULL);
+            UPDATE_STACK_POP();
+        }
+    }
+}
+
+static void gen_call(ASTNode *expr, AsmOut *out) {
+    if (x86_mode64) {
+        gen_call_sysv(expr, out);
+        return;
+    }
+    unsigned live = save_temps(out);
+    int argc = expr->data.call.args.count;
+    for (int j = argc-1; j >= 0; --j) {
+        ASTNode *arg = expr->data.call.args.items[j];
+        Operand op;
+        if (leaf_operand(arg, &op)) {
+            INS1(I_PUSH, op, "arg");
+        } else {
+            gen_expr(arg, out);
+            INS1(I_PUSH, EAX, "arg");
+        }
+        UPDATE_STACK_PUSH();
+    }
+    if (expr->data.call.name) {
+        INS1(I_CALL, x86_target(expr->data.call.name), NULL);
+    } else if (expr->data.call.left) {
+        gen_expr(expr->data.call.left, out);
+        INS1(I_CALL, EAX, "indirect call");
+    } else {
+        INS0(I_COMMENT, " invalid call node");
+    }
+    int cleanup = argc * 4;
+    if (cleanup > 0) {
+        INS2(I_ADD, ESP, IMM(cleanup), "cleanup args+align");
+        UPDATE_STACK_ADD(cleanup);
+    }
+    restore_temps(out, live);
+}
+
+// --- Tail calls ---
+// Once the arguments of `return f(args)` are evaluated the frame is not
+// needed any more, unless a pointer into it may still be around. A call of
+// the function itself stores them in its own parameters and jumps back past
+// the prologue. Another callee gets its arguments in this function's
+// argument slots (registers for x86-64) and is jumped to after the epilogue,
+// so it returns to our caller. B callers may leave off trailing arguments,
+// so on x86 a slot is only ours to write if every call in the program
+// pushes it, which is not known for a function whose address is taken or
+// that is called only from outside, like main.
+
+// Argument words every caller of fn is known to push
+static int args_pushed(ASTNode *fn) {
+    int n = symtab_lookup(&call_args, fn->data.function.name);
+    return n == (int)SYMTAB_MISSING || n < 0 ? 0 : n;
+}
+
+static int is_param(SymId name) {
+    ASTNodeList *params = &current_function->data.function.params;
+    for (int i = 0; i < params->count; ++i)
+        if (params->items[i]->data.var.name == name) return 1;
+    return 0;
+}
+
+// Parameters a self tail call may store into: those in registers, and on
+// x86 the slots every caller pushes
+static int params_writable(ASTNode *fn) {
+    if (x86_mode64) return 1;
+    ASTNodeList *params = &fn->data.function.params;
+    for (int j = args_pushed(fn); j < params->count; ++j)
+        if (var_operand(params->items[j]->data.var.name).kind == OPK_MEM) return 0;
+    return 1;
+}
+
+static int is_self_call(ASTNode *e, ASTNode *fn) {
+    return e && e->type == AST_CALL && e->data.call.name == fn->data.function.name &&
+           e->data.call.args.count == fn->data.function.params.count && params_writable(fn);
+}
+
+static int has_self_tail_call(ASTNode *s, ASTNode *fn) {
+    if (!s) return 0;
+    switch (s->type) {
+        case AST_BLOCK:
+            for (int i = 0; i < s->data.block.statements.count; ++i)
+                if (has_self_tail_call(s->data.block.statements.items[i], fn)) return 1;
+            return 0;
+        case AST_IF:
+            return has_self_tail_call(s->data.if_stmt.then_branch, fn) || has_self_tail_call(s->data.if_stmt.else_branch, fn);
+        case AST_WHILE: return has_self_tail_call(s->data.while_stmt.body, fn);
+        case AST_RETURN: return is_self_call(s->data.ret.expr, fn);
+        default: return 0;
+    }
+}
+
+// Evaluate the arguments of a call right to left and store argument j in
+// dest[j]. Values that need code, and parameters a store could overwrite,
+// wait on the stack until every argument is done; constants and other
+// variables are stored last unless an evaluation could change them.
+static void gen_args_to(ASTNode *call, const Operand *dest, AsmOut *out) {
+    ASTNodeList *args = &call->data.call.args;
+    int keep_order = 0;
+    for (int j = 0; j < args->count; ++j) keep_order |= has_side_effects(args->items[j]);
+    unsigned pushed = 0;
+    for (int j = args->count - 1; j >= 0; --j) {
+        ASTNode *arg = args->items[j];
+        Operand op;
+        if (leaf_operand(arg, &op)) {
+            if (!keep_order && !(arg->type == AST_VAR && is_param(arg->data.var.name))) continue;
+            INS1(I_PUSH, op, "arg");
+        } else {
+            gen_expr(arg, out);
+            INS1(I_PUSH, EAX, "arg");
+        }
+        UPDATE_STACK_PUSH();
+        pushed |= 1u << j;
+    }
+    for (int j = 0; j < args->count; ++j) {
+        if (!(pushed & (1u << j))) continue;
+        if (dest[j].kind == OPK_REG) {
+            INS1(I_POP, dest[j], "arg");
+            UPDATE_STACK_POP();
+        } else {
+            INS1(I_POP, EAX, "arg");
+            UPDATE_STACK_POP();
+            INS2(I_MOV, dest[j], EAX, NULL);
+        }
+    }
+    for (int j = 0; j < args->count; ++j) {
+        Operand op;
+        if ((pushed & (1u << j)) || !leaf_operand(args->items[j], &op)) continue;
+        if (op.kind == OPK_MEM && dest[j].kind == OPK_MEM) {
+            INS2(I_MOV, EAX, op, NULL);
+            op = EAX;
+        }
+        INS2(I_MOV, dest[j], op, "arg");
+    }
+}
+
+// Code for `return e` if e is a call that can reuse the frame
+static int gen_tail_call(ASTNode *e, AsmOut *out) {
+    if (!tail_calls_ok || !e || e->type != AST_CALL || (!e->data.call.name && !e->data.call.left)) return 0;
+    ASTNodeList *params = &current_function->data.function.params;
+    int argc = e->data.call.args.count;
+    Operand dest[32];
+    if (argc > 32) return 0;
+    if (is_self_call(e, current_function)) {
+        for (int j = 0; j < argc; ++j) dest[j] = var_operand(params->items[j]->data.var.name);
+        gen_args_to(e, dest, out);
+        INS1(I_JMP, LABEL(tail_entry_label), "tail call");
+        return 1;
+    }
+    if (x86_mode64) return gen_tail_call_sysv(e, out);
+    if (argc > args_pushed(current_function)) return 0;
+    ASTNode *callee = e->data.call.name ? NULL : e->data.call.left;
+    if (callee) {
+        // The callee is evaluated first here, which only matters with effects
+        for (int j = 0; j < argc; ++j)
+            if (has_side_effects(e->data.call.args.items[j])) return 0;
+        if (has_side_effects(callee)) return 0;
+        gen_expr(callee, out);
+        INS1(I_PUSH, EAX, "callee");
+        UPDATE_STACK_PUSH();
+    }
+    for (int j = 0; j < argc; ++j) dest[j] = FRAME_MEM(8 + 4 * j);
+    gen_args_to(e, dest, out);
+    if (callee) {
+        INS1(I_POP, ECX, "callee");
+        UPDATE_STACK_POP();
+    }
+    gen_frame_exit(out);
+    INS1(I_JMP, callee ? ECX : x86_target(e->data.call.name), "tail call");
+    return 1;
+}
+
+static void gen_expr(ASTNode *expr, AsmOut *out) {
     if (!expr) return;
     switch (expr->type) {
         case AST_NUM:
-            fprintf(out, "    mov eax, %d\n", expr->data.num.value);
+            INS2(I_MOV, EAX, IMM(expr->data.num.value), NULL);
             break;
         case AST_VAR: {
-            if (is_function_name(expr->data.var.name, top_level_funcs)) {
-                fprintf(out, "    lea eax, [%s] " ASMEND "function pointer\n", expr->data.var.name);
+            SymId name = expr->data.var.name;
+            if (is_function(name)) {
+                INS2(I_LEA, EAX, x86_mem_sym(name), "function pointer");
             } else {
-                int off = find_var_offset(expr->data.var.name);
-                if (off == 0x7fffffff) {
-                    fprintf(out, "    mov eax, [%s] " ASMEND "global %s\n", expr->data.var.name, expr->data.var.name);
-                } else {
-                    fprintf(out, "    mov eax, [ebp%+d] " ASMEND "var %s\n", off, expr->data.var.name);
-                }
+                emit(out, I_MOV, EAX, var_operand(name), var_note(name), name);
             }
             break;
         }
         case AST_INDEX: {
-            gen_lvalue(expr, out);
-            fprintf(out, "    mov eax, [eax] " ASMEND "load array element\n");
+            Temp t;
+            Operand elem = gen_element(expr, out, &t);
+            INS2(I_MOV, EAX, elem, "load array element");
+            end_target(out, t);
             break;
         }
         case AST_UNOP:
-            if (strcmp(expr->data.unop.op, "!") == 0) {
+            if (expr->data.unop.op == OP_NOT) {
                 gen_expr(expr->data.unop.expr, out);
-                fprintf(out, "    cmp eax, 0\n");
-                fprintf(out, "    sete al\n");
-                fprintf(out, "    movzx eax, al " ASMEND "logical not\n");
-            } else if (strcmp(expr->data.unop.op, "*") == 0) {
+                INS2(I_CMP, EAX, IMM(0), NULL);
+                INS1(I_SETE, AL, NULL);
+                INS2(I_MOVZX, EAX, AL, "logical not");
+            } else if (expr->data.unop.op == OP_SUB) {
                 gen_expr(expr->data.unop.expr, out);
-                fprintf(out, "    mov eax, [eax] " ASMEND "deref\n");
-            } else if (strcmp(expr->data.unop.op, "&") == 0) {
+                INS1(I_NEG, EAX, "negate");
+            } else if (expr->data.unop.op == OP_MUL) {
+                Temp t;
+                Operand m = gen_target(expr, out, &t);
+                INS2(I_MOV, EAX, m, "deref");
+                end_target(out, t);
+            } else if (expr->data.unop.op == OP_BITAND) {
                 gen_lvalue(expr->data.unop.expr, out);
-            } else if (strcmp(expr->data.unop.op, "++") == 0) {
-                if (expr->data.unop.is_postfix) {
-                    // Postfix: save original value, increment, return original
-                    gen_lvalue(expr->data.unop.expr, out);
-                    fprintf(out, "    mov ebx, eax " ASMEND "save address\n");
-                    fprintf(out, "    mov eax, [ebx] " ASMEND "load original value\n");
-                    fprintf(out, "    push eax " ASMEND "save original value\n");
-                    fprintf(out, "    inc dword ptr [ebx] " ASMEND "increment\n");
-                    fprintf(out, "    pop eax " ASMEND "return original value\n");
-                } else {
-                    // Prefix: increment first, then return new value
-                    gen_lvalue(expr->data.unop.expr, out);
-                    fprintf(out, "    inc dword ptr [eax] " ASMEND "increment\n");
-                    fprintf(out, "    mov eax, [eax] " ASMEND "return new value\n");
-                }
-            } else if (strcmp(expr->data.unop.op, "--") == 0) {
-                if (expr->data.unop.is_postfix) {
-                    // Postfix: save original value, decrement, return original
-                    gen_lvalue(expr->data.unop.expr, out);
-                    fprintf(out, "    mov ebx, eax " ASMEND "save address\n");
-                    fprintf(out, "    mov eax, [ebx] " ASMEND "load original value\n");
-                    fprintf(out, "    push eax " ASMEND "save original value\n");
-                    fprintf(out, "    dec dword ptr [ebx] " ASMEND "decrement\n");
-                    fprintf(out, "    pop eax " ASMEND "return original value\n");
-                } else {
-                    // Prefix: decrement first, then return new value
-                    gen_lvalue(expr->data.unop.expr, out);
-                    fprintf(out, "    dec dword ptr [eax] " ASMEND "decrement\n");
-                    fprintf(out, "    mov eax, [eax] " ASMEND "return new value\n");
-                }
+            } else if (expr->data.unop.op == OP_INC || expr->data.unop.op == OP_DEC) {
+                gen_incdec(expr, out, 1);
             } else {
                 // TODO: handle other unary ops
             }
             break;
-        case AST_BINOP:
-            if (strcmp(expr->data.binop.op, "+") == 0 || strcmp(expr->data.binop.op, "-") == 0 ||
-                strcmp(expr->data.binop.op, "*") == 0 || strcmp(expr->data.binop.op, "/") == 0 ||
-                strcmp(expr->data.binop.op, "<<") == 0 || strcmp(expr->data.binop.op, ">>") == 0) {
-                gen_expr(expr->data.binop.left, out);
-                fprintf(out, "    push eax\n");
-                gen_expr(expr->data.binop.right, out);
-                fprintf(out, "    mov ebx, eax\n");
-                fprintf(out, "    pop eax\n");
-                if (strcmp(expr->data.binop.op, "+") == 0) {
-                    fprintf(out, "    add eax, ebx\n");
-                } else if (strcmp(expr->data.binop.op, "-") == 0) {
-                    fprintf(out, "    sub eax, ebx\n");
-                } else if (strcmp(expr->data.binop.op, "*") == 0) {
-                    fprintf(out, "    imul eax, ebx\n");
-                } else if (strcmp(expr->data.binop.op, "/") == 0) {
-                    fprintf(out, "    cdq\n");
-                    fprintf(out, "    idiv ebx\n");
-                } else if (strcmp(expr->data.binop.op, "<<") == 0) {
-                    fprintf(out, "    mov cl, bl\n");
-                    fprintf(out, "    shl eax, cl\n");
-                } else if (strcmp(expr->data.binop.op, ">>") == 0) {
-                    fprintf(out, "    mov cl, bl\n");
-                    fprintf(out, "    shr eax, cl\n");
-                }
-            } else if (strcmp(expr->data.binop.op, "&") == 0 || strcmp(expr->data.binop.op, "|") == 0 || strcmp(expr->data.binop.op, "^") == 0) {
-                gen_expr(expr->data.binop.left, out);
-                fprintf(out, "    push eax\n");
-                gen_expr(expr->data.binop.right, out);
-                fprintf(out, "    mov ebx, eax\n");
-                fprintf(out, "    pop eax\n");
-                if (strcmp(expr->data.binop.op, "&") == 0) {
-                    fprintf(out, "    and eax, ebx\n");
-                } else if (strcmp(expr->data.binop.op, "|") == 0) {
-                    fprintf(out, "    or eax, ebx\n");
-                } else if (strcmp(expr->data.binop.op, "^") == 0) {
-                    fprintf(out, "    xor eax, ebx\n");
-                }
-            } else if (
-                strcmp(expr->data.binop.op, "==") == 0 || strcmp(expr->data.binop.op, "!=") == 0 ||
-                strcmp(expr->data.binop.op, "<") == 0 || strcmp(expr->data.binop.op, ">") == 0 ||
-                strcmp(expr->data.binop.op, "<=") == 0 || strcmp(expr->data.binop.op, ">=") == 0) {
-                gen_expr(expr->data.binop.left, out);
-                fprintf(out, "    push eax\n");
-                gen_expr(expr->data.binop.right, out);
-                fprintf(out, "    mov ebx, eax\n");
-                fprintf(out, "    pop eax\n");
-                fprintf(out, "    cmp eax, ebx\n");
-                if (strcmp(expr->data.binop.op, "==") == 0) {
-                    fprintf(out, "    sete al\n");
-                } else if (strcmp(expr->data.binop.op, "!=") == 0) {
-                    fprintf(out, "    setne al\n");
-                } else if (strcmp(expr->data.binop.op, "<") == 0) {
-                    fprintf(out, "    setl al\n");
-                } else if (strcmp(expr->data.binop.op, ">") == 0) {
-                    fprintf(out, "    setg al\n");
-                } else if (strcmp(expr->data.binop.op, "<=") == 0) {
-                    fprintf(out, "    setle al\n");
-                } else if (strcmp(expr->data.binop.op, ">=") == 0) {
-                    fprintf(out, "    setge al\n");
-                }
-                fprintf(out, "    movzx eax, al " ASMEND "relational result\n");
-            } else if (strcmp(expr->data.binop.op, "&&") == 0) {
+        case AST_BINOP: {
+            int op = expr->data.binop.op;
+            Mnemonic m = alu_mnemonic(op);
+            if (op == OP_MUL) {
+                gen_multiply(expr, out);
+            } else if (m != I_COUNT) {
+                gen_alu(expr, out, m);
+            } else if (op == OP_DIV || op == OP_MOD) {
+                gen_divide(expr, out);
+            } else if (op == OP_SHL || op == OP_SHR) {
+                gen_shift(expr, out);
+            } else if (op == OP_AND || op == OP_OR) {
                 int l_false = label_count++;
                 int l_end = label_count++;
-                gen_expr(expr->data.binop.left, out);
-                fprintf(out, "    test eax, eax\n");
-                fprintf(out, "    jz .L%d\n", l_false);
-                gen_expr(expr->data.binop.right, out);
-                fprintf(out, "    test eax, eax\n");
-                fprintf(out, "    jz .L%d\n", l_false);
-                fprintf(out, "    mov eax, 1\n");
-                fprintf(out, "    jmp .L%d\n", l_end);
-                fprintf(out, ".L%d:\n", l_false);
-                fprintf(out, "    mov eax, 0\n");
-                fprintf(out, ".L%d:\n", l_end);
-            } else if (strcmp(expr->data.binop.op, "||") == 0) {
-                int l_true = label_count++;
-                int l_end = label_count++;
-                gen_expr(expr->data.binop.left, out);
-                fprintf(out, "    test eax, eax\n");
-                fprintf(out, "    jnz .L%d\n", l_true);
-                gen_expr(expr->data.binop.right, out);
-                fprintf(out, "    test eax, eax\n");
-                fprintf(out, "    jnz .L%d\n", l_true);
-                fprintf(out, "    mov eax, 0\n");
-                fprintf(out, "    jmp .L%d\n", l_end);
-                fprintf(out, ".L%d:\n", l_true);
-                fprintf(out, "    mov eax, 1\n");
-                fprintf(out, ".L%d:\n", l_end);
+                gen_branch(expr, 0, l_false, out);
+                INS2(I_MOV, EAX, IMM(1), NULL);
+                INS1(I_JMP, LABEL(l_end), NULL);
+                PUT_LABEL(l_false);
+                INS2(I_MOV, EAX, IMM(0), NULL);
+                PUT_LABEL(l_end);
             } else {
                 // TODO: handle other binary ops
             }
             break;
+        }
         case AST_CHAR:
-            fprintf(out, "    mov eax, %d " ASMEND "char literal\n", (unsigned char)expr->data.char_lit.value);
+            INS2(I_MOV, EAX, IMM((unsigned char)expr->data.char_lit.value), "char literal");
             break;
-        case AST_STRING: {
-            const char *label = get_string_label(expr->data.string_lit.value);
-            fprintf(out, "    lea eax, [%s] " ASMEND "string literal\n", label);
+        case AST_STRING:
+            INS2(I_LEA, EAX, x86_mem_sym(get_string_label(expr->data.string_lit.value)), "string literal");
             break;
-        }
-        case AST_CALL: {
-            int argc = 0;
-            for (ASTNodeList *l = expr->data.call.args; l; l = l->next) argc++;
-            ASTNodeList *args[64];
-            int i = 0;
-            for (ASTNodeList *l = expr->data.call.args; l; l = l->next) args[i++] = l;
-
-            for (int j = argc-1; j >= 0; --j) {
-                gen_expr(args[j]->node, out);
-                fprintf(out, "    push eax " ASMEND "arg %d\n", j);
-                UPDATE_STACK_PUSH();
-            }
-            if (expr->data.call.name) {
-                fprintf(out, "    call %s\n", expr->data.call.name);
-            } else if (expr->data.call.left) {
-                gen_expr(expr->data.call.left, out);
-                fprintf(out, "    call eax " ASMEND "indirect call\n");
-            } else {
-                fprintf(out, "; invalid call node\n");
-            }
-            int cleanup = argc * 4;
-            if (cleanup > 0) {
-                fprintf(out, "    add esp, %d #cleanup args+align\n", cleanup);
-                UPDATE_STACK_ADD(cleanup);
-            }
+        case AST_CALL:
+            gen_call(expr, out);
             break;
-        }
         case AST_ASSIGN:
-            gen_lvalue(expr->data.assign.var, out);
-            fprintf(out, "    push eax " ASMEND "save lvalue addr\n");
-            gen_expr(expr->data.assign.expr, out);
-            fprintf(out, "    pop ebx " ASMEND "restore lvalue addr\n");
-            fprintf(out, "    mov [ebx], eax " ASMEND "assign\n");
+            gen_assign(expr->data.assign.var, expr->data.assign.expr, out, 1);
             break;
         default:
             // TODO: handle more expressions
@@ -539,100 +1805,124 @@ static void gen_expr(ASTNode *expr, FILE *out) {
     }
 }
 
-// Loop label stack for break/continue
-#define MAX_LOOP_DEPTH 16
-static int break_labels[MAX_LOOP_DEPTH];
-static int continue_labels[MAX_LOOP_DEPTH];
+// Loop label stack for break/continue. The inliner nests a callee's loops
+// inside the caller's, so there is no fixed depth
+static int *break_labels = NULL;
+static int *continue_labels = NULL;
+static int cap_break_labels = 0;
+static int cap_continue_labels = 0;
 static int loop_depth = 0;
 
-static void gen_stmt(ASTNode *stmt, FILE *out) {
+static void gen_stmt(ASTNode *stmt, AsmOut *out) {
     if (!stmt) return;
     switch (stmt->type) {
         case AST_BLOCK:
-            for (ASTNodeList *l = stmt->data.block.statements; l; l = l->next)
-                gen_stmt(l->node, out);
+            for (int i = 0; i < stmt->data.block.statements.count; ++i)
+                gen_stmt(stmt->data.block.statements.items[i], out);
             break;
         case AST_VAR_DECL:
             // Variable declaration: no code needed, but emit a comment for clarity
-            fprintf(out, ASMEND "    %s variable declaration\n", stmt->data.var_decl.name);
+            emit(out, I_COMMENT, x86_none(), x86_none(), "    auto ", stmt->data.var_decl.name);
             break;
         case AST_ASSIGN:
-            gen_lvalue(stmt->data.assign.var, out);
-            fprintf(out, "    push eax " ASMEND "save lvalue addr\n");
-            gen_expr(stmt->data.assign.expr, out);
-            fprintf(out, "    pop ebx " ASMEND "restore lvalue addr\n");
-            fprintf(out, "    mov [ebx], eax " ASMEND "assign\n");
+            gen_assign(stmt->data.assign.var, stmt->data.assign.expr, out, 0);
             break;
         case AST_IF: {
             int l_else = label_count++;
             int l_end = label_count++;
-            gen_expr(stmt->data.if_stmt.cond, out);
-            fprintf(out, "    test eax, eax\n");
-            fprintf(out, "    jz .L%d\n", l_else);
+            gen_branch(stmt->data.if_stmt.cond, 0, l_else, out);
             gen_stmt(stmt->data.if_stmt.then_branch, out);
-            fprintf(out, "    jmp .L%d\n", l_end);
-            fprintf(out, ".L%d:\n", l_else);
+            if (stmt->data.if_stmt.else_branch && (opt_level == 0 || falls_through(stmt->data.if_stmt.then_branch)))
+                INS1(I_JMP, LABEL(l_end), NULL);
+            PUT_LABEL(l_else);
             if (stmt->data.if_stmt.else_branch)
                 gen_stmt(stmt->data.if_stmt.else_branch, out);
-            fprintf(out, ".L%d:\n", l_end);
+            PUT_LABEL(l_end);
             break;
         }
         case AST_WHILE: {
             int l_cond = label_count++;
             int l_end = label_count++;
             // Push loop labels
+            break_labels = (int*)grow_vec(break_labels, &cap_break_labels, loop_depth + 1, sizeof(int));
+            continue_labels = (int*)grow_vec(continue_labels, &cap_continue_labels, loop_depth + 1, sizeof(int));
             break_labels[loop_depth] = l_end;
             continue_labels[loop_depth] = l_cond;
             loop_depth++;
-            fprintf(out, ".L%d:\n", l_cond);
-            gen_expr(stmt->data.while_stmt.cond, out);
-            fprintf(out, "    test eax, eax\n");
-            fprintf(out, "    jz .L%d\n", l_end);
-            gen_stmt(stmt->data.while_stmt.body, out);
-            fprintf(out, "    jmp .L%d\n", l_cond);
-            fprintf(out, ".L%d:\n", l_end);
+            if (opt_level > 0) {
+                // Rotated: one branch per iteration, with the test repeated
+                // at entry unless the loop optimizer knows it holds there
+                int l_top = label_count++;
+                if (!stmt->data.while_stmt.entered)
+                    gen_branch(stmt->data.while_stmt.cond, 0, l_end, out);
+                PUT_LABEL(l_top);
+                gen_stmt(stmt->data.while_stmt.body, out);
+                PUT_LABEL(l_cond);
+                gen_branch(stmt->data.while_stmt.cond, 1, l_top, out);
+            } else {
+                PUT_LABEL(l_cond);
+                gen_branch(stmt->data.while_stmt.cond, 0, l_end, out);
+                gen_stmt(stmt->data.while_stmt.body, out);
+                INS1(I_JMP, LABEL(l_cond), NULL);
+            }
+            PUT_LABEL(l_end);
             // Pop loop labels
             loop_depth--;
             break;
         }
         case AST_BREAK:
             if (loop_depth > 0) {
-                fprintf(out, "    jmp .L%d " ASMEND "break\n", break_labels[loop_depth-1]);
+                INS1(I_JMP, LABEL(break_labels[loop_depth-1]), "break");
             } else {
-                fprintf(out, "; break outside loop (ignored)\n");
+                INS0(I_COMMENT, " break outside loop (ignored)");
             }
             break;
         case AST_CONTINUE:
             if (loop_depth > 0) {
-                fprintf(out, "    jmp .L%d " ASMEND "continue\n", continue_labels[loop_depth-1]);
+                INS1(I_JMP, LABEL(continue_labels[loop_depth-1]), "continue");
             } else {
-                fprintf(out, "; continue outside loop (ignored)\n");
+                INS0(I_COMMENT, " continue outside loop (ignored)");
             }
             break;
         case AST_RETURN:
             if (stmt->data.ret.expr) {
+                if (gen_tail_call(stmt->data.ret.expr, out)) break;
                 gen_expr(stmt->data.ret.expr, out);
-                fprintf(out, "    mov esp, ebp\n");
-                fprintf(out, "    pop ebp\n");
-                fprintf(out, "    ret\n");
+                gen_epilogue(out);
             }
             break;
         case AST_LABEL:
-            fprintf(out, ".L_%s:\n", stmt->data.label.label);
+            INS1(I_LABEL, x86_user_label(stmt->data.label.label), NULL);
             break;
         case AST_GOTO:
-            fprintf(out, "    jmp .L_%s " ASMEND "goto\n", stmt->data.go.label);
+            INS1(I_JMP, x86_user_label(stmt->data.go.label), "goto");
             break;
         case AST_STATEMENT:
-            gen_expr(stmt->data.statement.stmt, out);
+            gen_effect(stmt->data.statement.stmt, out);
             break;
         case AST_META:
+            if (measuring) break;
             // Handle meta construct by sending to as_jit.c for evaluation
-            fprintf(out, ASMEND " Start of Meta construct\n");//, stmt->data.meta.content);
-            // Call the meta evaluation function
-            evaluate_meta_construct(stmt->data.meta.content);
-            fprintf(out, "\n");
-            fprintf(out, ASMEND " End of Meta construct\n");
+            INS0(I_COMMENT, " Start of Meta construct");
+            // Call the meta evaluation function; it runs its own generate_x86,
+            // so park our global-scope tables until it is done
+            {
+                GlobalScope outer;
+                int outer_frame_pointer = frame_pointer, outer_frame_size = frame_size;
+                int outer_stack_offset = stack_offset;
+                memset(&outer, 0, sizeof(outer));
+                swap_global_scope(&outer);
+                // Keep our output ordered with whatever the meta program prints
+                if (!out->code) emit_flush(out);
+                evaluate_meta_construct(stmt->data.meta.content);
+                fflush(stdout);
+                swap_global_scope(&outer);
+                free_global_scope(&outer);
+                frame_pointer = outer_frame_pointer;
+                frame_size = outer_frame_size;
+                stack_offset = outer_stack_offset;
+            }
+            INS0(I_COMMENT, " End of Meta construct");
             break;
         default:
             // TODO: handle more statements
@@ -640,36 +1930,110 @@ static void gen_stmt(ASTNode *stmt, FILE *out) {
     }
 }
 
-// Emit .data section for globals before functions
-void generate_x86(ASTNode *ast, FILE *out) {
+static void gen_items(ASTNode *ast, AsmOut *out) {
+    if (!ast) return;
+    if (ast->type == AST_PROGRAM) {
+        for (int i = 0; i < ast->data.program.functions.count; ++i) {
+            ASTNode *item = ast->data.program.functions.items[i];
+            if (item->type == AST_FUNCTION && !fn_cache_lookup(item, out))
+                gen_function(item, out);
+            else if (item->type == AST_META && !measuring)
+                gen_stmt(item, out);
+        }
+    } else if (ast->type == AST_FUNCTION) {
+        if (!fn_cache_lookup(ast, out)) gen_function(ast, out);
+    } else {
+        INS0(I_COMMENT, " x86 code generation expects a program or function node");
+    }
+}
+
+// Fill the program-wide tables the walk relies on
+static void collect_program(ASTNode *ast) {
+    symtab_clear(&global_vars);
+    symtab_clear(&function_names);
+    symtab_clear(&call_args);
+    symtab_clear(&string_ids);
     num_globals = 0;
     num_strings = 0;
     collect_globals(ast);
-    collect_strings(ast);
+    collect_uses(ast);
+}
+
+// Emit .data section for globals before functions
+static void gen_program(ASTNode *ast, AsmOut *out) {
+    collect_program(ast);
     // Emit .intel_syntax noprefix at the top
-    fprintf(out, ".intel_syntax noprefix\n");
+    EMIT(out, ".intel_syntax noprefix\n");
     // Add security section to mark stack as non-executable
-    fprintf(out, ".section .note.GNU-stack,\"\",@progbits\n");
-    fprintf(out, ".text\n");
+    EMIT(out, ".section .note.GNU-stack,\"\",@progbits\n");
+    EMIT(out, ".text\n");
     if (num_globals > 0 || num_strings > 0) {
-        fprintf(out, ".data\n");
+        EMIT(out, ".data\n");
         for (int i = 0; i < num_globals; ++i) {
-            fprintf(out, "%s: .long %d\n", global_names[i], global_inits[i]);
+            emit_name(out, globals[i].name);
+            emit_str(out, x86_mode64 ? ": .quad " : ": .long ");
+            emit_int(out, globals[i].init);
+            EMIT(out, "\n");
         }
         emit_string_literals(out);
-        fprintf(out, ".text\n");
+        EMIT(out, ".text\n");
     }
-    if (!ast) return;
-    if (ast->type == AST_PROGRAM) {
-        for (ASTNodeList *l = ast->data.program.functions; l; l = l->next) {
-            if (l->node->type == AST_FUNCTION)
-                gen_function(l->node, out);
-            else if (l->node->type == AST_META)
-                gen_stmt(l->node, out);
-        }
-    } else if (ast->type == AST_FUNCTION) {
-        gen_function(ast, out);
-    } else {
-        fprintf(out, "; x86 code generation expects a program or function node\n");
+    gen_items(ast, out);
+}
+
+void generate_x86(ASTNode *ast, FILE *file) {
+    AsmOut out;
+    memset(&out, 0, sizeof(out));
+    out.buf = (char*)malloc(ASM_BUF_SIZE);
+    if (!out.buf) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    out.fd = fileno(file);
+    out.compact = asm_compact;
+    fflush(file); // anything already written through stdio goes first
+    gen_program(ast, &out);
+    emit_flush(&out);
+    free(out.buf);
+    free(out.pending);
+}
+
+int generate_x86_code(ASTNode *ast, MCode *mc) {
+    AsmOut out;
+    memset(&out, 0, sizeof(out));
+    memset(mc, 0, sizeof(*mc));
+    out.code = mc;
+    out.label_base = label_count;
+    collect_program(ast);
+    // Globals and string literals go to the data block, in .data order
+    for (int i = 0; i < num_globals; ++i) {
+        int64_t init = globals[i].init;
+        mcode_symbol(mc, globals[i].name, mc->data_size, 1);
+        mcode_data(mc, &init, WORD_SIZE);   // little-endian: the low half first
+    }
+    for (int i = 0; i < num_strings; ++i) {
+        const char *s = symbol_name(string_literals[i]);
+        mcode_symbol(mc, string_label(i), mc->data_size, 1);
+        mcode_data(mc, s, (int)strlen(s) + 1);
     }
-} 
\ No newline at end of file
+    gen_items(ast, &out);
+    int rc = resolve_label_fixups(&out);
+    free(out.label_offsets);
+    free(out.user_labels.slots);
+    free(out.fixups);
+    free(out.pending);
+    if (rc != 0) mcode_free(mc);
+    return rc;
+}
+
+// Bytes of code and data the program compiles to, without running its meta
+// blocks, for reporting what an optimization saved
+long x86_program_size(ASTNode *ast) {
+    MCode mc;
+    int saved_label_count = label_count;
+    measuring = 1;
+    int rc = generate_x86_code(ast, &mc);
+    measuring = 0;
+    label_count = saved_label_count;
+    if (rc != 0) return 0;
+    long size = (long)mc.code_size + mc.data_size;
+    mcode_free(&mc);
+    return size;
+}
@@ -0,0 +1,415 @@
+// --- Per-function compilation cache ---
+// With -fcache-dir=DIR every function gen_function compiles leaves its final
+// instruction stream, after the peephole optimizer, in a file of DIR. The
+// file is named by a hash of everything the code depends on: the function's
+// AST as the AST passes left it, whether each name it mentions is a global or
+// a function, the code generation flags and the compiler build. A later
+// compile that finds the file replays the instructions into the sink instead
+// of allocating registers and walking the tree again. Both sinks take the
+// same Insns, so one entry serves -S and the meta JIT alike.
+//
+// Entries hold label numbers relative to the function's first label, and
+// string literals by their text, since both are numbered program-wide. The
+// whole key is stored as well and compared on a hit, so a hash collision
+// costs a recompile, not wrong code. Functions containing a meta block run
+// it while they compile and are never cached.
+#include <sys/stat.h>
+
+const char *fn_cache_dir = NULL;
+FnCacheStats fn_cache_stats;
+
+#define FN_CACHE_MAGIC "BFC1"
+
+// Growable byte buffer for keys and entries
+typedef struct {
+    unsigned char *bytes;
+    int len, cap;
+} ByteBuf;
+
+static void buf_put(ByteBuf *b, const void *p, int n) {
+    b->bytes = (unsigned char*)grow_vec(b->bytes, &b->cap, b->len + n, 1);
+    memcpy(b->bytes + b->len, p, n);
+    b->len += n;
+}
+
+static void buf_byte(ByteBuf *b, int v) {
+    unsigned char c = (unsigned char)v;
+    buf_put(b, &c, 1);
+}
+
+static void buf_int(ByteBuf *b, int v) { buf_put(b, &v, sizeof(v)); }
+
+static void buf_text(ByteBuf *b, const char *s, int len) {
+    buf_int(b, len);
+    buf_put(b, s, len);
+}
+
+static uint64_t fnv1a64(const unsigned char *p, size_t n, uint64_t h) {
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+#define FNV64_BASIS 14695981039346656037ull
+
+uint64_t cache_hash(const void *p, size_t n) {
+    return fnv1a64((const unsigned char*)p, n, FNV64_BASIS);
+}
+
+// Identifies the running compiler: a hash of its executable, or of the time
+// it was built where /proc is not available
+const char *b_build_id(void) {
+    static char id[17];
+    if (id[0]) return id;
+    uint64_t h = FNV64_BASIS;
+    FILE *f = fopen("/proc/self/exe", "rb");
+    if (f) {
+        unsigned char chunk[64 * 1024];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) h = fnv1a64(chunk, n, h);
+        fclose(f);
+    } else {
+        static const char built[] = __DATE__ " " __TIME__;
+        h = fnv1a64((const unsigned char*)built, sizeof(built) - 1, h);
+    }
+    snprintf(id, sizeof(id), "%016llx", (unsigned long long)h);
+    return id;
+}
+
+// --- Keys ---
+typedef struct {
+    ByteBuf buf;
+    int cacheable;
+} CacheKey;
+
+static void key_name(CacheKey *k, SymId name) {
+    buf_text(&k->buf, symbol_name(name) ? symbol_name(name) : "", (int)symbol_length(name));
+    if (name) buf_byte(&k->buf, is_global(name) | is_function(name) << 1);
+}
+
+static void key_node(CacheKey *k, const ASTNode *n);
+
+static void key_list(CacheKey *k, const ASTNodeList *l) {
+    buf_int(&k->buf, l->count);
+    for (int i = 0; i < l->count; ++i) key_node(k, l->items[i]);
+}
+
+static void key_node(CacheKey *k, const ASTNode *n) {
+    if (!n) { buf_byte(&k->buf, 0xff); return; }
+    buf_byte(&k->buf, n->type);
+    switch (n->type) {
+        case AST_FUNCTION:
+            key_name(k, n->data.function.name);
+            key_list(k, &n->data.function.params);
+            key_node(k, n->data.function.body);
+            break;
+        case AST_BLOCK: key_list(k, &n->data.block.statements); break;
+        case AST_STATEMENT: key_node(k, n->data.statement.stmt); break;
+        case AST_IF:
+            key_node(k, n->data.if_stmt.cond);
+            key_node(k, n->data.if_stmt.then_branch);
+            key_node(k, n->data.if_stmt.else_branch);
+            break;
+        case AST_WHILE:
+            buf_byte(&k->buf, n->data.while_stmt.entered);
+            key_node(k, n->data.while_stmt.cond);
+            key_node(k, n->data.while_stmt.body);
+            break;
+        case AST_RETURN: key_node(k, n->data.ret.expr); break;
+        case AST_ASSIGN:
+            key_node(k, n->data.assign.var);
+            key_node(k, n->data.assign.expr);
+            break;
+        case AST_BINOP:
+            buf_byte(&k->buf, n->data.binop.op);
+            key_node(k, n->data.binop.left);
+            key_node(k, n->data.binop.right);
+            break;
+        case AST_UNOP:
+            buf_byte(&k->buf, n->data.unop.op);
+            buf_byte(&k->buf, n->data.unop.is_postfix);
+            key_node(k, n->data.unop.expr);
+            break;
+        case AST_CALL:
+            key_name(k, n->data.call.name);
+            key_list(k, &n->data.call.args);
+            key_node(k, n->data.call.left);
+            break;
+        case AST_VAR: key_name(k, n->data.var.name); break;
+        case AST_NUM: buf_int(&k->buf, n->data.num.value); break;
+        case AST_CHAR: buf_byte(&k->buf, n->data.char_lit.value); break;
+        case AST_STRING:
+            buf_text(&k->buf, n->data.string_lit.value, (int)strlen(n->data.string_lit.value));
+            break;
+        case AST_EXTERN:
+            key_name(k, n->data.ext.name);
+            buf_byte(&k->buf, n->data.ext.is_func);
+            break;
+        case AST_INDEX:
+            key_node(k, n->data.index.array);
+            key_node(k, n->data.index.index);
+            break;
+        case AST_LABEL: key_name(k, n->data.label.label); break;
+        case AST_GOTO: key_name(k, n->data.go.label); break;
+        case AST_VAR_DECL: key_name(k, n->data.var_decl.name); break;
+        case AST_META: k->cacheable = 0; break;
+        default: break;
+    }
+}
+
+static void make_key(CacheKey *k, ASTNode *fn) {
+    memset(k, 0, sizeof(*k));
+    k->cacheable = 1;
+    buf_put(&k->buf, FN_CACHE_MAGIC, 4);
+    buf_put(&k->buf, b_build_id(), 16);
+    buf_byte(&k->buf, x86_mode64);
+    buf_byte(&k->buf, opt_level);
+    buf_byte(&k->buf, omit_frame_pointer);
+    // Sibling calls depend on how the rest of the program calls fn
+    buf_int(&k->buf, args_pushed(fn));
+    key_node(k, fn);
+}
+
+static void key_path(const CacheKey *k, char *path, size_t size) {
+    uint64_t h = cache_hash(k->buf.bytes, (size_t)k->buf.len);
+    snprintf(path, size, "%s/%016llx.bfc", fn_cache_dir, (unsigned long long)h);
+}
+
+// --- Entries ---
+// "BFC1", the key, the number of labels, a table of names and the
+// instructions; operands and notes refer to names by 1-based index.
+enum { NAME_SYMBOL, NAME_STRING };
+
+// The function being compiled after a miss, to store once it is final
+static struct {
+    int armed;
+    CacheKey key;
+    int first_label;
+} capture;
+
+static int fn_cache_capturing(void) { return capture.armed; }
+
+// Index of the string literal sym names, or -1
+static int string_index(SymId sym) {
+    const char *s = symbol_name(sym);
+    if (strncmp(s, "str", 3) != 0 || !isdigit((unsigned char)s[3])) return -1;
+    int index = atoi(s + 3);
+    return index < num_strings && string_label(index) == sym ? index : -1;
+}
+
+typedef struct {
+    ByteBuf names;
+    int count;
+    SymTable seen;   // text id * 2 + kind -> index
+} NameTable;
+
+static int name_ref(NameTable *t, SymId text, int kind) {
+    int index = symtab_lookup(&t->seen, text * 2 + kind);
+    if (index != (int)SYMTAB_MISSING) return index;
+    index = ++t->count;
+    symtab_insert(&t->seen, text * 2 + kind, index);
+    buf_byte(&t->names, kind);
+    buf_text(&t->names, symbol_name(text), (int)symbol_length(text));
+    return index;
+}
+
+static int sym_ref(NameTable *t, SymId sym) {
+    if (!sym) return 0;
+    int index = string_index(sym);
+    return index >= 0 ? name_ref(t, string_literals[index], NAME_STRING) : name_ref(t, sym, NAME_SYMBOL);
+}
+
+// Returns 0 if the operand names a label the function did not allocate
+static int put_operand_entry(ByteBuf *b, NameTable *t, const Operand *o, int num_labels) {
+    int value = o->value;
+    if (o->kind == OPK_LABEL && !o->sym) {
+        value -= capture.first_label;
+        if (value < 0 || value >= num_labels) return 0;
+    }
+    buf_byte(b, o->kind);
+    buf_byte(b, o->base);
+    buf_byte(b, o->index);
+    buf_byte(b, o->scale);
+    buf_int(b, value);
+    buf_int(b, sym_ref(t, o->sym));
+    return 1;
+}
+
+static void write_entry(const char *path, const ByteBuf *entry) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return;
+    int ok = fwrite(entry->bytes, 1, entry->len, f) == (size_t)entry->len;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) remove(tmp);
+}
+
+// Keep the instructions of the function a miss armed the capture for
+static void fn_cache_store(const Insn *code, int n) {
+    capture.armed = 0;
+    int num_labels = label_count - capture.first_label;
+    NameTable names;
+    ByteBuf insns;
+    memset(&names, 0, sizeof(names));
+    memset(&insns, 0, sizeof(insns));
+    int ok = 1;
+    for (int i = 0; i < n && ok; ++i) {
+        buf_byte(&insns, code[i].op);
+        ok = put_operand_entry(&insns, &names, &code[i].dst, num_labels) &&
+             put_operand_entry(&insns, &names, &code[i].src, num_labels);
+        buf_int(&insns, code[i].note ? name_ref(&names, intern_name(code[i].note, strlen(code[i].note)), NAME_SYMBOL) : 0);
+        buf_int(&insns, sym_ref(&names, code[i].note_sym));
+    }
+    if (ok) {
+        ByteBuf entry;
+        memset(&entry, 0, sizeof(entry));
+        buf_put(&entry, FN_CACHE_MAGIC, 4);
+        buf_int(&entry, capture.key.buf.len);
+        buf_put(&entry, capture.key.buf.bytes, capture.key.buf.len);
+        buf_int(&entry, num_labels);
+        buf_int(&entry, names.count);
+        buf_put(&entry, names.names.bytes, names.names.len);
+        buf_int(&entry, n);
+        buf_put(&entry, insns.bytes, insns.len);
+        char path[4096];
+        key_path(&capture.key, path, sizeof(path));
+        mkdir(fn_cache_dir, 0777);
+        write_entry(path, &entry);
+        free(entry.bytes);
+    }
+    free(names.names.bytes);
+    free(names.seen.slots);
+    free(insns.bytes);
+    free(capture.key.buf.bytes);
+}
+
+// Bounds-checked reads from a loaded entry
+typedef struct {
+    const unsigned char *p, *end;
+} Reader;
+
+static int read_bytes(Reader *r, void *dst, int n) {
+    if (n < 0 || r->end - r->p < n) return 0;
+    memcpy(dst, r->p, n);
+    r->p += n;
+    return 1;
+}
+
+static int read_int(Reader *r, int *v) { return read_bytes(r, v, sizeof(*v)); }
+
+static int read_operand(Reader *r, const SymId *syms, int num_names, int base, Operand *o) {
+    unsigned char head[4];
+    int sym;
+    if (!read_bytes(r, head, 4) || !read_int(r, &o->value) || !read_int(r, &sym)) return 0;
+    if (sym < 0 || sym > num_names) return 0;
+    o->kind = head[0];
+    o->base = head[1];
+    o->index = head[2];
+    o->scale = head[3];
+    o->sym = syms[sym];
+    if (o->kind == OPK_LABEL && !o->sym) o->value += base;
+    return 1;
+}
+
+// Decode an entry for key into instructions, with labels from base on.
+// Returns the instruction count, or -1 if the entry is not for this key or
+// is damaged.
+static int decode_entry(Reader *r, const CacheKey *key, int base, int *num_labels, Insn **code) {
+    char magic[4];
+    int key_len, num_names, n;
+    if (!read_bytes(r, magic, 4) || memcmp(magic, FN_CACHE_MAGIC, 4) != 0) return -1;
+    if (!read_int(r, &key_len) || key_len != key->buf.len || r->end - r->p < key_len ||
+        memcmp(r->p, key->buf.bytes, key_len) != 0)
+        return -1;
+    r->p += key_len;
+    if (!read_int(r, num_labels) || *num_labels < 0 || !read_int(r, &num_names) || num_names < 0 ||
+        num_names > r->end - r->p)
+        return -1;
+    SymId *syms = (SymId*)malloc((num_names + 1) * sizeof(SymId));
+    syms[0] = SYM_NONE;
+    int ok = 1;
+    for (int i = 1; i <= num_names && ok; ++i) {
+        unsigned char kind;
+        int len;
+        ok = read_bytes(r, &kind, 1) && read_int(r, &len) && len >= 0 && r->end - r->p >= len;
+        if (!ok) break;
+        syms[i] = intern_name((const char*)r->p, (size_t)len);
+        if (kind == NAME_STRING) syms[i] = get_string_label(symbol_name(syms[i]));
+        r->p += len;
+    }
+    n = -1;
+    if (ok && read_int(r, &n) && n >= 0 && n <= r->end - r->p) {
+        *code = (Insn*)malloc((n ? n : 1) * sizeof(Insn));
+        for (int i = 0; i < n && ok; ++i) {
+            Insn *in = &(*code)[i];
+            unsigned char op;
+            int note, note_sym;
+            ok = read_bytes(r, &op, 1) && op < I_COUNT &&
+                 read_operand(r, syms, num_names, base, &in->dst) &&
+                 read_operand(r, syms, num_names, base, &in->src) &&
+                 read_int(r, &note) && note >= 0 && note <= num_names &&
+                 read_int(r, &note_sym) && note_sym >= 0 && note_sym <= num_names;
+            if (!ok) break;
+            in->op = op;
+            in->note = note ? symbol_name(syms[note]) : NULL;
+            in->note_sym = syms[note_sym];
+        }
+        if (!ok || r->p != r->end) {
+            free(*code);
+            n = -1;
+        }
+    }
+    free(syms);
+    return n;
+}
+
+static int load_file(const char *path, unsigned char **data, long *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    int ok = fseek(f, 0, SEEK_END) == 0 && (*size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0;
+    *data = ok ? (unsigned char*)malloc(*size ? *size : 1) : NULL;
+    ok = ok && fread(*data, 1, *size, f) == (size_t)*size;
+    fclose(f);
+    if (!ok) free(*data);
+    return ok;
+}
+
+// Emit fn from the cache if it is there. On a miss, arm the capture so
+// flush_pending stores the function gen_function is about to compile.
+static int fn_cache_lookup(ASTNode *fn, AsmOut *out) {
+    if (!fn_cache_dir || measuring) return 0;
+    CacheKey key;
+    make_key(&key, fn);
+    if (!key.cacheable) {
+        fn_cache_stats.skipped++;
+        free(key.buf.bytes);
+        return 0;
+    }
+    char path[4096];
+    key_path(&key, path, sizeof(path));
+    unsigned char *data;
+    long size;
+    int n = -1, num_labels = 0;
+    Insn *code = NULL;
+    if (load_file(path, &data, &size)) {
+        Reader r = { data, data + size };
+        n = decode_entry(&r, &key, label_count, &num_labels, &code);
+        free(data);
+    }
+    if (n < 0) {
+        fn_cache_stats.misses++;
+        capture.armed = 1;
+        capture.key = key;
+        capture.first_label = label_count;
+        return 0;
+    }
+    fn_cache_stats.hits++;
+    label_count += num_labels;
+    for (int i = 0; i < n; ++i) emit_insn(out, &code[i]);
+    free(code);
+    free(key.buf.bytes);
+    return 1;
+}
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "x86.h"
+
+// Peephole optimizer over one function's instructions. Each rule looks at
+// a short run of instructions starting at some position and rewrites it in
+// place. A removed instruction is turned into a blank comment (no note) and
+// dropped at the end, so indices into the function stay valid meanwhile.
+
+typedef struct {
+    Insn *code;
+    int n;
+    int *label_at;         // .L<label_min + k> -> index, -1 if not here
+    int *label_seen;       // .L<label_min + k> -> last query that reached it
+    int label_min, num_labels, cap_labels, cap_seen;
+    int query;
+} Peephole;
+
+#define BIT(r) (1u << (r))
+#define LIVE_BUDGET 64     // instructions a liveness query may look at
+
+static int is_blank(const Insn *in) {
+    return in->op == I_COMMENT && !in->note && !in->note_sym;
+}
+
+static void kill(Insn *in) {
+    in->op = I_COMMENT;
+    in->note = NULL;
+    in->note_sym = SYM_NONE;
+}
+
+// Next instruction after i that is not a comment, or n
+static int next_insn(const Peephole *ph, int i) {
+    for (++i; i < ph->n && ph->code[i].op == I_COMMENT; ++i) {}
+    return i;
+}
+
+static int same_operand(const Operand *a, const Operand *b) {
+    return a->kind == b->kind && a->base == b->base && a->index == b->index &&
+           a->scale == b->scale && a->value == b->value && a->sym == b->sym;
+}
+
+static int is_reg(const Operand *o, Reg r) { return o->kind == OPK_REG && o->base == r; }
+
+static int is_cond_jump(int op) { return op == I_JZ || op == I_JNZ || (op >= I_JL && op <= I_JGE); }
+
+// Whether two operands can be the dst and src of one mov or ALU instruction
+static int pair_encodable(const Operand *dst, const Operand *src) {
+    if (dst->kind == OPK_IMM) return 0;
+    return !(dst->kind == OPK_MEM && src->kind == OPK_MEM);
+}
+
+// --- Register liveness ---
+
+static unsigned operand_regs(const Operand *o) {
+    unsigned m = 0;
+    if (o->kind == OPK_REG || o->kind == OPK_REG8) m |= BIT(o->base);
+    if (o->kind == OPK_MEM) {
+        if (o->base != REG_NONE) m |= BIT(o->base);
+        if (o->index != REG_NONE) m |= BIT(o->index);
+    }
+    return m;
+}
+
+// Registers used by a memory operand's address
+static unsigned address_regs(const Operand *o) {
+    return o->kind == OPK_MEM ? operand_regs(o) : 0;
+}
+
+// Registers an instruction reads (*use) and fully overwrites (*def)
+static void insn_regs(const Insn *in, unsigned *use, unsigned *def) {
+    unsigned d = operand_regs(&in->dst), s = operand_regs(&in->src);
+    unsigned dst_reg = in->dst.kind == OPK_REG ? d : 0;
+    *use = 0;
+    *def = 0;
+    switch (in->op) {
+        case I_MOV: case I_MOVZX: case I_LEA: case I_POP:
+            // Writing a byte register keeps the rest of it
+            *use = s | address_regs(&in->dst) | (in->dst.kind == OPK_REG8 ? d : 0);
+            *def = dst_reg;
+            break;
+        case I_CMP: case I_TEST: case I_PUSH:
+            *use = d | s;
+            break;
+        case I_CALL:
+            *use = d | s;
+            *def = BIT(R_EAX) | BIT(R_ECX) | BIT(R_EDX);
+            if (x86_mode64) {
+                // Register arguments and al in, everything caller-saved out
+                *use |= BIT(R_EAX) | BIT(R_ECX) | BIT(R_EDX) | BIT(R_ESI) | BIT(R_EDI) | BIT(R_R8) | BIT(R_R9);
+                *def |= BIT(R_ESI) | BIT(R_EDI) | BIT(R_R8) | BIT(R_R9) | BIT(R_R10) | BIT(R_R11);
+            }
+            break;
+        case I_CDQ:
+            *use = BIT(R_EAX);
+            *def = BIT(R_EDX);
+            break;
+        case I_IDIV:
+            *use = d | BIT(R_EAX) | BIT(R_EDX);
+            *def = BIT(R_EAX) | BIT(R_EDX);
+            break;
+        case I_IMUL:
+            if (in->src.kind != OPK_NONE) {
+                *use = d | s;
+                break;
+            }
+            // One operand: edx:eax = eax * dst
+            *use = d | BIT(R_EAX);
+            *def = BIT(R_EAX) | BIT(R_EDX);
+            break;
+        case I_RET:
+            // The result and the registers the caller expects back
+            if (x86_mode64)
+                *use = BIT(R_EAX) | BIT(R_EBX) | BIT(R_EBP) | BIT(R_R12) | BIT(R_R13) | BIT(R_R14) | BIT(R_R15);
+            else
+                *use = BIT(R_EAX) | BIT(R_EBX) | BIT(R_ESI) | BIT(R_EDI) | BIT(R_EBP);
+            break;
+        case I_XOR:
+            // xor r, r only clears r
+            if (dst_reg && same_operand(&in->dst, &in->src)) {
+                *def = dst_reg;
+                break;
+            }
+            *use = d | s;
+            break;
+        default:
+            // Read-modify-write: ALU ops, shifts, neg, inc, dec, xchg, setcc
+            *use = d | s;
+            *def = 0;
+            break;
+    }
+}
+
+static void index_labels(Peephole *ph) {
+    int lo = 0, hi = -1;
+    for (int i = 0; i < ph->n; ++i) {
+        const Insn *in = &ph->code[i];
+        if (in->op != I_LABEL || in->dst.sym) continue;
+        if (hi < lo) lo = hi = in->dst.value;
+        if (in->dst.value < lo) lo = in->dst.value;
+        if (in->dst.value > hi) hi = in->dst.value;
+    }
+    ph->label_min = lo;
+    ph->num_labels = hi - lo + 1;
+    ph->label_at = (int*)grow_vec(ph->label_at, &ph->cap_labels, ph->num_labels, sizeof(int));
+    ph->label_seen = (int*)grow_vec(ph->label_seen, &ph->cap_seen, ph->num_labels, sizeof(int));
+    for (int k = 0; k < ph->num_labels; ++k) ph->label_at[k] = -1;
+    memset(ph->label_seen, 0, (size_t)ph->num_labels * sizeof(int));
+    ph->query = 0;
+    for (int i = 0; i < ph->n; ++i) {
+        const Insn *in = &ph->code[i];
+        if (in->op == I_LABEL && !in->dst.sym) ph->label_at[in->dst.value - lo] = i;
+    }
+}
+
+// Index of the label a branch operand names, or -1
+static int label_index(const Peephole *ph, const Operand *target) {
+    if (target->kind != OPK_LABEL) return -1;
+    if (target->sym) {
+        for (int i = 0; i < ph->n; ++i) {
+            const Insn *in = &ph->code[i];
+            if (in->op == I_LABEL && in->dst.sym == target->sym) return i;
+        }
+        return -1;
+    }
+    int k = target->value - ph->label_min;
+    return k >= 0 && k < ph->num_labels ? ph->label_at[k] : -1;
+}
+
+// Whether any register in mask may be read before being overwritten when
+// execution reaches index i. Unknown control flow counts as a use. Each
+// label is followed once per query; a path that comes back to it adds
+// nothing new.
+static int live_at(Peephole *ph, int i, unsigned mask, int *budget) {
+    for (; i < ph->n; ++i) {
+        const Insn *in = &ph->code[i];
+        if (in->op == I_COMMENT) continue;
+        if (in->op == I_LABEL) {
+            if (in->dst.sym) continue;
+            int *seen = &ph->label_seen[in->dst.value - ph->label_min];
+            if (*seen == ph->query) return 0;
+            *seen = ph->query;
+            continue;
+        }
+        if (--*budget < 0) return 1;
+        if (in->op == I_JMP || is_cond_jump(in->op)) {
+            int target = label_index(ph, &in->dst);
+            if (target < 0) return 1;
+            if (in->op == I_JMP) {
+                i = target - 1;
+                continue;
+            }
+            if (live_at(ph, target, mask, budget)) return 1;
+            continue;
+        }
+        unsigned use, def;
+        insn_regs(in, &use, &def);
+        if (use & mask) return 1;
+        mask &= ~def;
+        if (!mask) return 0;
+        if (in->op == I_RET || in->op == I_FUNC) return 0;
+    }
+    return 1;
+}
+
+static int dead_after(Peephole *ph, int i, Reg r) {
+    int budget = LIVE_BUDGET;
+    ph->query++;
+    return !live_at(ph, i + 1, BIT(r), &budget);
+}
+
+// --- Rules ---
+// Each returns 1 if it rewrote the code at i.
+
+// mov r, r
+static int rule_self_move(Peephole *ph, int i) {
+    Insn *a = &ph->code[i];
+    if (a->op != I_MOV || a->dst.kind != OPK_REG || !same_operand(&a->dst, &a->src)) return 0;
+    kill(a);
+    return 1;
+}
+
+// mov A, B; mov B, A: the second copies a value already there
+static int rule_store_reload(Peephole *ph, int i) {
+    Insn *a = &ph->code[i];
+    int j = next_insn(ph, i);
+    if (a->op != I_MOV || j >= ph->n) return 0;
+    Insn *b = &ph->code[j];
+    if (b->op != I_MOV || !same_operand(&a->dst, &b->src) || !same_operand(&a->src, &b->dst)) return 0;
+    if (a->dst.kind == OPK_REG8 || a->src.kind == OPK_IMM) return 0;
+    // mov eax, [eax] changes the address the store would go to
+    if (a->dst.kind == OPK_REG && (address_regs(&a->src) & BIT(a->dst.base))) return 0;
+    kill(b);
+    return 1;
+}
+
+// push X; pop Y -> mov Y, X
+static int rule_push_pop(Peephole *ph, int i) {
+    Insn *a = &ph->code[i];
+    int j = next_insn(ph, i);
+    if (a->op != I_PUSH || j >= ph->n || ph->code[j].op != I_POP) return 0;
+    Insn *b = &ph->code[j];
+    if (!pair_encodable(&b->dst, &a->dst)) return 0;
+    if (b->dst.kind == OPK_MEM && (address_regs(&b->dst) & BIT(R_ESP))) return 0;
+    if (a->dst.kind == OPK_MEM && (address_regs(&a->dst) & BIT(R_ESP))) return 0;
+    if (same_operand(&a->dst, &b->dst)) {
+        kill(b);
+    } else {
+        b->op = I_MOV;
+        b->src = a->dst;
+    }
+    kill(a);
+    return 1;
+}
+
+// jmp L where L is among the labels that follow
+static int rule_jump_to_next(Peephole *ph, int i) {
+    Insn *a = &ph->code[i];
+    if (a->op != I_JMP || a->dst.kind != OPK_LABEL) return 0;
+    for (int j = i + 1; j < ph->n; ++j) {
+        const Insn *in = &ph->code[j];
+        if (in->op == I_COMMENT) continue;
+        if (in->op != I_LABEL) return 0;
+        if (same_operand(&in->dst, &a->dst)) {
+            kill(a);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// setcc al; movzx eax, al; test eax, eax; jz/jnz L -> jcc L, when the 0/1
+// value is not needed on either path
+static int rule_setcc_branch(Peephole *ph, int i) {
+    static const Mnemonic jump_if[] = { I_JZ, I_JNZ, I_JL, I_JG, I_JLE, I_JGE };
+    static const Mnemonic jump_unless[] = { I_JNZ, I_JZ, I_JGE, I_JLE, I_JG, I_JL };
+    Insn *set = &ph->code[i];
+    if (set->op < I_SETE || set->op > I_SETGE || set->dst.kind != OPK_REG8 || set->dst.base != R_EAX) return 0;
+    int j = next_insn(ph, i), k = next_insn(ph, j), l = next_insn(ph, k);
+    if (l >= ph->n) return 0;
+    Insn *zx = &ph->code[j], *test = &ph->code[k], *jump = &ph->code[l];
+    if (zx->op != I_MOVZX || !is_reg(&zx->dst, R_EAX) || zx->src.kind != OPK_REG8 || zx->src.base != R_EAX) return 0;
+    if (test->op != I_TEST || !is_reg(&test->dst, R_EAX) || !is_reg(&test->src, R_EAX)) return 0;
+    if (jump->op != I_JZ && jump->op != I_JNZ) return 0;
+    if (!dead_after(ph, l, R_EAX)) return 0;
+    int cc = set->op - I_SETE;
+    jump->op = (unsigned char)(jump->op == I_JZ ? jump_unless[cc] : jump_if[cc]);
+    kill(set);
+    kill(zx);
+    kill(test);
+    return 1;
+}
+
+// mov eax, X; cmp eax, Y -> cmp X, Y
+static int rule_compare_direct(Peephole *ph, int i) {
+    Insn *a = &ph->code[i];
+    int j = next_insn(ph, i);
+    if (a->op != I_MOV || !is_reg(&a->dst, R_EAX) || j >= ph->n) return 0;
+    Insn *b = &ph->code[j];
+    if (b->op != I_CMP || !is_reg(&b->dst, R_EAX) || (operand_regs(&b->src) & BIT(R_EAX))) return 0;
+    if (!pair_encodable(&a->src, &b->src) || !dead_after(ph, j, R_EAX)) return 0;
+    b->dst = a->src;
+    kill(a);
+    return 1;
+}
+
+// mov eax, X; mov Y, eax -> mov Y, X
+static int rule_move_through_eax(Peephole *ph, int i) {
+    Insn *a = &ph->code[i];
+    int j = next_insn(ph, i);
+    if (a->op != I_MOV || !is_reg(&a->dst, R_EAX) || j >= ph->n) return 0;
+    Insn *b = &ph->code[j];
+    if (b->op != I_MOV || !is_reg(&b->src, R_EAX) || (address_regs(&b->dst) & BIT(R_EAX))) return 0;
+    if (!pair_encodable(&b->dst, &a->src) || !dead_after(ph, j, R_EAX)) return 0;
+    b->src = a->src;
+    kill(a);
+    return 1;
+}
+
+// mov eax, X; op eax, Y; mov X, eax -> op X, Y
+static int rule_alu_in_place(Peephole *ph, int i) {
+    Insn *a = &ph->code[i];
+    int j = next_insn(ph, i), k = next_insn(ph, j);
+    if (a->op != I_MOV || !is_reg(&a->dst, R_EAX) || k >= ph->n) return 0;
+    Insn *op = &ph->code[j], *b = &ph->code[k];
+    const Operand *x = &a->src;
+    switch (op->op) {
+        case I_ADD: case I_SUB: case I_AND: case I_OR: case I_XOR: break;
+        case I_SHL: case I_SHR: case I_SAR: break;
+        case I_IMUL: if (x->kind != OPK_REG || op->src.kind == OPK_NONE) return 0; break;
+        default: return 0;
+    }
+    if (!is_reg(&op->dst, R_EAX) || (operand_regs(&op->src) & BIT(R_EAX))) return 0;
+    if (b->op != I_MOV || !is_reg(&b->src, R_EAX) || !same_operand(&b->dst, x)) return 0;
+    if (x->kind != OPK_REG && x->kind != OPK_MEM) return 0;
+    if (!pair_encodable(x, &op->src)) return 0;
+    if (!dead_after(ph, k, R_EAX)) return 0;
+    op->dst = *x;
+    kill(a);
+    kill(b);
+    return 1;
+}
+
+typedef int (*PeepholeFn)(Peephole *ph, int i);
+
+// Rules are keyed by the mnemonic of the first instruction they match; the
+// setcc rule is filed under I_SETE for all six
+static struct {
+    const char *name;
+    unsigned char first;
+    PeepholeFn apply;
+    long hits;
+} rules[] = {
+    { "self-move", I_MOV, rule_self_move, 0 },
+    { "store-reload", I_MOV, rule_store_reload, 0 },
+    { "compare-direct", I_MOV, rule_compare_direct, 0 },
+    { "move-through-eax", I_MOV, rule_move_through_eax, 0 },
+    { "alu-in-place", I_MOV, rule_alu_in_place, 0 },
+    { "push-pop", I_PUSH, rule_push_pop, 0 },
+    { "jump-to-next", I_JMP, rule_jump_to_next, 0 },
+    { "setcc-branch", I_SETE, rule_setcc_branch, 0 },
+};
+
+#define NUM_RULES ((int)(sizeof(rules) / sizeof(rules[0])))
+
+static Peephole peephole;
+
+// Previous instruction before i that is not a comment, or i if none
+static int prev_insn(const Peephole *ph, int i) {
+    for (int j = i - 1; j >= 0; --j)
+        if (ph->code[j].op != I_COMMENT) return j;
+    return i;
+}
+
+int x86_peephole(Insn *code, int n) {
+    Peephole *ph = &peephole;
+    ph->code = code;
+    ph->n = n;
+    index_labels(ph);
+    // One forward sweep. Every rule removes at least one instruction, and
+    // after a rewrite the sweep steps back two, as far as a rule's window
+    // can reach, so rules can match across the new code.
+    for (int i = 0; i < n; ) {
+        int op = code[i].op;
+        if (op >= I_SETE && op <= I_SETGE) op = I_SETE;
+        int fired = 0;
+        if (op != I_COMMENT && op != I_LABEL) {
+            for (int r = 0; r < NUM_RULES && !fired; ++r) {
+                if (rules[r].first == op && rules[r].apply(ph, i)) {
+                    rules[r].hits++;
+                    fired = 1;
+                }
+            }
+        }
+        i = fired ? prev_insn(ph, prev_insn(ph, i)) : i + 1;
+    }
+    // Drop what the rules removed
+    int w = 0;
+    for (int i = 0; i < n; ++i)
+        if (!is_blank(&code[i])) code[w++] = code[i];
+    return w;
+}
+
+void x86_peephole_report(FILE *f) {
+    for (int r = 0; r < NUM_RULES; ++r)
+        fprintf(f, "peephole: %-18s %ld\n", rules[r].name, rules[r].hits);
+}
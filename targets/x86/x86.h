@@ -0,0 +1,176 @@
+#ifndef X86_H
+#define X86_H
+
+#include <stdint.h>
+#include "../../b.h"
+
+// --- Structured IA-32 instructions ---
+// The code generator describes every instruction with an Insn; the -S path
+// prints it as Intel syntax and the JIT path encodes it straight to bytes.
+// In 64-bit mode the same instructions operate on 64-bit registers and
+// words, r8-r15 become available and a symbol operand is RIP-relative.
+
+typedef enum {
+    R_EAX, R_ECX, R_EDX, R_EBX, R_ESP, R_EBP, R_ESI, R_EDI,
+    R_R8, R_R9, R_R10, R_R11, R_R12, R_R13, R_R14, R_R15,   // 64-bit mode only
+    REG_NONE = 0xff
+} Reg;
+
+// Set for the x86-64 target: read by the printer, encoder and code generator
+extern int x86_mode64;
+
+extern const char x86_reg_names[8][4];
+extern const char x86_reg64_names[16][4];
+extern const char x86_reg8_names[4][3];  // al, cl, dl, bl
+
+// Name of a full-width register in the current mode
+const char *x86_reg_name(int r);
+
+typedef enum {
+    // Pseudo instructions
+    I_LABEL,     // .L<n>: or .L_<name>:            (dst: label)
+    I_FUNC,      // .globl <name> / <name>:         (dst: symbol)
+    I_COMMENT,   // whole-line comment, note only
+    // Real instructions; I_CDQ is cqo in 64-bit mode
+    I_MOV, I_MOVZX, I_LEA, I_PUSH, I_POP, I_XCHG,
+    I_ADD, I_SUB, I_AND, I_OR, I_XOR, I_CMP, I_TEST,
+    I_IMUL, I_CDQ, I_IDIV, I_NEG, I_INC, I_DEC, I_SHL, I_SHR, I_SAR,
+    I_SETE, I_SETNE, I_SETL, I_SETG, I_SETLE, I_SETGE,
+    I_JMP, I_JZ, I_JNZ, I_JL, I_JG, I_JLE, I_JGE,
+    I_CALL, I_RET,
+    I_COUNT
+} Mnemonic;
+
+extern const char *const x86_mnemonic[I_COUNT];
+
+typedef enum {
+    OPK_NONE,
+    OPK_REG,     // 32-bit register (64-bit in 64-bit mode)
+    OPK_REG8,    // low byte register (al, cl, dl, bl)
+    OPK_IMM,     // immediate
+    OPK_MEM,     // dword (qword) at [sym + base + index*scale + disp]
+    OPK_LABEL,   // branch target inside the program: .L<n> or .L_<name>
+    OPK_SYM      // branch target by symbol name (call printf)
+} OperandKind;
+
+typedef struct {
+    unsigned char kind;
+    unsigned char base;    // REG/REG8: the register; MEM: base register or REG_NONE
+    unsigned char index;   // MEM: index register or REG_NONE
+    unsigned char scale;   // MEM: 1, 2, 4 or 8
+    int value;             // IMM: value; MEM: displacement; LABEL: label number
+    SymId sym;             // MEM: symbol address; LABEL: user label name; SYM: target
+} Operand;
+
+typedef struct {
+    unsigned char op;      // Mnemonic
+    Operand dst, src;
+    const char *note;      // comment for -S output, or NULL
+    SymId note_sym;        // name appended to the note, or SYM_NONE
+} Insn;
+
+// Operand constructors. They are compound literals rather than functions so
+// the default unoptimized build does not pay a call per operand.
+#define x86_operand(kind, base, value, sym) \
+    ((Operand){ (unsigned char)(kind), (unsigned char)(base), REG_NONE, 1, (value), (sym) })
+#define x86_none() x86_operand(OPK_NONE, REG_NONE, 0, SYM_NONE)
+#define x86_reg(r) x86_operand(OPK_REG, r, 0, SYM_NONE)
+#define x86_reg8(r) x86_operand(OPK_REG8, r, 0, SYM_NONE)
+#define x86_imm(v) x86_operand(OPK_IMM, REG_NONE, v, SYM_NONE)
+#define x86_mem(base, disp) x86_operand(OPK_MEM, base, disp, SYM_NONE)
+#define x86_mem_sym(sym) x86_operand(OPK_MEM, REG_NONE, 0, sym)
+#define x86_mem_index(base, index, scale) \
+    ((Operand){ OPK_MEM, (unsigned char)(base), (unsigned char)(index), (unsigned char)(scale), 0, SYM_NONE })
+#define x86_label(n) x86_operand(OPK_LABEL, REG_NONE, n, SYM_NONE)
+#define x86_user_label(name) x86_operand(OPK_LABEL, REG_NONE, -1, name)
+#define x86_target(name) x86_operand(OPK_SYM, REG_NONE, 0, name)
+
+// --- Encoder ---
+#define X86_MAX_INSN 16
+
+// The 32-bit field of an encoded instruction that names a label or symbol
+typedef struct {
+    int at;        // byte offset inside the instruction, -1 if none
+    int pcrel;     // 1: rel32 from the end of the field; 0: absolute address
+} X86Fixup;
+
+// Encode one real instruction into buf. Returns its length, or -1 if the
+// operand combination has no encoding. Symbol and label fields are left as
+// the displacement (or zero) and described in *fix for the caller to patch.
+int x86_encode(const Insn *in, unsigned char *buf, X86Fixup *fix);
+
+// --- In-memory object code ---
+// What the direct emitter produces for the JIT: position-independent code
+// with internal branches already resolved, data, symbol definitions and the
+// relocations still needed against symbol addresses.
+typedef enum { RELOC_ABS32, RELOC_REL32 } RelocKind;   // both add to the field
+
+typedef struct {
+    int offset;            // position of the 32-bit field in code
+    SymId sym;
+    unsigned char kind;    // RelocKind
+} CodeReloc;
+
+typedef struct {
+    SymId name;
+    int offset;
+    unsigned char in_data; // offset is into data rather than code
+} CodeSymbol;
+
+typedef struct {
+    unsigned char *code;
+    int code_size, code_cap;
+    unsigned char *data;
+    int data_size, data_cap;
+    CodeSymbol *symbols;
+    int num_symbols, cap_symbols;
+    CodeReloc *relocs;
+    int num_relocs, cap_relocs;
+} MCode;
+
+// Grow a vector so it has room for `need` elements
+void *grow_vec(void *items, int *cap, int need, size_t elem);
+
+void mcode_symbol(MCode *mc, SymId name, int offset, int in_data);
+void mcode_data(MCode *mc, const void *bytes, int n);
+// Encode one real instruction at the end of the code. Symbol operands get a
+// relocation; a label operand's rel32 field is left zero and its offset put
+// in *label_at (otherwise -1) for the caller to patch. Returns -1 if the
+// operands have no encoding.
+int mcode_insn(MCode *mc, const Insn *in, int *label_at);
+void mcode_free(MCode *mc);
+
+// --- Peephole optimizer ---
+// Rewrite one function's instructions in place and return the new count
+int x86_peephole(Insn *code, int n);
+// Print how many times each rule fired
+void x86_peephole_report(FILE *f);
+
+// Compile a program to MCode without going through assembly text.
+// Returns 0 on success; the caller frees the buffers with mcode_free.
+int generate_x86_code(ASTNode *ast, MCode *mc);
+long x86_program_size(ASTNode *ast);
+
+// -fomit-frame-pointer: frames are addressed from esp and ebp holds a
+// variable; leaf functions with no locals in memory go without a frame
+// pointer either way
+extern int omit_frame_pointer;
+
+// -fcache-dir=DIR: keep each compiled function (targets/x86/fncache.c) and
+// meta block (as_jit.c) in DIR and take it from there while it is
+// unchanged; NULL turns the caches off
+extern const char *fn_cache_dir;
+
+// What the caches did so far; skipped counts functions that cannot be kept
+typedef struct {
+    int hits, misses, skipped;
+    int meta_hits, meta_misses;
+} FnCacheStats;
+extern FnCacheStats fn_cache_stats;
+
+// Identifies the compiler build, for keys of on-disk caches
+const char *b_build_id(void);
+// 64-bit FNV-1a of a key, which names its cache entry
+uint64_t cache_hash(const void *p, size_t n);
+
+#endif // X86_H
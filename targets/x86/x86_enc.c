@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "x86.h"
+
+// Binary encoder for the instructions the x86 backend produces
+
+const char *const x86_mnemonic[I_COUNT] = {
+    [I_LABEL] = "", [I_FUNC] = "", [I_COMMENT] = "",
+    [I_MOV] = "mov", [I_MOVZX] = "movzx", [I_LEA] = "lea", [I_PUSH] = "push", [I_POP] = "pop",
+    [I_XCHG] = "xchg",
+    [I_ADD] = "add", [I_SUB] = "sub", [I_AND] = "and", [I_OR] = "or", [I_XOR] = "xor",
+    [I_CMP] = "cmp", [I_TEST] = "test",
+    [I_IMUL] = "imul", [I_CDQ] = "cdq", [I_IDIV] = "idiv", [I_NEG] = "neg",
+    [I_INC] = "inc", [I_DEC] = "dec", [I_SHL] = "shl", [I_SHR] = "shr", [I_SAR] = "sar",
+    [I_SETE] = "sete", [I_SETNE] = "setne", [I_SETL] = "setl", [I_SETG] = "setg",
+    [I_SETLE] = "setle", [I_SETGE] = "setge",
+    [I_JMP] = "jmp", [I_JZ] = "jz", [I_JNZ] = "jnz",
+    [I_JL] = "jl", [I_JG] = "jg", [I_JLE] = "jle", [I_JGE] = "jge",
+    [I_CALL] = "call", [I_RET] = "ret"
+};
+
+int x86_mode64 = 0;
+
+const char x86_reg_names[8][4] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+const char x86_reg64_names[16][4] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+const char x86_reg8_names[4][3] = { "al", "cl", "dl", "bl" };
+
+const char *x86_reg_name(int r) {
+    return x86_mode64 ? x86_reg64_names[r] : x86_reg_names[r];
+}
+
+// --- Encoding table ---
+// Each row is one encoding of a mnemonic for a pair of operand classes.
+// Rows for the same mnemonic are tried in order, so short immediate forms
+// come before their imm32 fallbacks.
+
+typedef enum {
+    C_NONE,
+    C_R32,     // 32-bit register
+    C_EAX,     // eax, for the short accumulator forms
+    C_R8,      // byte register
+    C_CL,      // cl, as a shift count
+    C_RM32,    // 32-bit register or memory
+    C_M32,     // memory
+    C_IMM8,    // immediate that fits in a signed byte
+    C_IMM32,   // any immediate
+    C_REL      // label or symbol, as a rel32 target
+} OperandClass;
+
+typedef enum {
+    F_ZO,      // opcode only
+    F_O,       // register in the low opcode bits (dst)
+    F_OI,      // register in the opcode (dst), immediate (src); with C_EAX
+               // the register adds nothing and this is the accumulator form
+    F_I,       // immediate (dst)
+    F_MR,      // ModR/M: rm = dst, reg = src
+    F_RM,      // ModR/M: reg = dst, rm = src
+    F_M,       // ModR/M: rm = dst, reg = opcode extension
+    F_MI,      // ModR/M: rm = dst, reg = extension, immediate (src)
+    F_RMI,     // ModR/M: reg = rm = dst, immediate (src)
+    F_D        // rel32 displacement (dst)
+} EncodingForm;
+
+typedef struct {
+    unsigned char op;          // Mnemonic
+    unsigned char dst, src;    // OperandClass
+    unsigned char form;        // EncodingForm
+    unsigned char oplen;
+    unsigned char opcode[2];
+    unsigned char ext;         // ModR/M reg field for F_M and F_MI
+    unsigned char imm;         // immediate size in bytes
+} Encoding;
+
+#define E0(m, f, o) { m, C_NONE, C_NONE, f, 1, { o, 0 }, 0, 0 }
+#define E1(m, d, f, o, x, i) { m, d, C_NONE, f, 1, { o, 0 }, x, i }
+#define E2(m, d, s, f, o, x, i) { m, d, s, f, 1, { o, 0 }, x, i }
+#define E2X(m, d, s, f, o0, o1) { m, d, s, f, 2, { o0, o1 }, 0, 0 }
+#define ALU(m, x) \
+    E2(m, C_RM32, C_R32, F_MR, (x) << 3 | 1, 0, 0), \
+    E2(m, C_R32, C_M32, F_RM, (x) << 3 | 3, 0, 0), \
+    E2(m, C_RM32, C_IMM8, F_MI, 0x83, x, 1), \
+    E2(m, C_EAX, C_IMM32, F_OI, (x) << 3 | 5, 0, 4), \
+    E2(m, C_RM32, C_IMM32, F_MI, 0x81, x, 4)
+#define SETCC(m, o) { m, C_R8, C_NONE, F_M, 2, { 0x0F, o }, 0, 0 }
+
+static const Encoding encodings[] = {
+    E2(I_MOV, C_R32, C_IMM32, F_OI, 0xB8, 0, 4),
+    E2(I_MOV, C_R8, C_R8, F_MR, 0x88, 0, 0),
+    E2(I_MOV, C_RM32, C_R32, F_MR, 0x89, 0, 0),
+    E2(I_MOV, C_R32, C_M32, F_RM, 0x8B, 0, 0),
+    E2(I_MOV, C_RM32, C_IMM32, F_MI, 0xC7, 0, 4),
+    E2X(I_MOVZX, C_R32, C_R8, F_RM, 0x0F, 0xB6),
+    E2(I_LEA, C_R32, C_M32, F_RM, 0x8D, 0, 0),
+    E1(I_PUSH, C_R32, F_O, 0x50, 0, 0),
+    E1(I_PUSH, C_IMM8, F_I, 0x6A, 0, 1),
+    E1(I_PUSH, C_IMM32, F_I, 0x68, 0, 4),
+    E1(I_PUSH, C_M32, F_M, 0xFF, 6, 0),
+    E1(I_POP, C_R32, F_O, 0x58, 0, 0),
+    E2(I_XCHG, C_R32, C_EAX, F_O, 0x90, 0, 0),
+    E2(I_XCHG, C_RM32, C_R32, F_MR, 0x87, 0, 0),
+    ALU(I_ADD, 0), ALU(I_OR, 1), ALU(I_AND, 4), ALU(I_SUB, 5), ALU(I_XOR, 6), ALU(I_CMP, 7),
+    E2(I_TEST, C_RM32, C_R32, F_MR, 0x85, 0, 0),
+    E2(I_TEST, C_EAX, C_IMM32, F_OI, 0xA9, 0, 4),
+    E2(I_TEST, C_RM32, C_IMM32, F_MI, 0xF7, 0, 4),
+    E2X(I_IMUL, C_R32, C_RM32, F_RM, 0x0F, 0xAF),
+    E2(I_IMUL, C_R32, C_IMM8, F_RMI, 0x6B, 0, 1),
+    E2(I_IMUL, C_R32, C_IMM32, F_RMI, 0x69, 0, 4),
+    E1(I_IMUL, C_RM32, F_M, 0xF7, 5, 0),      // edx:eax = eax * rm
+    E0(I_CDQ, F_ZO, 0x99),
+    E1(I_IDIV, C_RM32, F_M, 0xF7, 7, 0),
+    E1(I_NEG, C_RM32, F_M, 0xF7, 3, 0),
+    E1(I_INC, C_R32, F_O, 0x40, 0, 0),
+    E1(I_INC, C_RM32, F_M, 0xFF, 0, 0),
+    E1(I_DEC, C_R32, F_O, 0x48, 0, 0),
+    E1(I_DEC, C_RM32, F_M, 0xFF, 1, 0),
+    E2(I_SHL, C_RM32, C_CL, F_M, 0xD3, 4, 0),
+    E2(I_SHL, C_RM32, C_IMM8, F_MI, 0xC1, 4, 1),
+    E2(I_SHR, C_RM32, C_CL, F_M, 0xD3, 5, 0),
+    E2(I_SHR, C_RM32, C_IMM8, F_MI, 0xC1, 5, 1),
+    E2(I_SAR, C_RM32, C_CL, F_M, 0xD3, 7, 0),
+    E2(I_SAR, C_RM32, C_IMM8, F_MI, 0xC1, 7, 1),
+    SETCC(I_SETE, 0x94), SETCC(I_SETNE, 0x95), SETCC(I_SETL, 0x9C),
+    SETCC(I_SETGE, 0x9D), SETCC(I_SETLE, 0x9E), SETCC(I_SETG, 0x9F),
+    E1(I_JMP, C_REL, F_D, 0xE9, 0, 0),
+    E1(I_JMP, C_RM32, F_M, 0xFF, 4, 0),
+    { I_JZ, C_REL, C_NONE, F_D, 2, { 0x0F, 0x84 }, 0, 0 },
+    { I_JNZ, C_REL, C_NONE, F_D, 2, { 0x0F, 0x85 }, 0, 0 },
+    { I_JL, C_REL, C_NONE, F_D, 2, { 0x0F, 0x8C }, 0, 0 },
+    { I_JGE, C_REL, C_NONE, F_D, 2, { 0x0F, 0x8D }, 0, 0 },
+    { I_JLE, C_REL, C_NONE, F_D, 2, { 0x0F, 0x8E }, 0, 0 },
+    { I_JG, C_REL, C_NONE, F_D, 2, { 0x0F, 0x8F }, 0, 0 },
+    E1(I_CALL, C_REL, F_D, 0xE8, 0, 0),
+    E1(I_CALL, C_RM32, F_M, 0xFF, 2, 0),
+    E0(I_RET, F_ZO, 0xC3),
+};
+
+#define NUM_ENCODINGS ((int)(sizeof(encodings) / sizeof(encodings[0])))
+
+// by_mnemonic[first_encoding[m] .. first_encoding[m + 1]) lists the rows for
+// mnemonic m in table order; built on first use
+static unsigned char by_mnemonic[NUM_ENCODINGS];
+static int first_encoding[I_COUNT + 1];
+static int encodings_indexed = 0;
+
+static void index_encodings(void) {
+    int next[I_COUNT + 1] = { 0 };
+    for (int i = 0; i < NUM_ENCODINGS; ++i) first_encoding[encodings[i].op + 1]++;
+    for (int m = 0; m < I_COUNT; ++m) first_encoding[m + 1] += first_encoding[m];
+    memcpy(next, first_encoding, sizeof(next));
+    for (int i = 0; i < NUM_ENCODINGS; ++i) by_mnemonic[next[encodings[i].op]++] = (unsigned char)i;
+    encodings_indexed = 1;
+}
+
+static int fits8(int v) { return v >= -128 && v <= 127; }
+
+static int operand_matches(int cls, const Operand *o) {
+    switch (cls) {
+        case C_NONE: return o->kind == OPK_NONE;
+        case C_R32: return o->kind == OPK_REG;
+        case C_EAX: return o->kind == OPK_REG && o->base == R_EAX;
+        case C_R8: return o->kind == OPK_REG8;
+        case C_CL: return o->kind == OPK_REG8 && o->base == R_ECX;
+        case C_RM32: return o->kind == OPK_REG || o->kind == OPK_MEM;
+        case C_M32: return o->kind == OPK_MEM;
+        case C_IMM8: return o->kind == OPK_IMM && fits8(o->value);
+        case C_IMM32: return o->kind == OPK_IMM;
+        case C_REL: return o->kind == OPK_LABEL || o->kind == OPK_SYM;
+    }
+    return 0;
+}
+
+// Rows 64-bit mode cannot use: 40-4F are REX prefixes there, and B8+r with
+// REX.W takes a 64-bit immediate, so C7 /0 sign-extends an imm32 instead
+static int legacy_only(const Encoding *e) {
+    if (e->op == I_INC || e->op == I_DEC) return e->form == F_O;
+    return e->op == I_MOV && e->form == F_OI;
+}
+
+static const Encoding *find_encoding(const Insn *in) {
+    if (!encodings_indexed) index_encodings();
+    if (in->op >= I_COUNT) return NULL;
+    for (int i = first_encoding[in->op]; i < first_encoding[in->op + 1]; ++i) {
+        const Encoding *e = &encodings[by_mnemonic[i]];
+        if (x86_mode64 && legacy_only(e)) continue;
+        if (operand_matches(e->dst, &in->dst) && operand_matches(e->src, &in->src)) return e;
+    }
+    return NULL;
+}
+
+static void put32(unsigned char *p, int v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+// ModR/M (+SIB, +displacement) for a register or memory r/m operand.
+// Registers go in as their low three bits; the REX prefix carries the rest.
+// Returns the number of bytes written; *disp_at gets the offset of a
+// symbol displacement within them, or -1.
+static int encode_modrm(unsigned char *p, int reg, const Operand *rm, int *disp_at) {
+    *disp_at = -1;
+    reg &= 7;
+    if (rm->kind == OPK_REG || rm->kind == OPK_REG8) {
+        p[0] = (unsigned char)(0xC0 | (reg << 3) | (rm->base & 7));
+        return 1;
+    }
+    int n = 1;
+    int disp = rm->value;
+    int mod;
+    int base = rm->base;
+    if (base == REG_NONE && rm->index == REG_NONE) {
+        // [disp32], which 64-bit mode reads as [rip + disp32]
+        p[0] = (unsigned char)((reg << 3) | 5);
+        if (rm->sym) *disp_at = 1;
+        put32(p + 1, disp);
+        return 5;
+    }
+    if (base == REG_NONE)
+        mod = 0;   // [index*scale + disp32], forced by SIB base 101
+    else if (disp == 0 && !rm->sym && (base & 7) != R_EBP)
+        mod = 0;
+    else if (fits8(disp) && !rm->sym)
+        mod = 1;
+    else
+        mod = 2;
+    if (rm->index != REG_NONE || (base & 7) == R_ESP) {
+        int ss = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+        int index = rm->index == REG_NONE ? 4 : rm->index & 7;
+        p[0] = (unsigned char)((mod << 6) | (reg << 3) | 4);
+        p[1] = (unsigned char)((ss << 6) | (index << 3) | (base == REG_NONE ? 5 : base & 7));
+        n = 2;
+    } else {
+        p[0] = (unsigned char)((mod << 6) | (reg << 3) | (base & 7));
+    }
+    if (mod == 1) {
+        p[n++] = (unsigned char)disp;
+    } else if (mod == 2 || base == REG_NONE) {
+        if (rm->sym) *disp_at = n;
+        put32(p + n, disp);
+        n += 4;
+    }
+    return n;
+}
+
+// Whether an instruction already works on 64 bits, or on bytes, in 64-bit
+// mode, so it takes no REX.W
+static int no_rex_w(const Encoding *e) {
+    switch (e->op) {
+        case I_PUSH: case I_POP: case I_CALL: case I_RET: case I_JMP:
+        case I_JZ: case I_JNZ: case I_JL: case I_JG: case I_JLE: case I_JGE:
+            return 1;
+        default:
+            return e->dst == C_R8;
+    }
+}
+
+// REX prefix for 64-bit mode: W for 64-bit operands, R, X and B for the
+// upper registers in the ModR/M reg field, the SIB index and the base
+static int rex_prefix(const Encoding *e, int reg, const Operand *rm, int opreg) {
+    int rex = no_rex_w(e) ? 0 : 8;
+    if (reg >= 8) rex |= 4;
+    if (rm && rm->kind == OPK_MEM && rm->index != REG_NONE && rm->index >= 8) rex |= 2;
+    if (rm && rm->base != REG_NONE && rm->base >= 8) rex |= 1;
+    if (opreg >= 8) rex |= 1;
+    return rex ? 0x40 | rex : 0;
+}
+
+int x86_encode(const Insn *in, unsigned char *buf, X86Fixup *fix) {
+    const Encoding *e = find_encoding(in);
+    fix->at = -1;
+    fix->pcrel = 0;
+    if (!e) return -1;
+    const Operand *d = &in->dst, *s = &in->src;
+    const Operand *imm = NULL;
+    const Operand *rm = NULL;
+    int reg = 0, opreg = -1;
+    switch (e->form) {
+        case F_ZO: case F_D: break;
+        case F_O: opreg = d->base; break;
+        case F_OI: opreg = d->base; imm = s; break;
+        case F_I: imm = d; break;
+        case F_MR: reg = s->base; rm = d; break;
+        case F_RM: reg = d->base; rm = s; break;
+        case F_M: reg = e->ext; rm = d; break;
+        case F_MI: reg = e->ext; rm = d; imm = s; break;
+        case F_RMI: reg = d->base; rm = d; imm = s; break;
+    }
+    int n = 0;
+    if (x86_mode64) {
+        int rex = rex_prefix(e, reg, rm, opreg);
+        if (rex) buf[n++] = (unsigned char)rex;
+    }
+    int prefix = n;
+    memcpy(buf + n, e->opcode, e->oplen);
+    n += e->oplen;
+    if (opreg >= 0) buf[n - 1] = (unsigned char)(buf[n - 1] + (opreg & 7));
+    if (e->form == F_D) {
+        put32(buf + n, 0);
+        fix->at = n;
+        fix->pcrel = 1;
+        return n + 4;
+    }
+    int disp_at = -1;
+    if (rm) n += encode_modrm(buf + n, reg, rm, &disp_at);
+    if (disp_at >= 0) fix->at = prefix + e->oplen + disp_at;
+    if (imm) {
+        if (e->imm == 1) buf[n++] = (unsigned char)imm->value;
+        else { put32(buf + n, imm->value); n += 4; }
+    }
+    if (x86_mode64 && fix->at >= 0 && rm->base == REG_NONE && rm->index == REG_NONE) {
+        // RIP-relative: the field is read from the end of the instruction,
+        // which is past any immediate
+        int field;
+        memcpy(&field, buf + fix->at, 4);
+        put32(buf + fix->at, field - (n - fix->at - 4));
+        fix->pcrel = 1;
+    }
+    return n;
+}
+
+// --- In-memory object code ---
+
+void *grow_vec(void *items, int *cap, int need, size_t elem) {
+    if (need <= *cap) return items;
+    int n = *cap ? *cap : 64;
+    while (n < need) n *= 2;
+    items = realloc(items, (size_t)n * elem);
+    if (!items) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    *cap = n;
+    return items;
+}
+
+void mcode_symbol(MCode *mc, SymId name, int offset, int in_data) {
+    mc->symbols = (CodeSymbol*)grow_vec(mc->symbols, &mc->cap_symbols, mc->num_symbols + 1, sizeof(CodeSymbol));
+    mc->symbols[mc->num_symbols].name = name;
+    mc->symbols[mc->num_symbols].offset = offset;
+    mc->symbols[mc->num_symbols].in_data = (unsigned char)in_data;
+    mc->num_symbols++;
+}
+
+void mcode_data(MCode *mc, const void *bytes, int n) {
+    mc->data = (unsigned char*)grow_vec(mc->data, &mc->data_cap, mc->data_size + n, 1);
+    memcpy(mc->data + mc->data_size, bytes, n);
+    mc->data_size += n;
+}
+
+int mcode_insn(MCode *mc, const Insn *in, int *label_at) {
+    *label_at = -1;
+    mc->code = (unsigned char*)grow_vec(mc->code, &mc->code_cap, mc->code_size + X86_MAX_INSN, 1);
+    X86Fixup fix;
+    int n = x86_encode(in, mc->code + mc->code_size, &fix);
+    if (n < 0) return -1;
+    if (fix.at >= 0) {
+        int at = mc->code_size + fix.at;
+        const Operand *ref = in->dst.kind == OPK_LABEL || in->dst.kind == OPK_SYM ||
+                             (in->dst.kind == OPK_MEM && in->dst.sym) ? &in->dst : &in->src;
+        if (ref->kind == OPK_LABEL) {
+            *label_at = at;
+        } else {
+            mc->relocs = (CodeReloc*)grow_vec(mc->relocs, &mc->cap_relocs, mc->num_relocs + 1, sizeof(CodeReloc));
+            mc->relocs[mc->num_relocs].offset = at;
+            mc->relocs[mc->num_relocs].sym = ref->sym;
+            mc->relocs[mc->num_relocs].kind = fix.pcrel ? RELOC_REL32 : RELOC_ABS32;
+            mc->num_relocs++;
+        }
+    }
+    mc->code_size += n;
+    return 0;
+}
+
+void mcode_free(MCode *mc) {
+    free(mc->code);
+    free(mc->data);
+    free(mc->symbols);
+    free(mc->relocs);
+    memset(mc, 0, sizeof(*mc));
+}
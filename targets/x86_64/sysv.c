@@ -0,0 +1,137 @@
+// --- x86-64 System V calling convention ---
+// The 64-bit target shares the x86 code generator in targets/x86/b2as.c
+// (included before this file) and differs from it only in how arguments
+// travel. The first six go in rdi, rsi, rdx, rcx, r8 and r9, the rest on
+// the stack right to left; the stack is 16-byte aligned at every call, and
+// al holds the number of vector registers a variadic callee gets (none).
+
+#define SYSV_ARG_REGS 6
+static const Reg sysv_arg_regs[SYSV_ARG_REGS] = { R_EDI, R_ESI, R_EDX, R_ECX, R_R8, R_R9 };
+
+// Frame variable of each register parameter, or -1
+static int sysv_param_vars[SYSV_ARG_REGS];
+
+// Register parameters get the first slots below rbp, where the prologue
+// stores them unless they live in a register; the others stay where the
+// caller put them, at [rbp+16] and up.
+static void add_params_sysv(ASTNodeList *paramlist) {
+    for (int i = 0; i < SYSV_ARG_REGS; ++i) sysv_param_vars[i] = -1;
+    for (int i = 0; i < paramlist->count; ++i) {
+        SymId name = paramlist->items[i]->data.var.name;
+        if (i >= SYSV_ARG_REGS) {
+            add_frame_var(name, 16 + 8 * (i - SYSV_ARG_REGS));
+        } else if (add_frame_var(name, -8 * (num_locals + 1))) {
+            sysv_param_vars[i] = num_frame_vars - 1;
+            num_locals++;
+        }
+    }
+}
+
+// Move the register parameters to where the body expects them
+static void gen_params_sysv(AsmOut *out) {
+    for (int i = 0; i < SYSV_ARG_REGS; ++i) {
+        if (sysv_param_vars[i] < 0) continue;
+        FrameVar *v = &frame[sysv_param_vars[i]];
+        Operand home = v->reg != REG_NONE ? x86_reg((Reg)v->reg) : FRAME_MEM(v->offset);
+        emit(out, I_MOV, home, x86_reg(sysv_arg_regs[i]), "param ", v->name);
+    }
+}
+
+// Register arguments are still evaluated right to left. Those that need
+// code wait on the stack until all are done; constants and variables are
+// moved in last, unless a later evaluation could change them. An indirect
+// callee ends up in r11.
+static void load_reg_args_sysv(ASTNode *expr, int in_regs, AsmOut *out) {
+    int keep_order = has_side_effects(expr->data.call.left);
+    for (int j = 0; j < in_regs; ++j)
+        keep_order |= has_side_effects(expr->data.call.args.items[j]);
+    unsigned pushed = 0;
+    for (int j = in_regs - 1; j >= 0; --j) {
+        ASTNode *arg = expr->data.call.args.items[j];
+        Operand op;
+        if (leaf_operand(arg, &op)) {
+            if (!keep_order) continue;
+            INS1(I_PUSH, op, "arg");
+        } else {
+            gen_expr(arg, out);
+            INS1(I_PUSH, EAX, "arg");
+        }
+        UPDATE_STACK_PUSH();
+        pushed |= 1u << j;
+    }
+    ASTNode *callee = expr->data.call.name ? NULL : expr->data.call.left;
+    Operand target;
+    if (callee && leaf_operand(callee, &target)) {
+        INS2(I_MOV, x86_reg(R_R11), target, NULL);
+    } else if (callee) {
+        gen_expr(callee, out);
+        INS2(I_MOV, x86_reg(R_R11), EAX, NULL);
+    }
+    for (int j = 0; j < in_regs; ++j) {
+        if (pushed & (1u << j)) {
+            INS1(I_POP, x86_reg(sysv_arg_regs[j]), "arg");
+            UPDATE_STACK_POP();
+        }
+    }
+    for (int j = 0; j < in_regs; ++j) {
+        Operand op;
+        if (!(pushed & (1u << j)) && leaf_operand(expr->data.call.args.items[j], &op))
+            INS2(I_MOV, x86_reg(sysv_arg_regs[j]), op, "arg");
+    }
+}
+
+static void gen_call_sysv(ASTNode *expr, AsmOut *out) {
+    unsigned live = save_temps(out);
+    int argc = expr->data.call.args.count;
+    int in_regs = argc < SYSV_ARG_REGS ? argc : SYSV_ARG_REGS;
+    int on_stack = argc - in_regs;
+    // rsp is the frame base + stack_offset here, and the base is 16-byte
+    // aligned
+    int pad = (8 * on_stack - stack_offset) & 15;
+    if (pad) {
+        INS2(I_SUB, ESP, IMM(pad), "align call");
+        UPDATE_STACK_SUB(pad);
+    }
+    for (int j = argc - 1; j >= in_regs; --j) {
+        ASTNode *arg = expr->data.call.args.items[j];
+        Operand op;
+        if (leaf_operand(arg, &op)) {
+            INS1(I_PUSH, op, "arg");
+        } else {
+            gen_expr(arg, out);
+            INS1(I_PUSH, EAX, "arg");
+        }
+        UPDATE_STACK_PUSH();
+    }
+    load_reg_args_sysv(expr, in_regs, out);
+    int known = expr->data.call.name && is_function(expr->data.call.name);
+    ASTNode *callee = expr->data.call.name ? NULL : expr->data.call.left;
+    // B functions take no variadic arguments; anything else might
+    if (!known) INS2(I_XOR, EAX, EAX, "no vector args");
+    if (expr->data.call.name) {
+        INS1(I_CALL, x86_target(expr->data.call.name), NULL);
+    } else if (callee) {
+        INS1(I_CALL, x86_reg(R_R11), "indirect call");
+    } else {
+        INS0(I_COMMENT, " invalid call node");
+    }
+    int cleanup = 8 * on_stack + pad;
+    if (cleanup > 0) {
+        INS2(I_ADD, ESP, IMM(cleanup), "cleanup args+align");
+        UPDATE_STACK_ADD(cleanup);
+    }
+    restore_temps(out, live);
+}
+
+// A tail call whose arguments all travel in registers: load them as for a
+// call, leave the frame and jump, with rsp where our caller left it
+static int gen_tail_call_sysv(ASTNode *expr, AsmOut *out) {
+    int argc = expr->data.call.args.count;
+    if (argc > SYSV_ARG_REGS || (!expr->data.call.name && !expr->data.call.left)) return 0;
+    load_reg_args_sysv(expr, argc, out);
+    if (!(expr->data.call.name && is_function(expr->data.call.name)))
+        INS2(I_XOR, EAX, EAX, "no vector args");
+    gen_frame_exit(out);
+    INS1(I_JMP, expr->data.call.name ? x86_target(expr->data.call.name) : x86_reg(R_R11), "tail call");
+    return 1;
+}
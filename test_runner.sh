@@ -1,5 +1,7 @@
 #!/bin/bash
 B_PARSER=./b
+# Target and link flag, e.g. -m32; empty for the host
+ARCH=${ARCH:-}
 ASM=out.s
 EXE=out
 PASS=0
@@ -13,8 +15,8 @@ for bfile in tests/*.b; do
     # Generate assembly filename based on input .b file
     asm_file="${bfile%.b}.s"
     exe_file="${bfile%.b}.out"
-    $B_PARSER -S "$bfile" > "$asm_file"
-    gcc -m32 -fno-pie -no-pie -o "$exe_file" "$asm_file"
+    $B_PARSER $ARCH -S "$bfile" > "$asm_file"
+    gcc $ARCH -fno-pie -no-pie -o "$exe_file" "$asm_file"
     if [ -n "$expected_exit" ]; then
         ./$exe_file > actual.out 2>&1 || true
         actual_exit=$?
@@ -39,6 +41,75 @@ for bfile in tests/*.b; do
     fi
 done
 
+# C backend: each test translated with -emit=c and built by the host C
+# compiler must print the same. The meta tests are left out, their blocks
+# print assembler comments into the output, which C does not accept
+for bfile in tests/*.b; do
+    case "$bfile" in *meta*) continue ;; esac
+    echo "Testing $bfile with -emit=c"
+    expected=$(awk '/^\/\/ EXPECTED/{flag=1; next} /^$/{flag=0} flag' "$bfile" | sed 's/^\/\/[ ]*//;s/^ *//;s/[\r\n]*$//')
+    c_file="${bfile%.b}.c"
+    exe_file="${bfile%.b}.c.out"
+    if ! $B_PARSER $ARCH -emit=c "$bfile" > "$c_file" || ! cc $ARCH -fwrapv -w -o "$exe_file" "$c_file"; then
+        echo "  FAIL (C build)"
+        FAIL=$((FAIL+1))
+        continue
+    fi
+    actual=$(./$exe_file)
+    if [ "$actual" = "$expected" ]; then
+        echo "  PASS"
+        PASS=$((PASS+1))
+    else
+        echo "  FAIL"
+        echo "    Got:      $actual"
+        echo "    Expected: $expected"
+        FAIL=$((FAIL+1))
+    fi
+done
+
+# Per-function cache: compiled twice into a fresh cache directory, each test
+# must take every function from the cache the second time and print exactly
+# the assembly the uncached compile above did
+for bfile in tests/*.b; do
+    echo "Testing $bfile with -fcache-dir"
+    asm_file="${bfile%.b}.s"
+    cache_dir=$(mktemp -d)
+    $B_PARSER $ARCH -S -fcache-dir="$cache_dir" "$bfile" > /dev/null 2>&1
+    stats=$($B_PARSER $ARCH -S -fcache-dir="$cache_dir" -fcache-stats "$bfile" 2> cache.err > cached.s; grep -a '^cache:' cache.err)
+    rm -rf "$cache_dir"
+    if ! echo "$stats" | grep -Eq '^cache: [1-9][0-9]* hits, 0 misses'; then
+        echo "  FAIL (second compile: $stats)"
+        FAIL=$((FAIL+1))
+    elif ! cmp -s cached.s "$asm_file"; then
+        echo "  FAIL (cached assembly differs from $asm_file)"
+        FAIL=$((FAIL+1))
+    else
+        echo "  PASS"
+        PASS=$((PASS+1))
+    fi
+done
+
+# Meta block cache: the second run maps each block's image from the cache
+# instead of compiling it, and must print the same as the first
+for bfile in tests/meta_demo.b tests/meta_meta_demo.b; do
+    echo "Testing $bfile with a cached meta block"
+    cache_dir=$(mktemp -d)
+    $B_PARSER $ARCH -S -fcache-dir="$cache_dir" "$bfile" > first.s 2>/dev/null
+    stats=$($B_PARSER $ARCH -S -fcache-dir="$cache_dir" -fcache-stats "$bfile" 2> cache.err > cached.s; grep -a '^cache:' cache.err)
+    rm -rf "$cache_dir"
+    if ! echo "$stats" | grep -Eq 'meta: [1-9][0-9]* hits'; then
+        echo "  FAIL (second compile: $stats)"
+        FAIL=$((FAIL+1))
+    elif ! cmp -s cached.s first.s || ! cmp -s cached.s "${bfile%.b}.s"; then
+        echo "  FAIL (output with the cached meta block differs)"
+        FAIL=$((FAIL+1))
+    else
+        echo "  PASS"
+        PASS=$((PASS+1))
+    fi
+done
+rm -f cached.s first.s cache.err
+
 echo "Tests passed: $PASS"
 echo "Tests failed: $FAIL"
 exit $FAIL 
\ No newline at end of file
@@ -3,7 +3,7 @@ main()
     auto str;
     extern printf;
 
-    str = "hello";
+    str = "hello, world";
     printf("%c %c %c %c %c", 
         str[0] & 255, 
         (str[0] >> 8) & 255, 
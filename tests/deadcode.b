@@ -0,0 +1,35 @@
+helper(x) { return x + 1; }
+unused(x) { return helper(x) * 2; }
+triple(x) { return x * 3; }
+
+pick(x) {
+    auto y;
+    if (x) return 1;
+    else return 2;
+    y = 5;
+    return y;
+}
+
+countdown(x) {
+    while (x) {
+        x--;
+        if (x == 3) { break; x = 100; }
+        continue;
+        x = 1000;
+    }
+    goto done;
+    x = 7;
+done:
+    return x;
+}
+
+main()
+{
+    extern printf;
+    auto f;
+    f = triple;
+    printf("%d %d %d %d", pick(0), countdown(10), (f)(4), helper(1));
+}
+
+// EXPECTED
+// 2 3 12 2
@@ -0,0 +1,68 @@
+g = 0;
+
+// Seven loops deep. Inlined into the twelve around its call in main they
+// nest nineteen deep, and every break and continue must still find its own
+deep(n) {
+    while (1) {
+        while (1) {
+            while (1) {
+                while (1) {
+                    while (1) {
+                        while (1) {
+                            while (n) {
+                                if (--n == 1) continue;
+                                g++;
+                            }
+                            break;
+                        }
+                        break;
+                    }
+                    break;
+                }
+                break;
+            }
+            break;
+        }
+        break;
+    }
+    return g;
+}
+
+main() {
+    extern printf;
+    auto a; auto b; auto c; auto d; auto e; auto f;
+    auto h; auto i; auto j; auto k; auto l; auto m;
+    auto x;
+    a = 0;
+    while (a < 2) { a++; b = 0;
+    while (b < 2) { b++; c = 0;
+    while (c < 2) { c++; d = 0;
+    while (d < 2) { d++; e = 0;
+    while (e < 2) { e++; f = 0;
+    while (f < 2) { f++; h = 0;
+    while (h < 2) { h++; i = 0;
+    while (i < 2) { i++; j = 0;
+    while (j < 2) { j++; k = 0;
+    while (k < 2) { k++; l = 0;
+    while (l < 2) { l++; m = 0;
+    while (m < 3) {
+        m++;
+        if (m == 2) continue;
+        x = deep(a + m);
+    }
+    if (l == 2) break; }
+    if (k == 2) break; }
+    if (j == 2) break; }
+    if (i == 2) break; }
+    if (h == 2) break; }
+    if (f == 2) break; }
+    if (e == 2) break; }
+    if (d == 2) break; }
+    if (c == 2) break; }
+    if (b == 2) break; }
+    if (a == 2) break; }
+    printf("%d %d %d", x, g, a * 100 + l * 10 + m);
+}
+
+// EXPECTED
+// 10240 10240 223
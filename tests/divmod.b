@@ -0,0 +1,18 @@
+id(x) { return x; }
+
+main()
+{
+    extern printf;
+    auto x;
+    auto y;
+
+    x = id(0 - 37);
+    y = id(1000);
+    printf("%d %d %d %d ", x / 4, x % 4, x / (0 - 8), x % 8);
+    printf("%d %d %d %d ", y / 7, y % 7, x / 10, x % (0 - 10));
+    printf("%d %d %d ", x * 10, y * 9, x * (0 - 4));
+    printf("%d %d", y / id(6), x % id(5));
+}
+
+// EXPECTED
+// -9 -1 4 -5 142 6 -3 -7 -370 9000 148 166 -2
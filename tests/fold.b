@@ -0,0 +1,34 @@
+size = 4 * 1024;
+mask = (1 << 8) - 1;
+big = 65536 * 65536;
+
+id(x) { return x; }
+
+// Named as a value below, so never inlined: its result is only known at
+// run time
+rt(x) { return x; }
+
+main()
+{
+    extern printf;
+    auto x;
+    auto w;
+
+    w = rt;
+    x = id(7);
+    printf("%d %d ", size, mask);
+    printf("%d %d %d ", x + 0, 0 - x, (x + 3) - 5);
+    printf("%d %d ", id(x) * 0, !(x < 3));
+    if (0) { auto z; z = 1; printf("no "); } else printf("else ");
+    while (0) printf("no ");
+    while (1) { if (++x == 10) break; }
+    printf("%d ", x);
+    // Folds match the generated code at either word size
+    if ((1 << 32) == 1) w = 1; else w = 0;
+    printf("%d %d %d ", big == rt(65536) * 65536, 65536 * 65536 == rt(65536) * rt(65536),
+           w == ((rt(1) << 32) == 1));
+    printf("%d %d", (rt(x) << 32) == (rt(x) << rt(32)), (0 - 1 >> 1) == (rt(0 - 1) >> 1));
+}
+
+// EXPECTED
+// 4096 255 7 -7 5 0 1 else 10 1 1 1 1 1
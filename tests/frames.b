@@ -0,0 +1,28 @@
+// Leaf functions run without a frame; their params stay on the stack
+mix(a, b, c, d, e, f) { return a - b + c * d - e + f * 2; }
+
+pick(a, b, c, d, e) {
+    if (a > b) return c;
+    if (d) return e;
+    return a + b + c + d + e;
+}
+
+// More locals than registers: these keep a frame
+spill(n) {
+    auto a; auto b; auto c; auto d; auto e;
+    a = n; b = a + 1; c = b + 2; d = c + 3; e = d + 4;
+    return a * b + c * d + e;
+}
+
+outer(x) { return mix(x, 1, 2, 3, 4, 5) + pick(x, 2, 3, 0, 9) + spill(x); }
+
+main() {
+    extern printf;
+    auto keep;
+    // Named as values, so none of them is inlined
+    keep = mix; keep = pick; keep = spill;
+    printf("%d %d %d %d", mix(10, 20, 3, 4, 5, 6), pick(5, 2, 7, 0, 0), spill(2), outer(1));
+}
+
+// EXPECTED
+// 9 7 58 68
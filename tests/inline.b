@@ -0,0 +1,46 @@
+n = 0;
+
+sq(x) { return x * x; }
+next() { return n++; }
+shifted(x) { return next() + x; }
+
+clamp(x, lo, hi) {
+    if (x < lo) return lo;
+    if (x > hi) return hi;
+    return x;
+}
+
+sum(k) {
+    auto s;
+    s = 0;
+    while (k > 0) { s = s + k; k--; }
+    return s;
+}
+
+skip(x) {
+    if (x) goto out;
+    n = n + 10;
+    out:
+    return n;
+}
+
+twice(f, x) { return (f)((f)(x)); }
+
+main()
+{
+    extern printf;
+    auto s;
+    auto x;
+
+    s = 3;
+    x = shifted(s);
+    printf("%d %d %d ", sq(s + 1), x, shifted(sq(2)));
+    x = clamp(s * 5, 0, 12);
+    printf("%d %d %d ", x, clamp(0 - 4, 0, 12), sum(s));
+    skip(0);
+    skip(1);
+    printf("%d %d %d", sum(sum(s)), n, twice(sq, 3));
+}
+
+// EXPECTED
+// 16 3 5 12 0 6 21 12 81
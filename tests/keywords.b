@@ -0,0 +1,22 @@
+main() {
+    extern printf;
+    auto ifx;
+    auto whiley;
+    auto autos;
+    auto returned;
+
+    ifx = 1;
+    whiley = 2;
+    autos = 3;
+    returned = ifx + whiley + autos;
+    if (returned == 6)
+        printf("%d ", returned);
+    if (ifx != 1)
+        printf("bad ");
+    if (whiley >= 2)
+        printf("%d ", whiley << 2);
+    printf("%d", autos <= 2);
+}
+
+// EXPECTED
+// 6 8 0
@@ -0,0 +1,75 @@
+g = 0;
+
+sum(n) {
+    auto i; auto s;
+    i = 0; s = 0;
+    while (i < n) { s = s + i; i++; }
+    return s;
+}
+
+upto(n) {
+    auto i; auto s;
+    i = 1; s = 0;
+    while (i <= n) { s = s + i * 2; ++i; }
+    return s;
+}
+
+scaled(n, a, b) {
+    auto i; auto s;
+    i = 0; s = 0;
+    while (i < n) { s = s + (a * b + i) / b; i = i + 1; }
+    return s;
+}
+
+// d == 0 must not be divided by when the loop never runs
+safe(n, d) {
+    auto i; auto s;
+    i = 0; s = 0;
+    while (i < n) { s = s + 100 / d; i++; }
+    return s;
+}
+
+bump() { g = g + 1; return 0; }
+
+// g changes through a call, x through a pointer
+moving(n) {
+    auto i; auto s; auto x; auto p;
+    i = 0; s = 0; x = 1; p = &x;
+    while (i < n) { s = s + g * 2 + x * 3; bump(); *p = *p + 1; i++; }
+    return s;
+}
+
+twice(p, n) {
+    auto i; auto s;
+    i = 0; s = 0;
+    while (i < n) {
+        s = s + *p * 2;
+        if (s > 20) break;
+        i++;
+    }
+    return s;
+}
+
+grid(n) {
+    auto i; auto j; auto s;
+    i = 0; s = 0;
+    while (i < n) {
+        j = 0;
+        while (j < n) { s = s + i * n + j; j++; }
+        i++;
+    }
+    return s;
+}
+
+main() {
+    extern printf;
+    auto x;
+    g = 0; x = 3;
+    printf("%d %d %d %d %d ", sum(0), sum(1), sum(3), sum(4), sum(10));
+    printf("%d %d %d ", upto(0), upto(5), upto(7));
+    printf("%d %d %d ", scaled(6, 3, 4), safe(0, 0), safe(5, 7));
+    printf("%d %d %d", moving(5), twice(&x, 10), grid(5));
+}
+
+// EXPECTED
+// 0 0 3 6 45 0 30 56 20 0 70 65 24 300
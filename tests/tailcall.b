@@ -0,0 +1,44 @@
+count(n, acc) {
+    if (n == 0) return acc;
+    return count(n - 1, acc + 2);
+}
+
+swap(a, b, k) {
+    if (k == 0) return a * 10 + b;
+    return swap(b, a, k - 1);
+}
+
+even(n) { if (n == 0) return 1; return odd(n - 1); }
+odd(n) { if (n == 0) return 0; return even(n - 1); }
+
+gcd(a, b) { if (b == 0) return a; return gcd(b, a % b); }
+digits(x, y, z) { return x + y * 10 + z * 100; }
+reverse(x, y, z) { return digits(z, y, x); }
+first(a, b, c) { return gcd(a, b); }
+apply(f, x, y) { return (f)(x, y, 0); }
+
+// guard passes pad one word of the five pad hands on: a sibling call would
+// store the other four over guard's frame
+keep(a, b, c, d, e) { return a; }
+pad(a, b, c, d, e) {
+    if (a < 0) return 0;
+    return keep(a + 1, 0, 0, 0, 0);
+}
+guard(x) {
+    auto s;
+    s = x * 3;
+    return pad(x) * 100 + s;
+}
+
+main()
+{
+    extern printf;
+    auto w;
+    w = keep; // not inlined
+    printf("%d %d %d %d ", count(100000, 0), swap(1, 2, 5), swap(1, 2, 6), even(10001));
+    printf("%d %d %d %d", gcd(1071, 462), reverse(1, 2, 3), first(12, 18, 5), apply(digits, 5, 6));
+    printf(" %d %d", guard(2), pad(4, 0, 0, 0, 0));
+}
+
+// EXPECTED
+// 200000 21 12 0 21 123 6 65 306 5